@@ -480,24 +480,59 @@ int CAddrMan::Check_()
 }
 #endif
 
-void CAddrMan::GetAddr_(std::vector<CAddress>& vAddr)
+void CAddrMan::FlushDeferred_()
 {
-    unsigned int nNodes = ADDRMAN_GETADDR_MAX_PCT * vRandom.size() / 100;
-    if (nNodes > ADDRMAN_GETADDR_MAX)
-        nNodes = ADDRMAN_GETADDR_MAX;
+    std::vector<CDeferredAdd> vBatch;
+    {
+        LOCK(cs_deferred);
+        vBatch.swap(vDeferred);
+        nDeferred = 0;
+    }
+    if (vBatch.empty())
+        return;
 
-    // gather a list of random nodes, skipping those of low quality
-    for (unsigned int n = 0; n < vRandom.size(); n++) {
-        if (vAddr.size() >= nNodes)
-            break;
+    int nAdd = 0;
+    for (const CDeferredAdd& deferred : vBatch) {
+        for (const CAddress& addr : deferred.vAddr)
+            nAdd += Add_(addr, deferred.source, deferred.nTimePenalty) ? 1 : 0;
+    }
+    if (nAdd)
+        LogPrint(BCLog::ADDRMAN, "Added %i addresses from %u addr messages: %i tried, %i new\n", nAdd, vBatch.size(), nTried, nNew);
+}
 
-        int nRndPos = RandomInt(vRandom.size() - n) + n;
-        SwapRandom(n, nRndPos);
-        assert(mapInfo.count(vRandom[n]) == 1);
+std::shared_ptr<const CAddrMan::CAddrSnapshot> CAddrMan::GetSnapshot_()
+{
+    std::shared_ptr<CAddrSnapshot> snap = std::make_shared<CAddrSnapshot>();
+    snap->nTime = GetTime();
+    snap->nTotal = vRandom.size();
+    snap->vAddr.reserve(mapInfo.size());
+
+    // skip those of low quality
+    const int64_t nNow = GetAdjustedTime();
+    for (const auto& entry : mapInfo) {
+        if (!entry.second.IsTerrible(nNow))
+            snap->vAddr.push_back(entry.second);
+    }
+    return snap;
+}
 
-        const CAddrInfo& ai = mapInfo[vRandom[n]];
-        if (!ai.IsTerrible())
-            vAddr.push_back(ai);
+void CAddrMan::GetAddr_(const CAddrSnapshot& snap, std::vector<CAddress>& vAddr)
+{
+    size_t nNodes = ADDRMAN_GETADDR_MAX_PCT * snap.nTotal / 100;
+    if (nNodes > ADDRMAN_GETADDR_MAX)
+        nNodes = ADDRMAN_GETADDR_MAX;
+    if (nNodes > snap.vAddr.size())
+        nNodes = snap.vAddr.size();
+
+    // gather a list of random nodes, with a partial shuffle of the snapshot positions
+    FastRandomContext rng;
+    std::vector<uint32_t> vPos(snap.vAddr.size());
+    for (size_t n = 0; n < vPos.size(); n++)
+        vPos[n] = n;
+    vAddr.reserve(nNodes);
+    for (size_t n = 0; n < nNodes; n++) {
+        std::swap(vPos[n], vPos[n + rng.randrange(vPos.size() - n)]);
+        vAddr.push_back(snap.vAddr[vPos[n]]);
     }
 }
 
@@ -16,6 +16,7 @@
 #include "util.h"
 
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <vector>
@@ -183,6 +184,18 @@ public:
 //! the maximum number of tried addr collisions to store
 #define ADDRMAN_SET_TRIED_COLLISION_SIZE 10
 
+//! how many gossiped addresses are queued before they are added in one batch
+#define ADDRMAN_DEFERRED_BATCH 1000
+
+//! how long gossiped addresses can wait in the queue (seconds)
+#define ADDRMAN_DEFERRED_SECONDS 10
+
+//! past this many queued addresses, the gossip waits for the batch to be added
+#define ADDRMAN_DEFERRED_MAX 10000
+
+//! how long getaddr responses are drawn from the same snapshot (seconds)
+#define ADDRMAN_SNAPSHOT_SECONDS 60
+
 /**
  * Stochastical (IP) address manager
  */
@@ -222,6 +235,40 @@ private:
     //! Holds addrs inserted into tried table that collide with existing entries. Test-before-evict discpline used to resolve these collisions.
     std::set<int> m_tried_collisions;
 
+    //! Addresses of one addr message, waiting to be added
+    struct CDeferredAdd {
+        std::vector<CAddress> vAddr;
+        CNetAddr source;
+        int64_t nTimePenalty;
+    };
+
+    //! The addresses getaddr responses are drawn from, without holding cs
+    struct CAddrSnapshot {
+        int64_t nTime;
+        //! number of entries in the tables when it was taken
+        size_t nTotal;
+        //! the entries which were not terrible
+        std::vector<CAddress> vAddr;
+    };
+
+    //! critical section to protect the deferred additions, taken after cs
+    Mutex cs_deferred;
+
+    //! addr gossip waiting to be added in one batch
+    std::vector<CDeferredAdd> vDeferred;
+
+    //! number of addresses in vDeferred
+    size_t nDeferred;
+
+    //! time the oldest entry of vDeferred was queued
+    int64_t nDeferredTime;
+
+    //! critical section to protect the snapshot pointer, taken after cs
+    Mutex cs_snapshot;
+
+    //! last snapshot of the tables for getaddr, replaced as a whole
+    std::shared_ptr<const CAddrSnapshot> snapshot;
+
 protected:
     //! secret key to randomize bucket select with
     uint256 nKey;
@@ -274,8 +321,14 @@ protected:
     int Check_();
 #endif
 
-    //! Select several addresses at once.
-    void GetAddr_(std::vector<CAddress>& vAddr);
+    //! Add the deferred addresses in one go.
+    void FlushDeferred_();
+
+    //! Take a snapshot of the entries getaddr can return.
+    std::shared_ptr<const CAddrSnapshot> GetSnapshot_();
+
+    //! Select several addresses at once from a snapshot.
+    static void GetAddr_(const CAddrSnapshot& snap, std::vector<CAddress>& vAddr);
 
     //! Mark an entry as currently-connected-to.
     void Connected_(const CService& addr, int64_t nTime);
@@ -484,6 +537,16 @@ public:
         nLastGood = 1; //Initially at 1 so that "never" is strictly worse.
         mapInfo.clear();
         mapAddr.clear();
+        {
+            LOCK(cs_deferred);
+            vDeferred.clear();
+            nDeferred = 0;
+            nDeferredTime = 0;
+        }
+        {
+            LOCK(cs_snapshot);
+            snapshot.reset();
+        }
     }
 
     CAddrMan()
@@ -542,6 +605,50 @@ public:
         return nAdd > 0;
     }
 
+    /**
+     * Add the addresses of an addr message. They are queued and added by batches,
+     * so the gossip doesn't contend with the connection and getaddr paths for cs:
+     * the batch is only added when cs is free, unless the queue grew too long.
+     * A short queue left behind by a quiet network is added by Select(), GetAddr()
+     * or the periodic FlushDeferred() of the connection manager.
+     */
+    void AddDeferred(const std::vector<CAddress>& vAddr, const CNetAddr& source, int64_t nTimePenalty = 0)
+    {
+        bool fFlush, fWait;
+        {
+            LOCK(cs_deferred);
+            const int64_t nNow = GetTime();
+            if (vDeferred.empty())
+                nDeferredTime = nNow;
+            vDeferred.push_back(CDeferredAdd{vAddr, source, nTimePenalty});
+            nDeferred += vAddr.size();
+            fFlush = nDeferred >= ADDRMAN_DEFERRED_BATCH || nNow - nDeferredTime >= ADDRMAN_DEFERRED_SECONDS || size() == 0;
+            fWait = nDeferred >= ADDRMAN_DEFERRED_MAX;
+        }
+        if (fWait) {
+            LOCK(cs);
+            Check();
+            FlushDeferred_();
+            Check();
+        } else if (fFlush) {
+            TRY_LOCK(cs, lockAddrman);
+            if (lockAddrman) {
+                Check();
+                FlushDeferred_();
+                Check();
+            }
+        }
+    }
+
+    //! Add the queued addr gossip now.
+    void FlushDeferred()
+    {
+        LOCK(cs);
+        Check();
+        FlushDeferred_();
+        Check();
+    }
+
     //! Mark an entry as accessible.
     void Good(const CService& addr, bool test_before_evict = true, int64_t nTime = GetAdjustedTime())
     {
@@ -592,22 +699,38 @@ public:
         {
             LOCK(cs);
             Check();
+            FlushDeferred_();
             addrRet = Select_(newOnly);
             Check();
         }
         return addrRet;
     }
 
-    //! Return a bunch of addresses, selected at random.
+    /**
+     * Return a bunch of addresses, selected at random. They are drawn from a snapshot
+     * of the tables, only retaken under cs once it is a minute old or the tables
+     * changed size by more than an eighth.
+     */
     std::vector<CAddress> GetAddr()
     {
-        Check();
-        std::vector<CAddress> vAddr;
+        std::shared_ptr<const CAddrSnapshot> snap;
         {
+            LOCK(cs_snapshot);
+            snap = snapshot;
+        }
+        const size_t nTotal = size();
+        if (!snap || GetTime() - snap->nTime >= ADDRMAN_SNAPSHOT_SECONDS ||
+            (nTotal > snap->nTotal ? nTotal - snap->nTotal : snap->nTotal - nTotal) * 8 > snap->nTotal) {
             LOCK(cs);
-            GetAddr_(vAddr);
+            Check();
+            FlushDeferred_();
+            snap = GetSnapshot_();
+            Check();
+            LOCK(cs_snapshot);
+            snapshot = snap;
         }
-        Check();
+        std::vector<CAddress> vAddr;
+        GetAddr_(*snap, vAddr);
         return vAddr;
     }
 
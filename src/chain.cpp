@@ -8,6 +8,7 @@
 #include "chain.h"
 #include "masternode.h"
 #include "masternodeman.h"
+#include "txdb.h"
 #include "legacy/stakemodifier.h"  // for ComputeNextStakeModifier
 
 
@@ -244,14 +245,22 @@ uint256 CBlockIndex::GetStakeModifierV2() const
     return nStakeModifier;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, bool fCheckIntegrity);
 
 CScript CBlockIndex::GetPaidPayee() const
 {
+    auto amount = CMasternode::GetMasternodePayment(nHeight);
+
+    // indexed when the block was connected, as long as the payment amount didn't change since
+    CScript paidPayee;
+    CAmount nPaidAmount;
+    if (pblocktree && pblocktree->ReadPaidPayee(GetBlockHash(), paidPayee, nPaidAmount) && nPaidAmount == amount)
+        return paidPayee;
+
     CBlock block;
-    if (nHeight <= chainActive.Height() && ReadBlockFromDisk(block, this)) {
-        auto amount = CMasternode::GetMasternodePayment(nHeight);
-        auto paidPayee = block.GetPaidPayee(amount);
+    if (nHeight <= chainActive.Height() && ReadBlockFromDisk(block, this, false)) {
+        paidPayee = block.GetPaidPayee(amount);
+        if (pblocktree) pblocktree->WritePaidPayee(GetBlockHash(), paidPayee, amount);
         return paidPayee;
     }
 
@@ -8,8 +8,10 @@
 
 #include "chainparams.h"
 
+#include "base58.h"
 #include "chainparamsseeds.h"
 #include "consensus/merkle.h"
+#include "script/standard.h"
 #include "util.h"
 #include "utilstrencodings.h"
 
@@ -221,6 +223,7 @@ public:
 
         vFixedSeeds = std::vector<SeedSpec6>(pnSeed6_main, pnSeed6_main + ARRAYLEN(pnSeed6_main));
         //convertSeed6(vFixedSeeds, pnSeed6_main, ARRAYLEN(pnSeed6_main)); // added
+        CompileBurnAddresses();
     }
 
     const Checkpoints::CCheckpointData& Checkpoints() const
@@ -373,6 +376,7 @@ public:
         base58Prefixes[EXT_COIN_TYPE] = boost::assign::list_of(0x80)(0x00)(0x00)(0x01).convert_to_container<std::vector<unsigned char> >();
 
         vFixedSeeds = std::vector<SeedSpec6>(pnSeed6_test, pnSeed6_test + ARRAYLEN(pnSeed6_test));
+        CompileBurnAddresses();
     }
 
     const Checkpoints::CCheckpointData& Checkpoints() const
@@ -508,6 +512,7 @@ public:
 
         vFixedSeeds.clear(); //! Regtest mode doesn't have any fixed seeds.
         vSeeds.clear();      //! Regtest mode doesn't have any DNS seeds.
+        CompileBurnAddresses();
     }
 
     const Checkpoints::CCheckpointData& Checkpoints() const
@@ -523,6 +528,60 @@ public:
 };
 static CRegTestParams regTestParams;
 
+void CChainParams::CompileBurnAddresses()
+{
+    mapBurnKeyIDs.clear();
+    mapBurnScriptIDs.clear();
+
+    const std::vector<unsigned char>& pubkey_prefix = base58Prefixes[PUBKEY_ADDRESS];
+    const std::vector<unsigned char>& script_prefix = base58Prefixes[SCRIPT_ADDRESS];
+    for (const auto& burn : consensus.mBurnAddresses) {
+        std::vector<unsigned char> data;
+        uint160 hash;
+        if (!DecodeBase58Check(burn.first, data)) continue;
+
+        // same decoding as DecodeDestination, with this network prefixes
+        if (data.size() == hash.size() + pubkey_prefix.size() && std::equal(pubkey_prefix.begin(), pubkey_prefix.end(), data.begin())) {
+            std::copy(data.begin() + pubkey_prefix.size(), data.end(), hash.begin());
+            mapBurnKeyIDs[hash] = &burn;
+        } else if (data.size() == hash.size() + script_prefix.size() && std::equal(script_prefix.begin(), script_prefix.end(), data.begin())) {
+            std::copy(data.begin() + script_prefix.size(), data.end(), hash.begin());
+            mapBurnScriptIDs[hash] = &burn;
+        }
+    }
+}
+
+const std::pair<const std::string, int>* CChainParams::GetBurnAddress(const CScript& scriptPubKey) const
+{
+    if (mapBurnKeyIDs.empty() && mapBurnScriptIDs.empty()) return nullptr;
+
+    uint160 hash;
+    const std::unordered_map<uint160, const std::pair<const std::string, int>*, uint160CheapHasher>* pmap;
+    if (scriptPubKey.IsPayToPublicKeyHash()) {
+        memcpy(hash.begin(), &scriptPubKey[3], 20);
+        pmap = &mapBurnKeyIDs;
+    } else if (scriptPubKey.IsPayToScriptHash()) {
+        memcpy(hash.begin(), &scriptPubKey[2], 20);
+        pmap = &mapBurnScriptIDs;
+    } else {
+        // the less common templates resolving to an address, like pay to pubkey
+        CTxDestination dest;
+        if (!ExtractDestination(scriptPubKey, dest)) return nullptr;
+        if (const CKeyID* keyID = boost::get<CKeyID>(&dest)) {
+            hash = *keyID;
+            pmap = &mapBurnKeyIDs;
+        } else if (const CScriptID* scriptID = boost::get<CScriptID>(&dest)) {
+            hash = *scriptID;
+            pmap = &mapBurnScriptIDs;
+        } else {
+            return nullptr;
+        }
+    }
+
+    const auto it = pmap->find(hash);
+    return it != pmap->end() ? it->second : nullptr;
+}
+
 static CChainParams* pCurrentParams = 0;
 
 const CChainParams& Params()
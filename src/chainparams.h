@@ -18,6 +18,9 @@
 
 #include <vector>
 #include <map>
+#include <unordered_map>
+
+class CScript;
 
 struct CDNSSeedData {
     std::string name, host;
@@ -75,6 +78,15 @@ public:
     bool IsTestNet() const { return NetworkID() == CBaseChainParams::TESTNET; }
     bool IsRegTestNet() const { return NetworkID() == CBaseChainParams::REGTEST; }
 
+    /** The burn address entry of consensus.mBurnAddresses a scriptPubKey pays to, or nullptr. No address encoding involved. */
+    const std::pair<const std::string, int>* GetBurnAddress(const CScript& scriptPubKey) const;
+    /** Whether a scriptPubKey pays to a burn address active before nHeight */
+    bool IsBurnScript(const CScript& scriptPubKey, int nHeight) const
+    {
+        const auto pburn = GetBurnAddress(scriptPubKey);
+        return pburn && pburn->second < nHeight;
+    }
+
 
 protected:
     CChainParams() {}
@@ -88,6 +100,13 @@ protected:
     std::vector<CDNSSeedData> vSeeds;
     std::vector<unsigned char> base58Prefixes[MAX_BASE58_TYPES];
     std::vector<SeedSpec6> vFixedSeeds;
+
+    //! consensus.mBurnAddresses entries by key id and by script id
+    std::unordered_map<uint160, const std::pair<const std::string, int>*, uint160CheapHasher> mapBurnKeyIDs;
+    std::unordered_map<uint160, const std::pair<const std::string, int>*, uint160CheapHasher> mapBurnScriptIDs;
+
+    /** Decode consensus.mBurnAddresses into the maps above, once the base58 prefixes are set */
+    void CompileBurnAddresses();
 };
 
 /**
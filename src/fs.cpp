@@ -8,6 +8,13 @@
 
 #include <boost/filesystem.hpp>
 
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace fsbridge {
 
 FILE *fopen(const fs::path& p, const char *mode)
@@ -20,4 +27,54 @@ FILE *freopen(const fs::path& p, const char *mode, FILE *stream)
     return ::freopen(p.string().c_str(), mode, stream);
 }
 
+MappedFile::MappedFile(const fs::path& p) : pData(nullptr), nSize(0), fMapped(false)
+{
+#ifndef WIN32
+    int fd = ::open(p.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return;
+    struct stat st;
+    if (::fstat(fd, &st) == 0) {
+        nSize = st.st_size;
+        if (nSize == 0) {
+            static const unsigned char chEmpty = 0;
+            pData = &chEmpty;
+        } else {
+            void* pMap = ::mmap(nullptr, nSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (pMap != MAP_FAILED) {
+                ::madvise(pMap, nSize, MADV_SEQUENTIAL);
+                pData = static_cast<const unsigned char*>(pMap);
+                fMapped = true;
+            }
+        }
+    }
+    ::close(fd);
+#else
+    FILE* file = fopen(p, "rb");
+    if (!file)
+        return;
+    if (::fseek(file, 0, SEEK_END) == 0) {
+        long nEnd = ::ftell(file);
+        if (nEnd >= 0 && ::fseek(file, 0, SEEK_SET) == 0) {
+            vchBuffer.resize(nEnd + 1);
+            if (::fread(vchBuffer.data(), 1, nEnd, file) == (size_t)nEnd) {
+                pData = vchBuffer.data();
+                nSize = nEnd;
+            }
+        }
+    }
+    ::fclose(file);
+#endif
+    if (!pData)
+        nSize = 0;
+}
+
+MappedFile::~MappedFile()
+{
+#ifndef WIN32
+    if (fMapped)
+        ::munmap(const_cast<unsigned char*>(pData), nSize);
+#endif
+}
+
 } // fsbridge
@@ -9,6 +9,7 @@
 
 #include <stdio.h>
 #include <string>
+#include <vector>
 
 #define BOOST_FILESYSTEM_NO_DEPRECATED
 #include <boost/filesystem.hpp>
@@ -22,6 +23,32 @@ namespace fs = boost::filesystem;
 namespace fsbridge {
     FILE *fopen(const fs::path& p, const char *mode);
     FILE *freopen(const fs::path& p, const char *mode, FILE *stream);
+
+    /**
+     * A whole file mapped read-only in memory, so it can be checksummed and
+     * deserialized in place. Where mapping isn't available the file is read
+     * into a buffer instead.
+     */
+    class MappedFile
+    {
+    private:
+        const unsigned char* pData;
+        size_t nSize;
+        bool fMapped;
+        std::vector<unsigned char> vchBuffer;
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+    public:
+        explicit MappedFile(const fs::path& p);
+        ~MappedFile();
+
+        bool IsNull() const { return pData == nullptr; }
+        const unsigned char* begin() const { return pData; }
+        const unsigned char* end() const { return pData + nSize; }
+        size_t size() const { return nSize; }
+    };
 };
 
 #endif
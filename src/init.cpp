@@ -43,6 +43,7 @@
 #include "scheduler.h"
 #include "spork.h"
 #include "sporkdb.h"
+#include "supplyindex.h"
 #include "txdb.h"
 #include "torcontrol.h"
 #include "guiinterface.h"
@@ -50,7 +51,9 @@
 #include "util.h"
 #include "utilmoneystr.h"
 #include "util/threadnames.h"
+#include "utxosnapshot.h"
 #include "validationinterface.h"
+#include "x11kvsengine.h"
 
 #ifdef ENABLE_WALLET
 #include "wallet/db.h"
@@ -251,6 +254,8 @@ void PrepareShutdown()
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
+        delete pcoinswriter;
+        pcoinswriter = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
         delete pcoinsdbview;
@@ -391,13 +396,17 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-debuglogfile=<file>", strprintf(_("Specify location of debug log file: this can be an absolute path or a path relative to the data directory (default: %s)"), DEFAULT_DEBUGLOGFILE));
     strUsage += HelpMessageOpt("-disablesystemnotifications", strprintf(_("Disable OS notifications for incoming transactions (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-dbbackgroundflush", strprintf(_("Write the database cache to disk in the background as the chain moves forward (default: %u)"), DEFAULT_DB_BACKGROUND_FLUSH));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
+    strUsage += HelpMessageOpt("-loadtxoutset=<file>", _("Load an empty chainstate from a dumptxoutset snapshot, the blocks up to its base block being already there") + " " + _("on startup"));
+    strUsage += HelpMessageOpt("-loadtxoutsethash=<hash>", _("The txoutset_hash dumptxoutset returned for the -loadtxoutset snapshot, which is refused when it doesn't match (required with -loadtxoutset)"));
     strUsage += HelpMessageOpt("-maxreorg=<n>", strprintf(_("Set the Maximum reorg depth (default: %u)"), DEFAULT_MAX_REORG_DEPTH));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-parhash=<n>", strprintf(_("Set the number of X11KVS header hashing threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -GetNumCores(), MAX_X11KVS_THREADS, DEFAULT_X11KVS_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), PIVX_PID_FILENAME));
 #endif
@@ -426,14 +435,21 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
+    strUsage += HelpMessageOpt("-msgworkers=<n>", strprintf(_("Number of threads running the peer messages which don't affect the chain, like masternode pings and broadcasts, 0 to run them with the others (0-%d, default: %d)"), MAX_MESSAGE_WORKERS, DEFAULT_MESSAGE_WORKERS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with bloom filters (default: %u)"), DEFAULT_PEERBLOOMFILTERS));
+    strUsage += HelpMessageOpt("-peercompactblocks", strprintf(_("Relay and serve blocks as compact blocks, rebuilt from the mempool by the receiver (default: %u)"), DEFAULT_PEERCOMPACTBLOCKS));
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), Params(CBaseChainParams::MAIN).GetDefaultPort(), Params(CBaseChainParams::TESTNET).GetDefaultPort()));
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+#ifdef HAVE_EPOLL
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("Socket events mode, which must be one of: select, epoll (default: %s)"), DEFAULT_SOCKETEVENTS));
+#else
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("Socket events mode, which must be one of: select (default: %s)"), DEFAULT_SOCKETEVENTS));
+#endif
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
@@ -463,6 +479,7 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug) {
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
+        strUsage += HelpMessageOpt("-dbbatchsize=<n>", strprintf("Maximum database write batch size in bytes, for the background writes (default: %u)", nDefaultDbBatchSize));
         strUsage += HelpMessageOpt("-checkpoints", strprintf(_("Only accept block chain matching built-in checkpoints (default: %u)"), DEFAULT_CHECKPOINTS_ENABLED));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", DEFAULT_DISABLE_SAFEMODE));
         strUsage += HelpMessageOpt("-testsafemode", strprintf(_("Force safe mode (default: %u)"), DEFAULT_TESTSAFEMODE));
@@ -522,6 +539,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockminsize=<n>", strprintf(_("Set minimum block size in bytes (default: %u)"), DEFAULT_BLOCK_MIN_SIZE));
     strUsage += HelpMessageOpt("-blockmaxsize=<n>", strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE));
     strUsage += HelpMessageOpt("-blockprioritysize=<n>", strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE));
+    strUsage += HelpMessageOpt("-blocktemplatecache", _("Keep the transactions of the next block selected in the background (default: 1 when staking or generating)"));
 
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
@@ -928,13 +946,27 @@ bool AppInit2()
         return false;
 
     // ********************************************************* Step 2: parameter interactions
+    std::string strSocketEvents = GetArg("-socketevents", DEFAULT_SOCKETEVENTS);
+    CConnman::SocketEventsMode socketEventsMode;
+    if (strSocketEvents == "select") {
+        socketEventsMode = CConnman::SOCKETEVENTS_SELECT;
+#ifdef HAVE_EPOLL
+    } else if (strSocketEvents == "epoll") {
+        socketEventsMode = CConnman::SOCKETEVENTS_EPOLL;
+#endif
+    } else {
+        return UIError(strprintf(_("Invalid -socketevents ('%s') specified"), strSocketEvents));
+    }
+
     // Make sure enough file descriptors are available
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     int nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     int nMaxConnections = std::max(nUserMaxConnections, 4 * MAX_OUTBOUND_CONNECTIONS);
 
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+    // (select() can't watch the sockets numbered FD_SETSIZE or above)
+    if (socketEventsMode == CConnman::SOCKETEVENTS_SELECT)
+        nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return UIError(_("Not enough file descriptors available."));
@@ -1011,6 +1043,15 @@ bool AppInit2()
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    // -parhash=0 means autodetect, but nX11KVSThreads==0 means no concurrency
+    int nX11KVSThreads = GetArg("-parhash", DEFAULT_X11KVS_THREADS);
+    if (nX11KVSThreads <= 0)
+        nX11KVSThreads += GetNumCores();
+    if (nX11KVSThreads <= 1)
+        nX11KVSThreads = 0;
+    else if (nX11KVSThreads > MAX_X11KVS_THREADS)
+        nX11KVSThreads = MAX_X11KVS_THREADS;
+
     setvbuf(stdout, NULL, _IOLBF, 0); /// ***TODO*** do we still need this after -printtoconsole is gone?
 
     // Staking needs a CWallet instance, so make sure wallet is enabled
@@ -1060,6 +1101,9 @@ bool AppInit2()
     if (GetBoolArg("-peerbloomfilters", DEFAULT_PEERBLOOMFILTERS))
         nLocalServices = ServiceFlags(nLocalServices | NODE_BLOOM);
 
+    if (GetBoolArg("-peercompactblocks", DEFAULT_PEERCOMPACTBLOCKS))
+        nLocalServices = ServiceFlags(nLocalServices | NODE_COMPACT_BLOCKS);
+
     nMaxTipAge = GetArg("-maxtipage", DEFAULT_MAX_TIP_AGE);
 
     if (!InitNUParams())
@@ -1118,6 +1162,13 @@ bool AppInit2()
             threadGroup.create_thread(&ThreadScriptCheck);
     }
 
+    LogPrintf("Using %u threads for X11KVS header hashing\n", nX11KVSThreads);
+    if (nX11KVSThreads) {
+        // the hashing caller joins the pool as the last worker
+        for (int i = 0; i < nX11KVSThreads - 1; i++)
+            threadGroup.create_thread(&ThreadX11KVSHash);
+    }
+
     if (mapArgs.count("-sporkkey")) // spork priv key
     {
         if (!sporkManager.SetPrivKey(GetArg("-sporkkey", "")))
@@ -1436,6 +1487,8 @@ bool AppInit2()
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
+    // flushes of the in-memory cache are written in the background, in batches of this size
+    const size_t nCoinDBBatchSize = GetBoolArg("-dbbackgroundflush", DEFAULT_DB_BACKGROUND_FLUSH) ? GetArg("-dbbatchsize", nDefaultDbBatchSize) : 0;
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
@@ -1454,6 +1507,7 @@ bool AppInit2()
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinswriter;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
@@ -1464,7 +1518,8 @@ bool AppInit2()
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
-                pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                pcoinswriter = new CCoinsViewDBWriter(pcoinscatcher, pcoinsdbview, nCoinDBBatchSize);
+                pcoinsTip = new CCoinsViewCache(pcoinswriter);
 
                 if (fReindex) {
                     pblocktree->WriteReindexing(true);
@@ -1493,6 +1548,23 @@ bool AppInit2()
                     break;
                 }
 
+                // Complete the chainstate write the last session was in the middle of,
+                // then reload the block index from the replayed chainstate
+                if (!pcoinsdbview->GetHeadBlocks().empty()) {
+                    uiInterface.InitMessage(_("Replaying blocks..."));
+                    if (!ReplayBlocks(pcoinsdbview)) {
+                        strLoadError = _("Unable to replay blocks. You will need to rebuild the database using -reindex.");
+                        break;
+                    }
+                    delete pcoinsTip;
+                    pcoinsTip = new CCoinsViewCache(pcoinswriter);
+                    UnloadBlockIndex();
+                    if (!LoadBlockIndex(strBlockIndexError)) {
+                        strLoadError = strprintf("%s : %s", _("Error loading block database"), strBlockIndexError);
+                        break;
+                    }
+                }
+
                 const Consensus::Params& consensus = Params().GetConsensus();
 
                 // If the loaded chain has a wrong genesis, bail out immediately
@@ -1500,6 +1572,33 @@ bool AppInit2()
                 if (!mapBlockIndex.empty() && mapBlockIndex.count(consensus.hashGenesisBlock) == 0)
                     return UIError(_("Incorrect or no genesis block found. Wrong datadir for network?"));
 
+                // Seed an empty chainstate from a UTXO snapshot, then reload the
+                // block index so the active chain ends at the snapshot base block
+                if (mapArgs.count("-loadtxoutset") && !fReindex) {
+                    const fs::path pathSnapshot = fs::absolute(GetArg("-loadtxoutset", ""), GetDataDir());
+                    const std::string strSnapshotHash = GetArg("-loadtxoutsethash", "");
+                    if (strSnapshotHash.size() != 64 || !IsHex(strSnapshotHash))
+                        return UIError(_("-loadtxoutset requires -loadtxoutsethash, the txoutset_hash dumptxoutset returned for the snapshot"));
+                    if (!pcoinsdbview->GetBestBlock().IsNull()) {
+                        LogPrintf("Ignoring -loadtxoutset=%s, the chainstate is not empty\n", pathSnapshot.string());
+                    } else {
+                        uiInterface.InitMessage(_("Loading UTXO snapshot..."));
+                        std::string strSnapshotError;
+                        if (!CUTXOSnapshot::Load(pcoinsdbview, pathSnapshot, uint256S(strSnapshotHash), strSnapshotError)) {
+                            strLoadError = strprintf("%s : %s", _("Error loading the UTXO snapshot"), strSnapshotError);
+                            break;
+                        }
+                        UnloadBlockIndex();
+                        if (!LoadBlockIndex(strBlockIndexError)) {
+                            strLoadError = strprintf("%s : %s", _("Error loading block database"), strBlockIndexError);
+                            break;
+                        }
+                    }
+                }
+
+                // Load the supply index matching the chainstate (empty if the chainstate is)
+                supplyIndex.Load(pcoinsTip->GetBestBlock());
+
                 // Initialize the block index (no-op if non-empty database was already loaded)
                 if (!InitBlockIndex()) {
                     strLoadError = _("Error initializing block database");
@@ -1760,6 +1859,8 @@ bool AppInit2()
     connOptions.uiInterface = &uiInterface;
     connOptions.nSendBufferMaxSize = 1000*GetArg("-maxsendbuffer", DEFAULT_MAXSENDBUFFER);
     connOptions.nReceiveFloodSize = 1000*GetArg("-maxreceivebuffer", DEFAULT_MAXRECEIVEBUFFER);
+    connOptions.socketEventsMode = socketEventsMode;
+    connOptions.nMessageWorkers = GetArg("-msgworkers", DEFAULT_MESSAGE_WORKERS);
 
     if (!connman.Start(scheduler, strNodeError, connOptions))
         return UIError(strNodeError);
@@ -1787,6 +1888,14 @@ bool AppInit2()
     }
 #endif
 
+    // Block creation only attaches the coinbase or the coinstake to a ready transaction selection
+    bool fGenerate = false;
+#ifdef ENABLE_WALLET
+    fGenerate = pwalletMain && GetBoolArg("-gen", DEFAULT_GENERATE);
+#endif
+    if (GetBoolArg("-blocktemplatecache", fStaking || fGenerate))
+        StartBlockTemplateCache(scheduler);
+
 
     return !fRequestShutdown;
 }
@@ -15,7 +15,9 @@
 #include "policy/policy.h"
 #include "stakeinput.h"
 #include "utilmoneystr.h"
+#include "x11kvsengine.h"
 
+#include <atomic>
 #include <boost/assign/list_of.hpp>
 
 /**
@@ -49,19 +51,45 @@ CStakeKernel::CStakeKernel(const CBlockIndex* const pindexPrev, CStakeInput* sta
 
 // Return stake kernel hash
 uint256 CStakeKernel::GetHash() const
+{
+    return GetHash(GetPrefixHasher(), nTime);
+}
+
+// Return the hasher loaded with the kernel message up to the block time
+CHash256 CStakeKernel::GetPrefixHasher() const
 {
     CDataStream ss(stakeModifier);
-    ss << nTimeBlockFrom << stakeUniqueness << nTime;
-    return Hash(ss.begin(), ss.end());
+    ss << nTimeBlockFrom << stakeUniqueness;
+    CHash256 hasher;
+    hasher.Write((const unsigned char*)&ss[0], ss.size());
+    return hasher;
 }
 
-// Check that the kernel hash meets the target required
-bool CStakeKernel::CheckKernelHash(bool fSkipLog) const
+// Return the stake kernel hash at nTimeTx, from the prefix hasher
+uint256 CStakeKernel::GetHash(const CHash256& hasherPrefix, int nTimeTx)
+{
+    unsigned char time[4];
+    WriteLE32(time, (uint32_t)nTimeTx);
+    CHash256 hasher(hasherPrefix);
+    uint256 hash;
+    hasher.Write(time, sizeof(time)).Finalize((unsigned char*)&hash);
+    return hash;
+}
+
+// Return the kernel hash target, weighted by the stake value
+uint256 CStakeKernel::GetTarget() const
 {
-    // Get weighted target
     uint256 bnTarget;
     bnTarget.SetCompact(nBits);
     bnTarget *= (uint256(stakeValue) / 100);
+    return bnTarget;
+}
+
+// Check that the kernel hash meets the target required
+bool CStakeKernel::CheckKernelHash(bool fSkipLog) const
+{
+    // Get weighted target
+    const uint256& bnTarget = GetTarget();
 
     // Check PoS kernel hash
     const uint256& hashProofOfStake = GetHash();
@@ -112,46 +140,106 @@ bool LoadStakeInput(const CBlock& block, const CBlockIndex* pindexPrev, std::uni
 }
 
 /*
- * Stake                Check if stakeInput can stake a block on top of pindexPrev
- *
- * @param[in]   pindexPrev      index of the parent block of the block being staked
- * @param[in]   stakeInput      input for the coinstake
- * @param[in]   nBits           target difficulty bits
- * @param[in]   nTimeTx         new blocktime
- * @return      bool            true if stake kernel hash meets target protocol
+ * Stake kernel search
  */
-bool Stake(const CBlockIndex* pindexPrev, CStakeInput* stakeInput, unsigned int nBits, int64_t& nTimeTx)
+
+CStakeKernelSearch::CStakeKernelSearch(const CBlockIndex* pindexPrevIn, unsigned int nBitsIn):
+    pindexPrev(pindexPrevIn),
+    nBits(nBitsIn)
 {
-    // Double check stake input contextual checks
     const int nHeightTx = pindexPrev->nHeight + 1;
 
     // Get the new time slot (and verify it's not the same as previous block)
     const bool fRegTest = Params().IsRegTestNet();
     const bool fTimeProtocolV2 = Params().GetConsensus().IsTimeProtocolV2(nHeightTx) && !fRegTest;
-    const int nTimeSlotLength = Params().GetConsensus().nTimeSlotLength;
-    nTimeTx = fTimeProtocolV2 ? pindexPrev->MinPastBlockTime() : GetAdjustedTime();
+    nTimeContext = fTimeProtocolV2 ? pindexPrev->MinPastBlockTime() : GetAdjustedTime();
+    nTimeStep = fTimeProtocolV2 ? Params().GetConsensus().nTimeSlotLength : 1;
 
-    if (!stakeInput || !stakeInput->ContextCheck(nHeightTx, nTimeTx)) return false;
+    nTimeStart = (nTimeContext / nTimeStep) * nTimeStep;
+    while (nTimeStart <= pindexPrev->MinPastBlockTime()) {
+        nTimeStart += nTimeStep;
+    }
+    nTimeEnd = fTimeProtocolV2 ? pindexPrev->MaxFutureBlockTime() : pindexPrev->GetBlockTime() + HASH_DRIFT;
+}
 
-    int slotStep = fTimeProtocolV2 ? nTimeSlotLength : 1;
+bool CStakeKernelSearch::AddInput(CStakeInput* stakeInput)
+{
+    // Double check stake input contextual checks
+    if (!stakeInput || !stakeInput->ContextCheck(pindexPrev->nHeight + 1, nTimeContext)) return false;
 
-    nTimeTx = (nTimeTx / slotStep) * slotStep;
+    const CStakeKernel stakeKernel(pindexPrev, stakeInput, nBits, nTimeStart);
+    vInputs.push_back(CInput{stakeKernel.GetPrefixHasher(), stakeKernel.GetTarget()});
+    return true;
+}
 
-    while(nTimeTx <= pindexPrev->MinPastBlockTime()) {
-        nTimeTx += slotStep;
+bool CStakeKernelSearch::Search(size_t nStart, size_t& nInputRet, int64_t& nTimeTxRet) const
+{
+    nTimeTxRet = nTimeEnd;
+    if (nStart >= vInputs.size() || nTimeStart > nTimeEnd) return false;
+
+    // Lowest input index with a kernel found so far, the chunks past it give up
+    std::atomic<size_t> nFound(vInputs.size());
+    const size_t nChunks = std::min(vInputs.size() - nStart, (size_t)(x11kvsEngine.GetWorkers() + 1) * 4);
+    const size_t nChunkSize = (vInputs.size() - nStart + nChunks - 1) / nChunks;
+    std::vector<std::pair<size_t, int64_t> > vResults(nChunks, std::make_pair(vInputs.size(), (int64_t)0));
+
+    std::vector<std::function<void()> > vJobs;
+    for (size_t nChunk = 0; nChunk < nChunks; nChunk++) {
+        const size_t nBegin = nStart + nChunk * nChunkSize;
+        const size_t nEnd = std::min(nBegin + nChunkSize, vInputs.size());
+        std::pair<size_t, int64_t>* presult = &vResults[nChunk];
+        vJobs.emplace_back([this, nBegin, nEnd, presult, &nFound]() {
+            for (size_t i = nBegin; i < nEnd && i < nFound; i++) {
+                for (int64_t nTimeTx = nTimeStart; nTimeTx <= nTimeEnd; nTimeTx += nTimeStep) {
+                    if (CStakeKernel::GetHash(vInputs[i].hasherPrefix, nTimeTx) < vInputs[i].bnTarget) {
+                        *presult = std::make_pair(i, nTimeTx);
+                        size_t nPrev = nFound;
+                        while (i < nPrev && !nFound.compare_exchange_weak(nPrev, i)) {}
+                        return;
+                    }
+                }
+            }
+        });
     }
-
-    while(nTimeTx <= (fTimeProtocolV2 ? pindexPrev->MaxFutureBlockTime() : pindexPrev->GetBlockTime() + HASH_DRIFT)) {
-        // Verify Proof Of Stake
-        CStakeKernel stakeKernel(pindexPrev, stakeInput, nBits, nTimeTx);
-        if(stakeKernel.CheckKernelHash(true)) return true;
-        nTimeTx += slotStep;
+    x11kvsEngine.Execute(vJobs);
+
+    for (const auto& result : vResults) {
+        if (result.first < vInputs.size()) {
+            nInputRet = result.first;
+            nTimeTxRet = result.second;
+            LogPrint(BCLog::STAKING, "%s : Proof Of Stake:"
+                                "\nnInput=%d"
+                                "\nnTimeTx=%d"
+                                "\nhashProofOfStake=%s"
+                                "\nnBits=%d"
+                                "\nbnTarget=%s\n\n",
+                __func__, nInputRet, nTimeTxRet, CStakeKernel::GetHash(vInputs[nInputRet].hasherPrefix, nTimeTxRet).GetHex(),
+                nBits, vInputs[nInputRet].bnTarget.GetHex());
+            return true;
+        }
     }
-
     return false;
 }
 
 
+/*
+ * Stake                Check if stakeInput can stake a block on top of pindexPrev
+ *
+ * @param[in]   pindexPrev      index of the parent block of the block being staked
+ * @param[in]   stakeInput      input for the coinstake
+ * @param[in]   nBits           target difficulty bits
+ * @param[in]   nTimeTx         new blocktime
+ * @return      bool            true if stake kernel hash meets target protocol
+ */
+bool Stake(const CBlockIndex* pindexPrev, CStakeInput* stakeInput, unsigned int nBits, int64_t& nTimeTx)
+{
+    CStakeKernelSearch search(pindexPrev, nBits);
+    size_t nInput;
+    if (!search.AddInput(stakeInput)) return false;
+    return search.Search(0, nInput, nTimeTx);
+}
+
+
 /*
  * CheckProofOfStake    Check if block has valid proof of stake
  *
@@ -9,6 +9,7 @@
 #ifndef PIVX_KERNEL_H
 #define PIVX_KERNEL_H
 
+#include "hash.h"
 #include "main.h"
 #include "stakeinput.h"
 
@@ -29,6 +30,16 @@ public:
     // Return stake kernel hash
     uint256 GetHash() const;
 
+    // Return the hasher loaded with the kernel message up to the block time,
+    // which is the same for all the time slots
+    CHash256 GetPrefixHasher() const;
+
+    // Return the stake kernel hash at nTimeTx, from the prefix hasher
+    static uint256 GetHash(const CHash256& hasherPrefix, int nTimeTx);
+
+    // Return the kernel hash target, weighted by the stake value
+    uint256 GetTarget() const;
+
     // Check that the kernel hash meets the target required
     bool CheckKernelHash(bool fSkipLog = false) const;
 
@@ -43,6 +54,60 @@ private:
     CAmount stakeValue{0};     // target multiplier
 };
 
+/**
+ * Kernel search of many stake inputs over all the time slots of a block on
+ * top of pindexPrev, for the staker.
+ *
+ * The kernel message is the same for every time slot of an input up to the
+ * block time, so it is hashed once per input into a SHA256 midstate, along
+ * with the weighted target. Each (input, time slot) pair then only costs the
+ * four time bytes and the SHA256d finalization. The inputs are spread over
+ * the hashing worker pool (-parhash).
+ */
+class CStakeKernelSearch
+{
+public:
+    /**
+     * CStakeKernelSearch Constructor
+     *
+     * @param[in]   pindexPrev      index of the parent of the kernel block
+     * @param[in]   nBits           target difficulty bits of the kernel block
+     */
+    CStakeKernelSearch(const CBlockIndex* pindexPrev, unsigned int nBits);
+
+    // Add an input to the search, false if it fails the contextual checks
+    bool AddInput(CStakeInput* stakeInput);
+
+    // Number of inputs added
+    size_t GetInputsCount() const { return vInputs.size(); }
+
+    /*
+     * Search       Find the first input from nStart, in the order they were added,
+     *              with a kernel meeting the target, same as calling Stake() on each
+     *
+     * @param[in]   nStart          index of the first input to search
+     * @param[out]  nInputRet       index of the input found
+     * @param[out]  nTimeTxRet      earliest time slot of the kernel found, or the last time slot searched
+     * @return      bool            true if a kernel was found
+     */
+    bool Search(size_t nStart, size_t& nInputRet, int64_t& nTimeTxRet) const;
+
+private:
+    struct CInput {
+        CHash256 hasherPrefix;
+        uint256 bnTarget;
+    };
+
+    const CBlockIndex* pindexPrev;
+    unsigned int nBits;
+    // time slots searched
+    int64_t nTimeContext{0};
+    int64_t nTimeStart{0};
+    int64_t nTimeEnd{0};
+    int nTimeStep{1};
+    std::vector<CInput> vInputs;
+};
+
 /* PoS Validation */
 
 /*
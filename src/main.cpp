@@ -13,6 +13,7 @@
 
 #include "addrman.h"
 #include "amount.h"
+#include "blockencodings.h"
 #include "blocksignature.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -37,6 +38,7 @@
 #include "rewards.h"
 #include "spork.h"
 #include "sporkdb.h"
+#include "supplyindex.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "guiinterface.h"
@@ -51,8 +53,10 @@
 #include <boost/thread.hpp>
 #include <boost/foreach.hpp>
 #include <atomic>
+#include <list>
 #include <queue>
 #include <regex>
+#include <unordered_map>
 
 
 #if defined(NDEBUG)
@@ -214,6 +218,12 @@ std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlock
 /** Number of blocks in flight with validated headers. */
 int nQueuedValidatedHeaders = 0;
 
+/** Blocks to download from all the peers at once while in IBD (see SendMessages). Protected by cs_main. */
+CBlockDownloadQueue blocksToDownload;
+//! Last block of blocksToDownload a getblocks was sent from, and when
+uint256 hashBlocksToDownloadEnd;
+int64_t nBlocksToDownloadEndTime = 0;
+
 /** Number of preferable block download peers. */
 int nPreferredDownload = 0;
 
@@ -224,6 +234,97 @@ std::set<CBlockIndex*> setDirtyBlockIndex;
 std::set<int> setDirtyFileInfo;
 } // anon namespace
 
+bool CBlockDownloadQueue::Push(const uint256& hash)
+{
+    if (!setBlocks.insert(hash).second)
+        return false;
+    vBlocks.push_back(hash);
+    return true;
+}
+
+void CBlockDownloadQueue::Prune(const BlockMap& mapIndex)
+{
+    while (!vBlocks.empty() && mapIndex.count(vBlocks.front())) {
+        setBlocks.erase(vBlocks.front());
+        vBlocks.pop_front();
+    }
+}
+
+bool CBlockDownloadQueue::DropFrom(const uint256& hash)
+{
+    if (!setBlocks.count(hash))
+        return false;
+
+    // The blocks after an invalid one build on it: none of them can connect
+    std::deque<uint256>::iterator itDrop = std::find(vBlocks.begin(), vBlocks.end(), hash);
+    for (std::deque<uint256>::iterator it = itDrop; it != vBlocks.end(); ++it)
+        setBlocks.erase(*it);
+    vBlocks.erase(itDrop, vBlocks.end());
+
+    std::map<uint256, CBlockAhead>::iterator it = mapBlocksAhead.begin();
+    while (it != mapBlocksAhead.end()) {
+        const uint256 hashAhead = it->second.pblock->GetHash();
+        if (setBlocks.count(hashAhead)) {
+            ++it;
+            continue;
+        }
+        nBlocksAheadSize -= it->second.nSize;
+        setBlocksAhead.erase(hashAhead);
+        it = mapBlocksAhead.erase(it);
+    }
+    return true;
+}
+
+void CBlockDownloadQueue::Clear()
+{
+    vBlocks.clear();
+    setBlocks.clear();
+    mapBlocksAhead.clear();
+    setBlocksAhead.clear();
+    nBlocksAheadSize = 0;
+}
+
+void CBlockDownloadQueue::FindBlocksToRequest(size_t nCount, size_t nWindow, const std::function<bool(const uint256&)>& fSkip, std::vector<uint256>& vBlocksRet) const
+{
+    const size_t nEnd = std::min(vBlocks.size(), nWindow);
+    for (size_t i = 0; i < nEnd && vBlocksRet.size() < nCount; i++) {
+        const uint256& hash = vBlocks[i];
+        if (setBlocksAhead.count(hash) || fSkip(hash))
+            continue;
+        vBlocksRet.push_back(hash);
+    }
+}
+
+bool CBlockDownloadQueue::HoldBlockAhead(NodeId nodeid, const CBlock& block)
+{
+    const uint256 hash = block.GetHash();
+    if (setBlocksAhead.count(hash) || mapBlocksAhead.count(block.hashPrevBlock))
+        return false;
+
+    const size_t nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    if (nBlocksAheadSize + nSize > nMaxBlocksAheadSize) {
+        // It is asked again once the download moves on
+        LogPrint(BCLog::NET, "Dropping block %s received ahead from peer=%d, no room left\n", hash.ToString(), nodeid);
+        return false;
+    }
+    mapBlocksAhead.emplace(block.hashPrevBlock, CBlockAhead{nodeid, std::make_shared<const CBlock>(block), nSize});
+    setBlocksAhead.insert(hash);
+    nBlocksAheadSize += nSize;
+    return true;
+}
+
+bool CBlockDownloadQueue::PopBlockAhead(const uint256& hashParent, CBlockAhead& aheadRet)
+{
+    std::map<uint256, CBlockAhead>::iterator it = mapBlocksAhead.find(hashParent);
+    if (it == mapBlocksAhead.end())
+        return false;
+    aheadRet = it->second;
+    nBlocksAheadSize -= aheadRet.nSize;
+    setBlocksAhead.erase(aheadRet.pblock->GetHash());
+    mapBlocksAhead.erase(it);
+    return true;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Registration of network node signals.
@@ -350,6 +451,20 @@ struct CNodeState {
 
     CNodeBlocks nodeBlocks;
 
+    //! Whether this peer relays and serves compact blocks (sent us a sendcmpct).
+    bool fSupportsCmpctBlocks;
+    //! Whether this peer wants the new blocks announced with a cmpctblock rather than an inv.
+    bool fPreferCmpctBlocks;
+    //! The compact block of this peer waiting for the blocktxn of its missing transactions.
+    std::unique_ptr<PartiallyDownloadedBlock> partialBlock;
+    uint256 hashPartialBlock;
+    //! The blocks asked to this peer as compact blocks, not received yet, and when (in microseconds).
+    std::map<uint256, int64_t> mapCmpctBlocksRequested;
+    //! How many blocks of blocksToDownload can be in flight from this peer.
+    int nBlocksDownloadWindow;
+    //! The block of blocksToDownload this peer last stalled, asked to another peer since.
+    uint256 hashStalledBlock;
+
     CNodeState(CAddress addrIn, std::string addrNameIn) : address(addrIn), name(addrNameIn) {
         fCurrentlyConnected = false;
         nMisbehavior = 0;
@@ -361,6 +476,9 @@ struct CNodeState {
         nStallingSince = 0;
         nBlocksInFlight = 0;
         fPreferredDownload = false;
+        fSupportsCmpctBlocks = false;
+        fPreferCmpctBlocks = false;
+        nBlocksDownloadWindow = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
     }
 };
 
@@ -608,6 +726,45 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     }
 }
 
+void ClearBlocksToDownload()
+{
+    blocksToDownload.Clear();
+    hashBlocksToDownloadEnd.SetNull();
+}
+
+/** Ask this peer for the next blocks of blocksToDownload not in flight, up to its window. */
+void RequestBlocksToDownload(CNode* pto, CNodeState& state, int64_t nNow, std::vector<CInv>& vGetData)
+{
+    blocksToDownload.Prune(mapBlockIndex);
+    if (!state.hashStalledBlock.IsNull() && !blocksToDownload.Contains(state.hashStalledBlock))
+        state.hashStalledBlock.SetNull();
+    if (blocksToDownload.Empty() || state.nBlocksInFlight >= state.nBlocksDownloadWindow)
+        return;
+
+    // The next block to connect holds the whole download back. When the blocks after it
+    // came in but it didn't for a while, ask it to this peer and shrink the window of the
+    // slow one.
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itFront = mapBlocksInFlight.find(blocksToDownload.Front());
+    if (itFront != mapBlocksInFlight.end() && itFront->second.first != pto->GetId() && blocksToDownload.HasBlocksAhead() &&
+        itFront->second.second->nTime < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
+        CNodeState* stateStaller = State(itFront->second.first);
+        stateStaller->nBlocksDownloadWindow = std::max(MIN_BLOCKS_DOWNLOAD_PER_PEER, stateStaller->nBlocksDownloadWindow / 2);
+        stateStaller->hashStalledBlock = itFront->first;
+        LogPrint(BCLog::NET, "Peer=%d is stalling block %s, asking peer=%d\n", itFront->second.first, itFront->first.ToString(), pto->id);
+        MarkBlockAsReceived(itFront->first);
+    }
+
+    // Never ask further than BLOCK_DOWNLOAD_WINDOW ahead of the next block to connect
+    std::vector<uint256> vToRequest;
+    blocksToDownload.FindBlocksToRequest(state.nBlocksDownloadWindow - state.nBlocksInFlight, BLOCK_DOWNLOAD_WINDOW,
+        [&state](const uint256& hash) { return mapBlocksInFlight.count(hash) || hash == state.hashStalledBlock; }, vToRequest);
+    for (const uint256& hash : vToRequest) {
+        vGetData.push_back(CInv(MSG_BLOCK, hash));
+        MarkBlockAsInFlight(pto->GetId(), hash);
+        LogPrint(BCLog::NET, "Requesting block %s peer=%d\n", hash.ToString(), pto->id);
+    }
+}
+
 } // anon namespace
 
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats)
@@ -668,6 +825,7 @@ CBlockIndex* GetChainTip()
 }
 
 CCoinsViewCache* pcoinsTip = NULL;
+CCoinsViewDBWriter* pcoinswriter = NULL;
 CBlockTreeDB* pblocktree = NULL;
 CSporkDB* pSporkDB = NULL;
 
@@ -871,13 +1029,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             uint256 hashBlock;
             CTransaction txPrev;
             if (GetTransaction(tx.vin[i].prevout.hash, txPrev, hashBlock, true)) { // get the vin's previous transaction
-                CTxDestination source;
-                if (ExtractDestination(txPrev.vout[tx.vin[i].prevout.n].scriptPubKey, source)) { // extract the destination of the previous transaction's vout[n]
-                    const std::string addr = EncodeDestination(source);
-                    if (consensus.mBurnAddresses.find(addr) != consensus.mBurnAddresses.end() &&
-                        consensus.mBurnAddresses.at(addr) < chainHeight) {
-                        return state.DoS(0, false, REJECT_INVALID, "bad-txns-invalid-outputs");
-                    }
+                if (Params().IsBurnScript(txPrev.vout[tx.vin[i].prevout.n].scriptPubKey, chainHeight)) { // the vin's previous transaction's vout[n] pays to a burn address
+                    return state.DoS(0, false, REJECT_INVALID, "bad-txns-invalid-outputs");
                 }
             }
         }
@@ -1385,7 +1538,7 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+static bool ReadBlockDataFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
@@ -1401,6 +1554,14 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
         return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
 
+    return true;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+{
+    if (!ReadBlockDataFromDisk(block, pos))
+        return false;
+
     // Check the header
     if (block.IsProofOfWork()) {
         if (!CheckProofOfWork(block.GetHash(), block.nBits))
@@ -1410,14 +1571,116 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, bool fCheckIntegrity)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
+    if (!ReadBlockDataFromDisk(block, pindex->GetBlockPos()))
         return false;
-    if (block.GetHash() != pindex->GetBlockHash()) {
-        LogPrintf("%s : block=%s index=%s\n", __func__, block.GetHash().GetHex(), pindex->GetBlockHash().GetHex());
-        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : GetHash() doesn't match index");
+
+    // The block index holds the hash this header was validated with, so
+    // there is no need to run the PoW hash again: the header read from disk
+    // only has to be the indexed one.
+    if (block.GetBlockHeader() != pindex->GetBlockHeader()) {
+        LogPrintf("%s : block=%s index=%s\n", __func__, block.GetBlockHeader().GetHash().GetHex(), pindex->GetBlockHash().GetHex());
+        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : header doesn't match index");
+    }
+
+    // The merkle root covers the transactions read from disk
+    if (fCheckIntegrity) {
+        bool mutated;
+        if (BlockMerkleRoot(block, &mutated) != block.hashMerkleRoot || mutated)
+            return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : transactions don't match the merkle root of block %s", pindex->GetBlockHash().GetHex());
+    }
+
+    block.SetCachedHash(pindex->GetBlockHash());
+    return true;
+}
+
+namespace {
+
+/**
+ * Blocks recently served to peers or over REST, as stored on disk. Peers
+ * syncing from us tend to ask for the same ranges, and the tip blocks are
+ * asked by every peer relaying them.
+ */
+class CRawBlockCache
+{
+private:
+    typedef std::pair<uint256, std::vector<unsigned char> > Entry;
+
+    Mutex cs;
+    //! Most recently used first
+    std::list<Entry> lruBlocks;
+    std::unordered_map<uint256, std::list<Entry>::iterator, BlockHasher> mapBlocks;
+    size_t nBytes = 0;
+
+public:
+    bool Get(const uint256& hash, std::vector<unsigned char>& vBlock)
+    {
+        LOCK(cs);
+        auto it = mapBlocks.find(hash);
+        if (it == mapBlocks.end()) return false;
+        lruBlocks.splice(lruBlocks.begin(), lruBlocks, it->second);
+        vBlock = it->second->second;
+        return true;
+    }
+
+    void Put(const uint256& hash, const std::vector<unsigned char>& vBlock)
+    {
+        if (vBlock.size() > MAX_RAW_BLOCK_CACHE_SIZE / 4) return;
+        LOCK(cs);
+        if (mapBlocks.count(hash)) return;
+        lruBlocks.emplace_front(hash, vBlock);
+        mapBlocks.emplace(hash, lruBlocks.begin());
+        nBytes += vBlock.size();
+        while (nBytes > MAX_RAW_BLOCK_CACHE_SIZE) {
+            nBytes -= lruBlocks.back().second.size();
+            mapBlocks.erase(lruBlocks.back().first);
+            lruBlocks.pop_back();
+        }
+    }
+};
+
+CRawBlockCache rawBlockCache;
+
+} // anon namespace
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vBlock, const CBlockIndex* pindex)
+{
+    const uint256 hash = pindex->GetBlockHash();
+    if (rawBlockCache.Get(hash, vBlock))
+        return true;
+
+    // The block is preceded on disk by the network magic and its size
+    CDiskBlockPos pos = pindex->GetBlockPos();
+    if (pos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("%s : invalid position of block %s", __func__, hash.GetHex());
+    pos.nPos -= MESSAGE_START_SIZE + sizeof(unsigned int);
+
+    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s : OpenBlockFile failed", __func__);
+
+    try {
+        CMessageHeader::MessageStartChars blk_start;
+        unsigned int nSize;
+        filein >> FLATDATA(blk_start) >> nSize;
+        if (memcmp(blk_start, Params().MessageStart(), MESSAGE_START_SIZE))
+            return error("%s : block %s magic mismatch", __func__, hash.GetHex());
+        if (nSize > MAX_BLOCK_SIZE_CURRENT)
+            return error("%s : block %s size %u is out of range", __func__, hash.GetHex(), nSize);
+        vBlock.resize(nSize);
+        filein.read((char*)vBlock.data(), nSize);
+    } catch (const std::exception& e) {
+        return error("%s : I/O error - %s", __func__, e.what());
     }
+
+    // Same check as ReadBlockFromDisk: the header on disk has to be the indexed one
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    ssHeader << pindex->GetBlockHeader();
+    if (vBlock.size() < ssHeader.size() || memcmp(vBlock.data(), &ssHeader[0], ssHeader.size()))
+        return error("%s : header doesn't match index for block %s", __func__, hash.GetHex());
+
+    rawBlockCache.Put(hash, vBlock);
     return true;
 }
 
@@ -1618,7 +1881,7 @@ void static InvalidBlockFound(CBlockIndex* pindex, const CValidationState& state
     }
 }
 
-void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight)
+void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight, CSupplyDelta* pdelta)
 {
     // mark inputs spent
     if (!tx.IsCoinBase()) {
@@ -1626,16 +1889,24 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo& txund
         for (const CTxIn& txin : tx.vin) {
             txundo.vprevout.emplace_back();
             inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            if (pdelta && !txundo.vprevout.back().IsSpent())
+                pdelta->SpendCoin(txin.prevout, txundo.vprevout.back());
         }
     }
     // add outputs
     AddCoins(inputs, tx, nHeight);
+    if (pdelta) {
+        for (size_t i = 0; i < tx.vout.size(); ++i) {
+            if (!tx.vout[i].scriptPubKey.IsUnspendable())
+                pdelta->AddCoin(COutPoint(tx.GetHash(), i), Coin(tx.vout[i], nHeight, tx.IsCoinBase(), tx.IsCoinStake()));
+        }
+    }
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache &inputs, int nHeight)
 {
     CTxUndo txundo;
-    UpdateCoins(tx, inputs, txundo, nHeight);
+    UpdateCoins(tx, inputs, txundo, nHeight, nullptr);
 }
 
 bool CScriptCheck::operator()()
@@ -1853,9 +2124,10 @@ enum DisconnectResult
  * @param undo The Coin to be restored.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
+ * @param pdelta If not null, records the restored coin for the supply index.
  * @return A DisconnectResult as an int
  */
-int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
+int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out, CSupplyDelta* pdelta)
 {
     bool fClean = true;
 
@@ -1874,6 +2146,7 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
             return DISCONNECT_FAILED; // adding output for transaction without known metadata
         }
     }
+    if (pdelta && !undo.out.scriptPubKey.IsUnspendable()) pdelta->AddCoin(out, undo);
     view.AddCoin(out, std::move(undo), false);
 
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
@@ -1882,7 +2155,7 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  When UNCLEAN or FAILED is returned, view is left in an indeterminate state. */
-DisconnectResult DisconnectBlock(CBlock& block, CBlockIndex* pindex, CCoinsViewCache& view)
+DisconnectResult DisconnectBlock(CBlock& block, CBlockIndex* pindex, CCoinsViewCache& view, CSupplyDelta* pdelta = nullptr)
 {
     AssertLockHeld(cs_main);
 
@@ -1927,6 +2200,7 @@ DisconnectResult DisconnectBlock(CBlock& block, CBlockIndex* pindex, CCoinsViewC
                 COutPoint out(hash, o);
                 Coin coin;
                 view.SpendCoin(out, &coin);
+                if (pdelta && !coin.IsSpent()) pdelta->SpendCoin(out, coin);
                 if (tx.vout[o] != coin.out) {
                     fClean = false; // transaction output mismatch
                 }
@@ -1946,7 +2220,7 @@ DisconnectResult DisconnectBlock(CBlock& block, CBlockIndex* pindex, CCoinsViewC
         }
         for (unsigned int j = tx.vin.size(); j-- > 0;) {
             const COutPoint& out = tx.vin[j].prevout;
-            int res = ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out);
+            int res = ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out, pdelta);
             if (res == DISCONNECT_FAILED) return DISCONNECT_FAILED;
             fClean = fClean && res != DISCONNECT_UNCLEAN;
         }
@@ -2009,7 +2283,7 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, bool fAlreadyChecked)
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, bool fAlreadyChecked, CSupplyDelta* pdelta)
 {
     AssertLockHeld(cs_main);
 
@@ -2130,13 +2404,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         // ----------- burn address scanning -----------
         if(nHeight > nLastCheckpointHeight) {
             for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                CTxDestination source;
-                if (tx.vout[i].scriptPubKey.IsNormalPaymentScript() && ExtractDestination(tx.vout[i].scriptPubKey, source)) {
-                    const std::string addr = EncodeDestination(source);
-                    if (consensus.mBurnAddresses.find(addr) != consensus.mBurnAddresses.end() &&
-                        consensus.mBurnAddresses.at(addr) < nHeight) {
-                        nUnspendableValue += tx.vout[i].nValue;
-                    }
+                if (tx.vout[i].scriptPubKey.IsNormalPaymentScript() && Params().IsBurnScript(tx.vout[i].scriptPubKey, nHeight)) {
+                    nUnspendableValue += tx.vout[i].nValue;
                 }
             }
         }
@@ -2145,7 +2414,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (i > 0) {
             blockundo.vtxundo.emplace_back();
         }
-        UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
+        UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight, pdelta);
 
         vPos.emplace_back(tx.GetHash(), pos);
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
@@ -2217,16 +2486,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             Coin coin;
             if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
                 // ----------- burn address scanning -----------
-                CTxDestination source;
-                if (ExtractDestination(coin.out.scriptPubKey, source)) {
-                    const std::string addr = EncodeDestination(source);
-                    if (consensus.mBurnAddresses.find(addr) != consensus.mBurnAddresses.end() &&
-                        consensus.mBurnAddresses.at(addr) < nHeight) 
-                    {
-                        nUnspendableValue += coin.out.nValue;
-                        pcursor->Next();
-                        continue;
-                    }
+                if (Params().IsBurnScript(coin.out.scriptPubKey, nHeight)) {
+                    nUnspendableValue += coin.out.nValue;
+                    pcursor->Next();
+                    continue;
                 }
             }
             pcursor->Next();
@@ -2257,6 +2520,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if(!mnodeman.ConnectBlock(pindex, block)) return false;
     }
 
+    // Index the paid payee, so the masternode manager doesn't have to read the block back
+    const CAmount nMNPayment = CMasternode::GetMasternodePayment(pindex->nHeight);
+    if (!pblocktree->WritePaidPayee(pindex->GetBlockHash(), block.GetPaidPayee(nMNPayment), nMNPayment))
+        return AbortNode(state, "Failed to write paid payee index");
+
     return true;
 }
 
@@ -2291,11 +2559,14 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
             nLastSetChain = nNow;
         }
         int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
-        int64_t cacheSize = pcoinsTip->DynamicMemoryUsage() * DB_PEAK_USAGE_FACTOR;
+        // The coins still being written in the background count against the same budget
+        int64_t cacheSize = (pcoinsTip->DynamicMemoryUsage() + pcoinswriter->DynamicMemoryUsage()) * DB_PEAK_USAGE_FACTOR;
         int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
+        // A flush being written in the background still holds its coins, and the next one would wait for it.
+        bool fWriting = pcoinswriter->IsWriting();
         // The cache is large and we're within 10% and 10 MiB of the limit, but we have time now
         // (not in the middle of a block processing).
-        bool fCacheLarge = mode == FLUSH_STATE_PERIODIC &&
+        bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && !fWriting &&
                 cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
         // The cache is over the limit, we have to write now.
         bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && (unsigned) cacheSize > nCoinCacheUsage;
@@ -2303,7 +2574,7 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
         // Do this frequently, so we don't need to redownload after a crash.
         bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
         // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
-        bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
+        bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && !fWriting && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
         // Combine all conditions that result in a full cache flush.
         bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush;
         // Write blocks and block index to disk.
@@ -2343,9 +2614,12 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
             // overwrite one. Still, use a conservative safety factor of 2.
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
-            // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // Flush the chainstate (which may refer to block index entries). Moving forward, it
+            // is written in the background, unless it has to be on disk when returning.
+            if (!pcoinsTip->Flush() || (mode == FLUSH_STATE_ALWAYS && !pcoinswriter->Sync()))
                 return AbortNode(state, "Failed to write to coin database");
+            // The supply index follows the chainstate on disk, a failure only costs a rebuild.
+            supplyIndex.Write();
             nLastFlush = nNow;
         }
         if ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
@@ -2409,8 +2683,51 @@ void static UpdateTip(CBlockIndex* pindexNew)
     }
 }
 
-/** Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and manually re-limit mempool size after this, with cs_main held. */
-bool static DisconnectTip(CValidationState& state)
+void ResurrectDisconnectedTransactions(std::vector<std::vector<CTransaction>>& vBlocksTx, const std::set<uint256>& setConfirmed)
+{
+    AssertLockHeld(cs_main);
+    if (!setConfirmed.empty()) {
+        for (std::vector<CTransaction>& vtx : vBlocksTx) {
+            vtx.erase(std::remove_if(vtx.begin(), vtx.end(), [&setConfirmed](const CTransaction& tx) {
+                return setConfirmed.count(tx.GetHash()) != 0;
+            }), vtx.end());
+        }
+    }
+    std::vector<uint256> vHashUpdate;
+    for (auto it = vBlocksTx.rbegin(); it != vBlocksTx.rend(); ++it) {
+        for (const CTransaction& tx : *it) {
+            // ignore validation errors in resurrected transactions
+            std::list<CTransaction> removed;
+            CValidationState stateDummy;
+            if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, nullptr, true)) {
+                mempool.remove(tx, removed, true);
+            } else if (mempool.exists(tx.GetHash())) {
+                vHashUpdate.push_back(tx.GetHash());
+            }
+        }
+    }
+    // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
+    // no in-mempool children, which is generally not true when adding
+    // previously-confirmed transactions back to the mempool.
+    // UpdateTransactionsFromBlock finds descendants of any transactions in these
+    // blocks that were added back and cleans up the mempool state.
+    mempool.UpdateTransactionsFromBlock(vHashUpdate);
+
+    for (const std::vector<CTransaction>& vtx : vBlocksTx) {
+        for (const CTransaction& tx : vtx) {
+            GetMainSignals().SyncTransaction(tx, chainActive.Tip(), CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+        }
+    }
+    vBlocksTx.clear();
+}
+
+/**
+ * Disconnect chainActive's tip, into the coins cache only: the caller flushes the chain state
+ * once it is done disconnecting. The transactions of the block are appended to vBlocksTx, for
+ * ResurrectDisconnectedTransactions. You probably want to call mempool.removeForReorg and
+ * manually re-limit mempool size after this, with cs_main held.
+ */
+bool static DisconnectTip(CValidationState& state, std::vector<std::vector<CTransaction>>& vBlocksTx)
 {
     CBlockIndex* pindexDelete = chainActive.Tip();
     assert(pindexDelete);
@@ -2422,40 +2739,20 @@ bool static DisconnectTip(CValidationState& state)
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK)
+        CSupplyDelta supplyDelta;
+        if (DisconnectBlock(block, pindexDelete, view, &supplyDelta) != DISCONNECT_OK)
             return error("DisconnectTip() : DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
+        supplyIndex.DisconnectBlock(supplyDelta, pindexDelete);
     }
     LogPrint(BCLog::BENCH, "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
-    // Write the chain state to disk, if necessary.
-    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+    // Write the chain state to disk, if the cache is too large.
+    if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
-    // Resurrect mempool transactions from the disconnected block.
-    std::vector<uint256> vHashUpdate;
-    for (const CTransaction& tx : block.vtx) {
-        // ignore validation errors in resurrected transactions
-        std::list<CTransaction> removed;
-        CValidationState stateDummy;
-        if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, nullptr, true)) {
-            mempool.remove(tx, removed, true);
-        } else if (mempool.exists(tx.GetHash())) {
-            vHashUpdate.push_back(tx.GetHash());
-        }
-    }
-    // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
-    // no in-mempool children, which is generally not true when adding
-    // previously-confirmed transactions back to the mempool.
-    // UpdateTransactionsFromBlock finds descendants of any transactions in this
-    // block that were added back and cleans up the mempool state.
-    mempool.UpdateTransactionsFromBlock(vHashUpdate);
 
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
-    // Let wallets know transactions went from 1-confirmed to
-    // 0-confirmed or conflicted:
-    for (const CTransaction& tx : block.vtx) {
-        GetMainSignals().SyncTransaction(tx, pindexDelete->pprev, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
-    }
+    vBlocksTx.emplace_back(std::move(block.vtx));
     return true;
 }
 
@@ -2491,7 +2788,8 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const CB
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, fAlreadyChecked);
+        CSupplyDelta supplyDelta;
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, fAlreadyChecked, &supplyDelta);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2503,6 +2801,7 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const CB
         nTimeConnectTotal += nTime3 - nTime2;
         LogPrint(BCLog::BENCH, "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
+        supplyIndex.ConnectBlock(supplyDelta, pindexNew);
     }
     int64_t nTime4 = GetTimeMicros();
     nTimeFlush += nTime4 - nTime3;
@@ -2543,10 +2842,12 @@ bool DisconnectBlocks(int nBlocks)
     CValidationState state;
 
     LogPrintf("%s: Got command to replay %d blocks\n", __func__, nBlocks);
+    std::vector<std::vector<CTransaction>> vBlocksTx;
     for (int i = 0; i <= nBlocks; i++)
-        DisconnectTip(state);
+        DisconnectTip(state, vBlocksTx);
+    ResurrectDisconnectedTransactions(vBlocksTx);
 
-    return true;
+    return FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
 void ReprocessBlocks(int nBlocks)
@@ -2664,14 +2965,25 @@ static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMo
     bool fInvalidFound = false;
     const CBlockIndex* pindexOldTip = chainActive.Tip();
     const CBlockIndex* pindexFork = chainActive.FindFork(pindexMostWork);
+    const size_t nTxChangedStart = txChanged.size();
+    // The transactions of the blocks connected by this step
+    auto GetConfirmed = [&txChanged, nTxChangedStart]() {
+        std::set<uint256> setConfirmed;
+        for (size_t i = nTxChangedStart; i < txChanged.size(); i++)
+            setConfirmed.insert(std::get<0>(txChanged[i]).GetHash());
+        return setConfirmed;
+    };
 
-    // Disconnect active blocks which are no longer in the best chain.
-    bool fBlocksDisconnected = false;
+    // Disconnect active blocks which are no longer in the best chain. Their transactions are
+    // kept aside until the new blocks are connected, and the chain state is written once.
+    std::vector<std::vector<CTransaction>> vBlocksTx;
     while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
-        if (!DisconnectTip(state))
+        if (!DisconnectTip(state, vBlocksTx)) {
+            ResurrectDisconnectedTransactions(vBlocksTx);
             return false;
-        fBlocksDisconnected = true;
+        }
     }
+    const bool fBlocksDisconnected = !vBlocksTx.empty();
 
     // Build list of new blocks to connect.
     std::vector<CBlockIndex*> vpindexToConnect;
@@ -2703,6 +3015,7 @@ static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMo
                     break;
                 } else {
                     // A system error occurred (disk space, database error, ...).
+                    ResurrectDisconnectedTransactions(vBlocksTx, GetConfirmed());
                     return false;
                 }
             } else {
@@ -2717,6 +3030,13 @@ static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMo
     }
 
     if (fBlocksDisconnected) {
+        // The whole reorg reaches the disk in a single chain state write.
+        if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+            // The reorg is done in memory already, the mempool follows it either way
+            ResurrectDisconnectedTransactions(vBlocksTx, GetConfirmed());
+            return false;
+        }
+        ResurrectDisconnectedTransactions(vBlocksTx, GetConfirmed());
         mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
         LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
     }
@@ -2731,6 +3051,28 @@ static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMo
     return true;
 }
 
+/** The compact block of the last new tip, built once for all the peers it is relayed to */
+static Mutex cs_LastCmpctBlock;
+static uint256 hashLastCmpctBlock;
+static std::shared_ptr<const CBlockHeaderAndShortTxIDs> pLastCmpctBlock;
+
+static void SetLastCmpctBlock(const CBlock& block)
+{
+    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs>(block);
+    LOCK(cs_LastCmpctBlock);
+    pLastCmpctBlock = pcmpctblock;
+    hashLastCmpctBlock = block.GetHash();
+}
+
+/** The compact block of hashBlock if it is the last one built, nullptr otherwise */
+static std::shared_ptr<const CBlockHeaderAndShortTxIDs> GetLastCmpctBlock(const uint256& hashBlock)
+{
+    LOCK(cs_LastCmpctBlock);
+    if (hashLastCmpctBlock != hashBlock)
+        return nullptr;
+    return pLastCmpctBlock;
+}
+
 /**
  * Make the best chain active, in multiple steps. The result is either failure
  * or an activated best chain. pblock is either NULL or a pointer to a block
@@ -2807,6 +3149,10 @@ bool ActivateBestChain(CValidationState& state, const CBlock* pblock, bool fAlre
                 int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate();
                 {
                     if (connman) {
+                        // The peers preferring it get the new tip as a compact block, built
+                        // here from the block in memory rather than under the send locks
+                        if (pblock && pblock->GetHash() == hashNewTip)
+                            SetLastCmpctBlock(*pblock);
                         connman->ForEachNode([pindexNewTip, nBlockEstimate, hashNewTip](CNode* pnode) {
                             if (pindexNewTip->nHeight > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate)) {
                                 pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
@@ -2847,6 +3193,7 @@ bool InvalidateBlock(CValidationState& state, CBlockIndex* pindex)
     setDirtyBlockIndex.insert(pindex);
     setBlockIndexCandidates.erase(pindex);
 
+    std::vector<std::vector<CTransaction>> vBlocksTx;
     while (chainActive.Contains(pindex)) {
         CBlockIndex* pindexWalk = chainActive.Tip();
         pindexWalk->nStatus |= BLOCK_FAILED_CHILD;
@@ -2854,11 +3201,15 @@ bool InvalidateBlock(CValidationState& state, CBlockIndex* pindex)
         setBlockIndexCandidates.erase(pindexWalk);
         // ActivateBestChain considers blocks already in chainActive
         // unconditionally valid already, so force disconnect away from it.
-        if (!DisconnectTip(state)) {
+        if (!DisconnectTip(state, vBlocksTx)) {
+            ResurrectDisconnectedTransactions(vBlocksTx);
             mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
             return false;
         }
     }
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+        return false;
+    ResurrectDisconnectedTransactions(vBlocksTx);
 
     LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
 
@@ -3356,13 +3707,9 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
                     uint256 hashBlock;
                     CTransaction txPrev;
                     if (GetTransaction(tx.vin[i].prevout.hash, txPrev, hashBlock, true)) { // get the vin's previous transaction
-                        CTxDestination source;
-                        if (ExtractDestination(txPrev.vout[tx.vin[i].prevout.n].scriptPubKey, source)) { // extract the destination of the previous transaction's vout[n]
-                            const std::string addr = EncodeDestination(source);
-                            if (consensus.mBurnAddresses.find(addr) != consensus.mBurnAddresses.end() &&
-                                consensus.mBurnAddresses.at(addr) < nHeight) {
-                                return state.DoS(100, error("%s : Burned address %s tried to send a transaction %s (rejecting it).", __func__, addr.c_str(), txPrev.GetHash().ToString().c_str()), REJECT_INVALID, "bad-txns-banned");
-                            }
+                        const auto pburn = Params().GetBurnAddress(txPrev.vout[tx.vin[i].prevout.n].scriptPubKey); // the vin's previous transaction's vout[n] burn address
+                        if (pburn && pburn->second < nHeight) {
+                            return state.DoS(100, error("%s : Burned address %s tried to send a transaction %s (rejecting it).", __func__, pburn->first.c_str(), txPrev.GetHash().ToString().c_str()), REJECT_INVALID, "bad-txns-banned");
                         }
                     }
                 }
@@ -4021,7 +4368,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             break;
         CBlock block;
         // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex))
+        if (!ReadBlockFromDisk(block, pindex, true))
             return error("%s: *** ReadBlockFromDisk failed at %d, hash=%s", __func__, pindex->nHeight, pindex->GetBlockHash().ToString());
         // check level 1: verify block validity
         if (nCheckLevel >= 1 && !CheckBlock(block, state))
@@ -4086,7 +4433,6 @@ void ResyncSupply()
         return;
 
     CAmount nMoneySupply = 0;
-    auto& consensus = Params().GetConsensus();
 
     std::unique_ptr<CCoinsViewCursor> pcursor(pcoinsTip->Cursor());
 
@@ -4096,14 +4442,9 @@ void ResyncSupply()
         Coin coin;
         if (pcursor->GetKey(key) && pcursor->GetValue(coin) && !coin.IsSpent()) {
             // ----------- burn address scanning -----------
-            CTxDestination source;
-            if (ExtractDestination(coin.out.scriptPubKey, source)) {
-                const std::string addr = EncodeDestination(source);
-                if (consensus.mBurnAddresses.find(addr) != consensus.mBurnAddresses.end() &&
-                    consensus.mBurnAddresses.at(addr) < chainActive.Height()) {
-                    pcursor->Next();
-                    continue;
-                }
+            if (Params().IsBurnScript(coin.out.scriptPubKey, chainActive.Height())) {
+                pcursor->Next();
+                continue;
             }
             nMoneySupply += coin.out.nValue;
         }
@@ -4113,6 +4454,70 @@ void ResyncSupply()
     chainActive.Tip()->nMoneySupply = nMoneySupply;
 }
 
+/** Apply the coin changes of a block again, some of them being possibly on disk already */
+static bool RollforwardBlock(const CBlockIndex* pindex, CCoinsViewCache& inputs)
+{
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex))
+        return error("%s: unable to read block %s at height %d", __func__, pindex->GetBlockHash().ToString(), pindex->nHeight);
+
+    for (const CTransaction& tx : block.vtx) {
+        if (!tx.IsCoinBase()) {
+            for (const CTxIn& txin : tx.vin)
+                inputs.SpendCoin(txin.prevout);
+        }
+        for (size_t i = 0; i < tx.vout.size(); i++)
+            inputs.AddCoin(COutPoint(tx.GetHash(), i), Coin(tx.vout[i], pindex->nHeight, tx.IsCoinBase(), tx.IsCoinStake()), true);
+    }
+    return true;
+}
+
+bool ReplayBlocks(CCoinsViewDB* view)
+{
+    LOCK(cs_main);
+
+    const std::vector<uint256> vhashHeads = view->GetHeadBlocks();
+    if (vhashHeads.empty())
+        return true; // the last write completed
+    if (vhashHeads.size() != 2)
+        return error("%s: unknown inconsistent state", __func__);
+
+    BlockMap::const_iterator itNew = mapBlockIndex.find(vhashHeads[0]);
+    if (itNew == mapBlockIndex.end())
+        return error("%s: the chainstate was written toward unknown block %s", __func__, vhashHeads[0].GetHex());
+    const CBlockIndex* pindexNew = itNew->second;
+
+    // Only writes moving the chainstate forward are done in parts, so the
+    // blocks after the old best block are all there is to apply again
+    // (the coinbase of the genesis block is never added).
+    int nHeightOld = 0;
+    if (!vhashHeads[1].IsNull()) {
+        BlockMap::const_iterator itOld = mapBlockIndex.find(vhashHeads[1]);
+        if (itOld == mapBlockIndex.end())
+            return error("%s: the chainstate was written from unknown block %s", __func__, vhashHeads[1].GetHex());
+        if (pindexNew->GetAncestor(itOld->second->nHeight) != itOld->second)
+            return error("%s: block %s doesn't descend from %s", __func__, vhashHeads[0].GetHex(), vhashHeads[1].GetHex());
+        nHeightOld = itOld->second->nHeight;
+    }
+
+    LogPrintf("%s: replaying blocks %d to %d of an interrupted chainstate write\n", __func__, nHeightOld + 1, pindexNew->nHeight);
+    uiInterface.ShowProgress(_("Replaying blocks..."), 0);
+    CCoinsViewCache cache(view);
+    for (int nHeight = nHeightOld + 1; nHeight <= pindexNew->nHeight; nHeight++) {
+        boost::this_thread::interruption_point();
+        uiInterface.ShowProgress(_("Replaying blocks..."), (int)((nHeight - nHeightOld) * 100 / (pindexNew->nHeight - nHeightOld + 1)));
+        if (!RollforwardBlock(pindexNew->GetAncestor(nHeight), cache))
+            return false;
+    }
+    uiInterface.ShowProgress("", 100);
+
+    // written at once, which also erases the head blocks
+    cache.SetBestBlock(pindexNew->GetBlockHash());
+    if (!cache.Flush())
+        return error("%s: failed to write the chainstate", __func__);
+    return true;
+}
+
 bool RewindBlockIndex(std::string param)
 {
     LOCK(cs_main);
@@ -4159,13 +4564,15 @@ bool RewindBlockIndex(std::string param)
 
     blocksToRollBack = nHeight - targetHeight;
     double blocksRolledBack = 0;
+    std::vector<std::vector<CTransaction>> vBlocksTx;
     // Iterate to start removing blocks
     while (nHeight > targetHeight) {
         blocksRolledBack++;
         // End loop if shutdown was requested
         if (ShutdownRequested()) return false;
 
-        if (!DisconnectTip(state)) {
+        if (!DisconnectTip(state, vBlocksTx)) {
+            ResurrectDisconnectedTransactions(vBlocksTx);
             FlushStateToDisk(state, FLUSH_STATE_PERIODIC);
             return error("%s: unable to disconnect block at height %i", __func__, nHeight);
         }
@@ -4178,6 +4585,7 @@ bool RewindBlockIndex(std::string param)
                     (blocksRolledBack / blocksToRollBack) * 100
                 )
             );
+            ResurrectDisconnectedTransactions(vBlocksTx);
             // flush state to disk.
             if (!FlushStateToDisk(state, FLUSH_STATE_PERIODIC)) {
                 return false;
@@ -4186,9 +4594,10 @@ bool RewindBlockIndex(std::string param)
 
         nHeight = chainActive.Height();
     }
+    ResurrectDisconnectedTransactions(vBlocksTx);
 
-    // flush state to disk.
-    if (!FlushStateToDisk(state, FLUSH_STATE_PERIODIC)) {
+    // flush state to disk, before the blocks are removed from the index below.
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
         return false;
     }
 
@@ -4342,16 +4751,57 @@ bool InitBlockIndex()
 }
 
 
-bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
+CBlockImportProgress blockImportProgress;
+
+/** Maximum number of blocks handed over at once by the import reader */
+static const size_t IMPORT_BATCH_MAX_BLOCKS = 128;
+/** Maximum size of the blocks handed over at once by the import reader */
+static const size_t IMPORT_BATCH_MAX_BYTES = 2 * MAX_BLOCK_SIZE_CURRENT;
+/** Maximum number of batches the import reader keeps ahead of the committer */
+static const size_t IMPORT_MAX_QUEUED_BATCHES = 4;
+
+namespace {
+
+/**
+ * Reader stage of LoadExternalBlockFile. It scans the file for the message
+ * start markers and deserializes the blocks on its own thread, handing them
+ * over in batches. The blocks are deserialized here and not on the hashing
+ * pool, so that a corrupted block is rescanned byte by byte as before.
+ */
+class CBlockFileReader
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+public:
+    struct CBatch {
+        std::vector<CBlock> vBlocks;
+        std::vector<unsigned int> vPos;
+        size_t nBytes{0};
+    };
 
-    int nLoaded = 0;
-    try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2 * MAX_BLOCK_SIZE_CURRENT, MAX_BLOCK_SIZE_CURRENT + 8, SER_DISK, CLIENT_VERSION);
+private:
+    CBufferedFile blkdat;
+    boost::mutex mutex;
+    //! The reader blocks on this while the queue is full
+    boost::condition_variable condReader;
+    //! The committer blocks on this while the queue is empty
+    boost::condition_variable condCommitter;
+    std::deque<CBatch> queue;
+    bool fDone{false};
+    std::string strError;
+    boost::thread thread;
+
+    void Push(CBatch& batch)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queue.size() >= IMPORT_MAX_QUEUED_BATCHES)
+            condReader.wait(lock); // interruption point
+        queue.push_back(std::move(batch));
+        condCommitter.notify_one();
+        batch = CBatch();
+    }
+
+    void ReadBlocks()
+    {
+        CBatch batch;
         uint64_t nRewind = blkdat.GetPos();
         while (!blkdat.eof()) {
             boost::this_thread::interruption_point();
@@ -4379,61 +4829,170 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
             try {
                 // read block
                 uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
                 blkdat.SetLimit(nBlockPos + nSize);
                 blkdat.SetPos(nBlockPos);
                 CBlock block;
                 blkdat >> block;
                 nRewind = blkdat.GetPos();
 
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != Params().GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__,
-                            hash.GetHex(), block.hashPrevBlock.GetHex());
+                batch.vBlocks.push_back(std::move(block));
+                batch.vPos.push_back(nBlockPos);
+                batch.nBytes += nSize;
+                blockImportProgress.nBlocksRead++;
+                blockImportProgress.nBytesRead += nSize;
+                if (batch.vBlocks.size() >= IMPORT_BATCH_MAX_BLOCKS || batch.nBytes >= IMPORT_BATCH_MAX_BYTES)
+                    Push(batch);
+            } catch (const std::exception& e) {
+                LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
+            }
+        }
+        if (!batch.vBlocks.empty())
+            Push(batch);
+    }
+
+    void Thread()
+    {
+        util::ThreadRename("pivx-loadblkrd");
+        try {
+            ReadBlocks();
+        } catch (const boost::thread_interrupted&) {
+            // the committer has left
+        } catch (const std::runtime_error& e) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            strError = e.what();
+        }
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fDone = true;
+        condCommitter.notify_all();
+    }
+
+public:
+    // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+    explicit CBlockFileReader(FILE* fileIn) : blkdat(fileIn, 2 * MAX_BLOCK_SIZE_CURRENT, MAX_BLOCK_SIZE_CURRENT + 8, SER_DISK, CLIENT_VERSION)
+    {
+        thread = boost::thread(&CBlockFileReader::Thread, this);
+    }
+
+    ~CBlockFileReader()
+    {
+        thread.interrupt();
+        thread.join();
+    }
+
+    /** Wait for the next batch of blocks, in file order. Returns false once the file is done. */
+    bool GetBatch(CBatch& batch)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queue.empty() && !fDone)
+            condCommitter.wait(lock); // interruption point
+        if (queue.empty())
+            return false;
+        batch = std::move(queue.front());
+        queue.pop_front();
+        condReader.notify_one();
+        return true;
+    }
+
+    /** The I/O error that stopped the reader, if any */
+    std::string GetError()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return strError;
+    }
+};
+
+} // anon namespace
+
+bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
+{
+    // Map of disk positions for blocks with unknown parent (only used for reindex)
+    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+    int64_t nStart = GetTimeMillis();
+
+    // The import is pipelined: the reader thread scans and deserializes the
+    // file, the headers of each batch are hashed on the X11KVS hashing pool,
+    // and this thread commits the blocks in file order.
+    blockImportProgress.Reset();
+    int nLoaded = 0;
+    try {
+        CBlockFileReader reader(fileIn);
+        CBlockFileReader::CBatch batch;
+        bool fStop = false;
+        while (!fStop && reader.GetBatch(batch)) {
+            boost::this_thread::interruption_point();
+
+            std::vector<const CBlockHeader*> vpHeaders;
+            vpHeaders.reserve(batch.vBlocks.size());
+            for (const CBlock& block : batch.vBlocks)
+                vpHeaders.push_back(&block);
+            std::vector<uint256> vHashes;
+            GetBlockHeaderHashes(vpHeaders, vHashes);
+            for (size_t i = 0; i < batch.vBlocks.size(); i++)
+                batch.vBlocks[i].SetCachedHash(vHashes[i]);
+            blockImportProgress.nBlocksHashed += batch.vBlocks.size();
+
+            for (size_t i = 0; i < batch.vBlocks.size(); i++) {
+                boost::this_thread::interruption_point();
+                blockImportProgress.nBlocksProcessed++;
+                try {
+                    const CBlock& block = batch.vBlocks[i];
                     if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
+                        dbp->nPos = batch.vPos[i];
+
+                    // detect out of order blocks, and store them for later
+                    const uint256& hash = vHashes[i];
+                    if (hash != Params().GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+                        LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__,
+                                hash.GetHex(), block.hashPrevBlock.GetHex());
+                        if (dbp)
+                            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+                        continue;
+                    }
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    CValidationState state;
-                    if (ProcessNewBlock(state, nullptr, &block, dbp, nullptr))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != Params().GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
+                    // process in case the block isn't known yet
+                    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+                        CValidationState state;
+                        if (ProcessNewBlock(state, nullptr, &block, dbp, nullptr))
+                            nLoaded++;
+                        if (state.IsError()) {
+                            fStop = true;
+                            break;
+                        }
+                    } else if (hash != Params().GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+                        LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+                    }
 
-                // Recursively process earlier encountered successors of this block
-                std::deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second)) {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                head.ToString());
-                            CValidationState dummy;
-                            if (ProcessNewBlock(dummy, nullptr, &block, &it->second, nullptr)) {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
+                    // Recursively process earlier encountered successors of this block
+                    std::deque<uint256> queue;
+                    queue.push_back(hash);
+                    while (!queue.empty()) {
+                        uint256 head = queue.front();
+                        queue.pop_front();
+                        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+                        while (range.first != range.second) {
+                            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+                            CBlock blockChild;
+                            if (ReadBlockFromDisk(blockChild, it->second)) {
+                                LogPrintf("%s: Processing out of order child %s of %s\n", __func__, blockChild.GetHash().ToString(),
+                                    head.ToString());
+                                CValidationState dummy;
+                                if (ProcessNewBlock(dummy, nullptr, &blockChild, &it->second, nullptr)) {
+                                    nLoaded++;
+                                    queue.push_back(blockChild.GetHash());
+                                }
                             }
+                            range.first++;
+                            mapBlocksUnknownParent.erase(it);
                         }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
                     }
+                } catch (const std::exception& e) {
+                    LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
             }
         }
+        const std::string strError = reader.GetError();
+        if (!strError.empty())
+            throw std::runtime_error(strError);
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
@@ -4698,6 +5257,53 @@ static void RelayAddress(const CAddress& addr, bool fReachable, CConnman& connma
     connman.ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
+static std::shared_ptr<const CBlockHeaderAndShortTxIDs> GetCmpctBlock(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+
+    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = GetLastCmpctBlock(pindex->GetBlockHash());
+    if (pcmpctblock)
+        return pcmpctblock;
+
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex))
+        return nullptr;
+    return std::make_shared<const CBlockHeaderAndShortTxIDs>(block);
+}
+
+/**
+ * Check the header of a compact block before any work is spent rebuilding it: the
+ * proof of work, or the proof of stake of the prefilled coinstake, and the contextual
+ * checks against its parent. Requires cs_main.
+ */
+static bool CheckCmpctBlockHeader(const CBlockHeaderAndShortTxIDs& cmpctblock, CBlockIndex* pindexPrev, CValidationState& state)
+{
+    AssertLockHeld(cs_main);
+
+    const CBlock block = cmpctblock.GetHeaderBlock();
+    const bool fProofOfStake = block.IsProofOfStake();
+
+    if (!CheckBlockHeader(block, state, !fProofOfStake))
+        return false;
+
+    if (pindexPrev->nStatus & BLOCK_FAILED_MASK)
+        return state.Invalid(error("%s : prev block %s is invalid", __func__, pindexPrev->GetBlockHash().GetHex()), REJECT_INVALID, "bad-prevblk");
+
+    if (!CheckWork(block, pindexPrev))
+        return state.DoS(100, false, REJECT_INVALID, "bad-diffbits", false, "incorrect proof of work");
+
+    if (!ContextualCheckBlockHeader(block, state, pindexPrev))
+        return false;
+
+    if (fProofOfStake) {
+        std::string strError;
+        if (!CheckProofOfStake(block, strError, pindexPrev))
+            return state.DoS(100, error("%s : proof of stake check failed (%s)", __func__, strError));
+    }
+
+    return true;
+}
+
 void static ProcessGetData(CNode* pfrom, CConnman& connman, std::atomic<bool>& interruptMsgProc)
 {
     AssertLockNotHeld(cs_main);
@@ -4718,7 +5324,7 @@ void static ProcessGetData(CNode* pfrom, CConnman& connman, std::atomic<bool>& i
                 return;
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end()) {
@@ -4737,14 +5343,24 @@ void static ProcessGetData(CNode* pfrom, CConnman& connman, std::atomic<bool>& i
                 }
                 // Don't send not-validated blocks
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
-                    else // MSG_FILTERED_BLOCK)
+                    // Send block from disk, the recent ones as a compact block when asked so
+                    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock;
+                    if (inv.type == MSG_CMPCT_BLOCK && chainActive.Height() - mi->second->nHeight <= MAX_CMPCTBLOCK_DEPTH)
+                        pcmpctblock = GetCmpctBlock(mi->second);
+                    if (pcmpctblock) {
+                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+                    } else if (inv.type == MSG_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
+                        // The network serialization of a block is the one on disk
+                        CSerializedNetMsg msg;
+                        msg.command = NetMsgType::BLOCK;
+                        if (!ReadRawBlockFromDisk(msg.data, (*mi).second))
+                            assert(!"cannot load block from disk");
+                        connman.PushMessage(pfrom, std::move(msg));
+                    } else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
                         bool send = false;
                         CMerkleBlock merkleBlock;
                         {
@@ -4857,6 +5473,73 @@ void static ProcessGetData(CNode* pfrom, CConnman& connman, std::atomic<bool>& i
 }
 
 bool fRequestedSporksIDB = false;
+/** An invalid block of the IBD download would hold it back forever, along with the blocks after it */
+static void DropInvalidBlockToDownload(const uint256& hashBlock)
+{
+    LOCK(cs_main);
+    if (blocksToDownload.DropFrom(hashBlock))
+        LogPrint(BCLog::NET, "Dropping invalid block %s and the blocks after it from the download\n", hashBlock.ToString());
+}
+
+/** Process a block received from a peer, in full or rebuilt from a compact block */
+static void ProcessBlockFromPeer(CNode* pfrom, const CBlock& block, CConnman& connman)
+{
+    const CInv inv(MSG_BLOCK, block.GetHash());
+    pfrom->AddInventoryKnown(inv);
+
+    CValidationState state;
+    if (!mapBlockIndex.count(block.GetHash())) {
+        ProcessNewBlock(state, pfrom, &block, nullptr, &connman);
+        int nDoS;
+        if (state.IsInvalid(nDoS)) {
+            assert(state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
+            connman.PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::REJECT, (std::string)NetMsgType::BLOCK, state.GetRejectCode(),
+                                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash));
+            if (nDoS > 0) {
+                TRY_LOCK(cs_main, lockMain);
+                if (lockMain) Misbehaving(pfrom->GetId(), nDoS);
+            }
+            DropInvalidBlockToDownload(inv.hash);
+        }
+        //disconnect this node if its old protocol version
+        pfrom->DisconnectOldProtocol(pfrom->nVersion, ActiveProtocol(), NetMsgType::BLOCK);
+    } else {
+        LogPrint(BCLog::NET, "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, block.GetHash().GetHex());
+    }
+}
+
+/** Process the blocks received ahead of their parent, now that the parent is in */
+static void ProcessBlocksAhead(const uint256& hashParent, CConnman& connman)
+{
+    uint256 hashPrev = hashParent;
+    while (true) {
+        CBlockDownloadQueue::CBlockAhead ahead;
+        {
+            LOCK(cs_main);
+            if (!mapBlockIndex.count(hashPrev) || !blocksToDownload.PopBlockAhead(hashPrev, ahead))
+                return;
+        }
+
+        // Processed on behalf of the peer it came from, for the block source and the spam filter
+        CNode* pnodeFrom = nullptr;
+        connman.ForNode(ahead.nodeid, [&pnodeFrom](CNode* pnode) {
+            pnodeFrom = pnode->AddRef();
+            return true;
+        });
+        if (pnodeFrom) {
+            ProcessBlockFromPeer(pnodeFrom, *ahead.pblock, connman);
+            pnodeFrom->Release();
+        } else {
+            // The peer is gone, there is nobody left to blame
+            CValidationState state;
+            ProcessNewBlock(state, nullptr, ahead.pblock.get(), nullptr, &connman);
+            if (state.IsInvalid())
+                DropInvalidBlockToDownload(ahead.pblock->GetHash());
+        }
+        hashPrev = ahead.pblock->GetHash();
+    }
+}
+
 bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vRecv, int64_t nTimeReceived, CConnman& connman, std::atomic<bool>& interruptMsgProc)
 {
     LogPrint(BCLog::NET, "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -5069,10 +5752,32 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        // Ask the peers supporting it to relay us the blocks as compact blocks. The outbound
+        // peers, the ones we chose, announce the new blocks with a cmpctblock right away.
+        if (pfrom->nVersion >= COMPACT_BLOCKS_VERSION && (pfrom->nServices & NODE_COMPACT_BLOCKS) &&
+            (pfrom->GetLocalServices() & NODE_COMPACT_BLOCKS)) {
+            bool fAnnounceUsingCMPCTBLOCK = !pfrom->fInbound;
+            uint64_t nCMPCTBLOCKVersion = 1;
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion));
+        }
         pfrom->fSuccessfullyConnected = true;
     }
 
 
+    else if (strCommand == NetMsgType::SENDCMPCT) {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (nCMPCTBLOCKVersion == 1 && (pfrom->GetLocalServices() & NODE_COMPACT_BLOCKS)) {
+            LOCK(cs_main);
+            CNodeState* state = State(pfrom->GetId());
+            state->fSupportsCmpctBlocks = true;
+            state->fPreferCmpctBlocks = fAnnounceUsingCMPCTBLOCK;
+        }
+    }
+
+
     else if (strCommand == NetMsgType::ADDR) {
         std::vector<CAddress> vAddr;
         vRecv >> vAddr;
@@ -5128,6 +5833,11 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
 
         LOCK(cs_main);
 
+        // The getblocks answers go to the download queue while in IBD, they are
+        // asked to all the peers from there. A single block is an announcement,
+        // left to the queue as long as it is syncing us.
+        const bool fQueueBlocks = vInv.size() > 1 && IsInitialBlockDownload();
+
         std::vector<CInv> vToFetch;
 
         for (unsigned int nInv = 0; nInv < vInv.size(); nInv++) {
@@ -5147,9 +5857,19 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
 
             if (inv.type == MSG_BLOCK) {
                 UpdateBlockAvailability(pfrom->GetId(), inv.hash);
-                if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
-                    // Add this to the list of blocks to request
-                    vToFetch.push_back(inv);
+                if (fQueueBlocks && !fAlreadyHave && !fImporting && !fReindex) {
+                    blocksToDownload.Push(inv.hash);
+                } else if (blocksToDownload.Empty() && !fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
+                    // Add this to the list of blocks to request, as a compact block
+                    // once synced since its transactions should be in our mempool
+                    CNodeState* nodestate = State(pfrom->GetId());
+                    if (nodestate->fSupportsCmpctBlocks && !IsInitialBlockDownload() &&
+                        nodestate->mapCmpctBlocksRequested.size() < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                        nodestate->mapCmpctBlocksRequested.emplace(inv.hash, GetTimeMicros());
+                        vToFetch.push_back(CInv(MSG_CMPCT_BLOCK, inv.hash));
+                    } else {
+                        vToFetch.push_back(inv);
+                    }
                     LogPrint(BCLog::NET, "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
                 }
             }
@@ -5462,6 +6182,35 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         CInv inv(MSG_BLOCK, hashBlock);
         LogPrint(BCLog::NET, "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
 
+        {
+            LOCK(cs_main);
+            // A block asked as a compact block may come in full, if it got deep meanwhile
+            State(pfrom->GetId())->mapCmpctBlocksRequested.erase(hashBlock);
+
+            if (blocksToDownload.Contains(hashBlock)) {
+                // It came in: the peers which stalled it no longer skip it
+                for (std::pair<const NodeId, CNodeState>& entry : mapNodeState) {
+                    if (entry.second.hashStalledBlock == hashBlock)
+                        entry.second.hashStalledBlock.SetNull();
+                }
+
+                // A block of the IBD download: widen the window of the peer delivering it
+                std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator it = mapBlocksInFlight.find(hashBlock);
+                if (it != mapBlocksInFlight.end() && it->second.first == pfrom->GetId()) {
+                    CNodeState* nodestate = State(pfrom->GetId());
+                    nodestate->nBlocksDownloadWindow = std::min(MAX_BLOCKS_DOWNLOAD_PER_PEER, nodestate->nBlocksDownloadWindow + 1);
+                }
+
+                // and keep it until its parent is in when it came first
+                if (!mapBlockIndex.count(block.hashPrevBlock)) {
+                    pfrom->AddInventoryKnown(inv);
+                    MarkBlockAsReceived(hashBlock);
+                    blocksToDownload.HoldBlockAhead(pfrom->GetId(), block);
+                    return true;
+                }
+            }
+        }
+
         //sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
         if (!mapBlockIndex.count(block.hashPrevBlock)) {
             if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
@@ -5474,27 +6223,149 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
                 pfrom->vBlockRequested.push_back(hashBlock);
             }
         } else {
-            pfrom->AddInventoryKnown(inv);
+            ProcessBlockFromPeer(pfrom, block, connman);
+            ProcessBlocksAhead(hashBlock, connman);
+        }
+    }
+
+
+    else if (strCommand == NetMsgType::CMPCTBLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        const uint256 hashBlock = cmpctblock.header.GetHash();
+        LogPrint(BCLog::NET, "received cmpctblock %s peer=%d\n", hashBlock.ToString(), pfrom->id);
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+            CNodeState* nodestate = State(pfrom->GetId());
+
+            // Only rebuild the compact blocks we asked for, or the new blocks of the
+            // outbound peers, which were asked to announce them that way
+            const bool fRequested = nodestate->mapCmpctBlocksRequested.erase(hashBlock);
+            if (!fRequested && (pfrom->fInbound || !nodestate->fSupportsCmpctBlocks)) {
+                LogPrint(BCLog::NET, "Peer %d sent us an unrequested compact block %s\n", pfrom->id, hashBlock.ToString());
+                return true;
+            }
+            pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hashBlock));
+
+            BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+            if (mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA))
+                return true;
+
+            // Catch up from our tip through the block inventory, which asks for the missing parents
+            BlockMap::iterator miPrev = mapBlockIndex.find(cmpctblock.header.hashPrevBlock);
+            if (miPrev == mapBlockIndex.end()) {
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETBLOCKS, chainActive.GetLocator(), UINT256_ZERO));
+                return true;
+            }
 
             CValidationState state;
-            if (!mapBlockIndex.count(block.GetHash())) {
-                ProcessNewBlock(state, pfrom, &block, nullptr, &connman);
+            if (!CheckCmpctBlockHeader(cmpctblock, miPrev->second, state)) {
                 int nDoS;
-                if (state.IsInvalid(nDoS)) {
-                    assert(state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
-                    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::REJECT, strCommand, state.GetRejectCode(),
-                                                   state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash));
-                    if (nDoS > 0) {
-                        TRY_LOCK(cs_main, lockMain);
-                        if (lockMain) Misbehaving(pfrom->GetId(), nDoS);
-                    }
-                }
-                //disconnect this node if its old protocol version
-                pfrom->DisconnectOldProtocol(pfrom->nVersion, ActiveProtocol(), strCommand);
-            } else {
-                LogPrint(BCLog::NET, "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, block.GetHash().GetHex());
+                if (state.IsInvalid(nDoS) && nDoS > 0)
+                    Misbehaving(pfrom->GetId(), nDoS);
+                return error("Peer %d sent us a compact block %s with an invalid header: %s", pfrom->id, hashBlock.ToString(), FormatStateMessage(state));
+            }
+
+            nodestate->partialBlock.reset(new PartiallyDownloadedBlock(&mempool));
+            nodestate->hashPartialBlock = hashBlock;
+            ReadStatus status = nodestate->partialBlock->InitData(cmpctblock);
+            if (status == READ_STATUS_INVALID) {
+                nodestate->partialBlock.reset();
+                Misbehaving(pfrom->GetId(), 100);
+                return error("Peer %d sent us invalid compact block %s", pfrom->id, hashBlock.ToString());
+            }
+
+            std::vector<uint16_t> vMissing;
+            if (status == READ_STATUS_OK) {
+                vMissing = nodestate->partialBlock->GetMissingIndexes();
+                if (vMissing.empty())
+                    status = nodestate->partialBlock->FillBlock(block, std::vector<CTransaction>());
+            }
+            if (status == READ_STATUS_OK && !vMissing.empty()) {
+                // Ask for the transactions we don't have
+                BlockTransactionsRequest req;
+                req.blockhash = hashBlock;
+                req.indexes = std::move(vMissing);
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETBLOCKTXN, req));
+                return true;
+            }
+            nodestate->partialBlock.reset();
+            if (status != READ_STATUS_OK) {
+                // Short id collision, or an invalid reconstruction
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, std::vector<CInv>(1, CInv(MSG_BLOCK, hashBlock))));
+                return true;
             }
         }
+
+        ProcessBlockFromPeer(pfrom, block, connman);
+    }
+
+
+    else if (strCommand == NetMsgType::GETBLOCKTXN) {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint(BCLog::NET, "Peer %d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+
+        if (mi->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            // An old block is sent in full instead. The message processing
+            // loop goes through vRecvGetData next.
+            LogPrint(BCLog::NET, "Peer %d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_BLOCKTXN_DEPTH);
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, mi->second))
+            assert(!"cannot load block from disk");
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("Peer %d sent us a getblocktxn with out-of-bounds tx indices", pfrom->id);
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCKTXN, resp));
+    }
+
+
+    else if (strCommand == NetMsgType::BLOCKTXN && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+            CNodeState* nodestate = State(pfrom->GetId());
+            if (!nodestate->partialBlock || nodestate->hashPartialBlock != resp.blockhash) {
+                LogPrint(BCLog::NET, "Peer %d sent us a blocktxn for block %s we weren't expecting\n", pfrom->id, resp.blockhash.ToString());
+                return true;
+            }
+
+            ReadStatus status = nodestate->partialBlock->FillBlock(block, resp.txn);
+            nodestate->partialBlock.reset();
+            if (status == READ_STATUS_INVALID) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("Peer %d sent us invalid compact block/non-matching block transactions", pfrom->id);
+            } else if (status == READ_STATUS_FAILED) {
+                // Might have collided, fall back to getdata now :(
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, std::vector<CInv>(1, CInv(MSG_BLOCK, resp.blockhash))));
+                return true;
+            }
+        }
+
+        ProcessBlockFromPeer(pfrom, block, connman);
     }
 
     // This asymmetric behavior for inbound and outbound connections was introduced
@@ -5503,9 +6374,10 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     // Making users (which are behind NAT and can only make outgoing connections) ignore
     // getaddr message mitigates the attack.
     else if ((strCommand == NetMsgType::GETADDR) && (pfrom->fInbound)) {
-        pfrom->vAddrToSend.clear();
         std::vector<CAddress> vAddr = connman.GetAddresses();
         FastRandomContext insecure_rand;
+        LOCK(pfrom->cs_addrToSend);
+        pfrom->vAddrToSend.clear();
         for (const CAddress& addr : vAddr)
             pfrom->PushAddress(addr, insecure_rand);
     }
@@ -5670,6 +6542,25 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     }
 
 
+    else if (strCommand == NetMsgType::NOTFOUND) {
+        std::vector<CInv> vInv;
+        vRecv >> vInv;
+        if (vInv.size() > MAX_INV_SZ) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 20);
+            return error("message notfound size() = %u", vInv.size());
+        }
+
+        // The compact blocks the peer doesn't have won't come
+        LOCK(cs_main);
+        CNodeState* nodestate = State(pfrom->GetId());
+        for (const CInv& inv : vInv) {
+            if (inv.type == MSG_CMPCT_BLOCK || inv.type == MSG_BLOCK)
+                nodestate->mapCmpctBlocksRequested.erase(inv.hash);
+        }
+    }
+
+
     else if (strCommand == NetMsgType::REJECT) {
         try {
             std::string strMsg;
@@ -5724,56 +6615,69 @@ int ActiveProtocol()
     return std::min(PROTOCOL_VERSION, (int)sporkManager.GetSporkValue(SPORK_14_MIN_PROTOCOL_ACCEPTED));
 }
 
-bool ProcessMessages(CNode* pfrom, CConnman& connman, std::atomic<bool>& interruptMsgProc)
+/**
+ * Commands run by the message workers concurrently across peers once the
+ * handshake is done. Their handlers take cs_main themselves around the few
+ * chain state reads they need, instead of holding up the chain lane.
+ */
+static bool IsParallelMessage(const std::string& strCommand)
 {
-    // Message format
-    //  (4) message start
-    //  (12) command
-    //  (4) size
-    //  (4) checksum
-    //  (x) data
-    //
-    bool fMoreWork = false;
-
-    if (!pfrom->vRecvGetData.empty())
-        ProcessGetData(pfrom, connman, interruptMsgProc);
-
-    if (pfrom->fDisconnect)
-        return false;
-
-    // this maintains the order of responses
-    if (!pfrom->vRecvGetData.empty()) return true;
-
-    // Don't bother if send buffer is too full to respond anyway
-    if (pfrom->fPauseSend)
-        return false;
+    return strCommand == NetMsgType::MNBROADCAST ||
+           strCommand == NetMsgType::MNPING ||
+           strCommand == NetMsgType::GETMNLIST ||
+           strCommand == NetMsgType::SPORK ||
+           strCommand == NetMsgType::GETSPORKS ||
+           strCommand == NetMsgType::ADDR ||
+           strCommand == NetMsgType::GETADDR ||
+           strCommand == NetMsgType::PING ||
+           strCommand == NetMsgType::PONG;
+}
 
-    std::list<CNetMessage> msgs;
+/** Take the next message of the peer, only if it is a parallel one when fParallelOnly */
+static bool TakeMessage(CNode* pfrom, CConnman& connman, bool fParallelOnly, std::list<CNetMessage>& msgs, bool& fMoreWork)
+{
+    bool fResumeRecv = false;
     {
         LOCK(pfrom->cs_vProcessMsg);
         if (pfrom->vProcessMsg.empty())
             return false;
+        if (fParallelOnly && !IsParallelMessage(pfrom->vProcessMsg.front().hdr.GetCommand()))
+            return false;
         // Just take one message
         msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
         pfrom->nProcessQueueSize -= msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
+        fResumeRecv = pfrom->fPauseRecv && pfrom->nProcessQueueSize <= connman.GetReceiveFloodSize();
         pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman.GetReceiveFloodSize();
         fMoreWork = !pfrom->vProcessMsg.empty();
     }
-    CNetMessage& msg(msgs.front());
+    // the socket handler doesn't wait on a paused peer, tell it to read again
+    if (fResumeRecv)
+        connman.WakeSocketHandler();
+    return true;
+}
 
+static void RunMessage(CNode* pfrom, CNetMessage& msg, CConnman& connman, std::atomic<bool>& interruptMsgProc)
+{
+    // Message format
+    //  (4) message start
+    //  (12) command
+    //  (4) size
+    //  (4) checksum
+    //  (x) data
+    //
     msg.SetVersion(pfrom->GetRecvVersion());
     // Scan for message start
     if (memcmp(msg.hdr.pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0) {
         LogPrintf("PROCESSMESSAGE: INVALID MESSAGESTART %s peer=%d\n", SanitizeString(msg.hdr.GetCommand()), pfrom->id);
         pfrom->fDisconnect = true;
-        return false;
+        return;
     }
 
     // Read header
     CMessageHeader& hdr = msg.hdr;
     if (!hdr.IsValid(Params().MessageStart())) {
         LogPrintf("PROCESSMESSAGE: ERRORS IN HEADER %s peer=%d\n", SanitizeString(hdr.GetCommand()), pfrom->id);
-        return fMoreWork;
+        return;
     }
     std::string strCommand = hdr.GetCommand();
 
@@ -5789,7 +6693,7 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, std::atomic<bool>& interru
                SanitizeString(strCommand), nMessageSize,
                HexStr(hash.begin(), hash.begin()+CMessageHeader::CHECKSUM_SIZE),
                HexStr(hdr.pchChecksum, hdr.pchChecksum+CMessageHeader::CHECKSUM_SIZE));
-            return fMoreWork;
+            return;
         }
 
     // Process message
@@ -5797,9 +6701,7 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, std::atomic<bool>& interru
     try {
         fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, connman, interruptMsgProc);
         if (interruptMsgProc)
-            return false;
-        if (!pfrom->vRecvGetData.empty())
-            fMoreWork = true;
+            return;
     } catch (const std::ios_base::failure& e) {
         connman.PushMessage(pfrom, CNetMsgMaker(INIT_PROTO_VERSION).Make(NetMsgType::REJECT, strCommand, REJECT_MALFORMED, std::string("error parsing message")));
         if (strstr(e.what(), "end of data")) {
@@ -5819,6 +6721,60 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, std::atomic<bool>& interru
 
     if (!fRet)
         LogPrintf("ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
+}
+
+/** Run on a message worker the peer messages in a row which are parallel ones */
+static void ProcessParallelMessages(CNode* pfrom, CConnman& connman, std::atomic<bool>& interruptMsgProc)
+{
+    std::list<CNetMessage> msgs;
+    bool fMoreWork = false;
+    while (!interruptMsgProc && !pfrom->fDisconnect && !pfrom->fPauseSend &&
+           TakeMessage(pfrom, connman, true, msgs, fMoreWork)) {
+        RunMessage(pfrom, msgs.front(), connman, interruptMsgProc);
+        msgs.clear();
+    }
+}
+
+bool ProcessMessages(CNode* pfrom, CConnman& connman, std::atomic<bool>& interruptMsgProc)
+{
+    bool fMoreWork = false;
+
+    if (!pfrom->vRecvGetData.empty())
+        ProcessGetData(pfrom, connman, interruptMsgProc);
+
+    if (pfrom->fDisconnect)
+        return false;
+
+    // this maintains the order of responses
+    if (!pfrom->vRecvGetData.empty()) return true;
+
+    // Don't bother if send buffer is too full to respond anyway
+    if (pfrom->fPauseSend)
+        return false;
+
+    // Hand the messages which only briefly need cs_main over to the workers, so that
+    // a flood of them doesn't hold back the blocks of the other peers
+    if (connman.HasMessageWorkers() && pfrom->fSuccessfullyConnected) {
+        bool fParallel = false;
+        {
+            LOCK(pfrom->cs_vProcessMsg);
+            fParallel = !pfrom->vProcessMsg.empty() && IsParallelMessage(pfrom->vProcessMsg.front().hdr.GetCommand());
+        }
+        if (fParallel) {
+            connman.AddMessageTask(pfrom, std::bind(&ProcessParallelMessages, pfrom, std::ref(connman), std::ref(interruptMsgProc)));
+            return false;
+        }
+    }
+
+    std::list<CNetMessage> msgs;
+    if (!TakeMessage(pfrom, connman, false, msgs, fMoreWork))
+        return false;
+
+    RunMessage(pfrom, msgs.front(), connman, interruptMsgProc);
+    if (interruptMsgProc)
+        return false;
+    if (!pfrom->vRecvGetData.empty())
+        fMoreWork = true;
 
     return fMoreWork;
 }
@@ -5901,6 +6857,7 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
             std::vector<CAddress> vAddr;
+            LOCK(pto->cs_addrToSend);
             vAddr.reserve(pto->vAddrToSend.size());
             for (const CAddress& addr : pto->vAddrToSend) {
                 if (!pto->addrKnown.contains(addr.GetKey())) {
@@ -5960,6 +6917,16 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
                 if (inv.type == MSG_TX && pto->filterInventoryKnown.contains(inv.hash))
                     continue;
 
+                // The new best block goes as a cmpctblock to the peers asking so, saving the getdata round trip
+                if (inv.type == MSG_BLOCK && state.fPreferCmpctBlocks && inv.hash == chainActive.Tip()->GetBlockHash()) {
+                    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = GetLastCmpctBlock(inv.hash);
+                    if (pcmpctblock) {
+                        pto->filterInventoryKnown.insert(inv.hash);
+                        connman.PushMessage(pto, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+                        continue;
+                    }
+                }
+
                 // trickle out tx inv to protect privacy
                 if (inv.type == MSG_TX && !fSendTrickle) {
                     // 1/4 of tx invs blast to all immediately
@@ -6009,11 +6976,38 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
             pto->fDisconnect = true;
             return true;
         }
+        // Forget the compact blocks this peer didn't deliver in time, they would hold its slots forever
+        for (std::map<uint256, int64_t>::iterator it = state.mapCmpctBlocksRequested.begin(); it != state.mapCmpctBlocksRequested.end();) {
+            if (it->second < nNow - 1000000 * 2 * Params().GetConsensus().nTargetSpacing) {
+                LogPrint(BCLog::NET, "Timeout downloading compact block %s from peer=%d\n", it->first.ToString(), pto->id);
+                it = state.mapCmpctBlocksRequested.erase(it);
+            } else {
+                ++it;
+            }
+        }
 
         //
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
+        if (!blocksToDownload.Empty()) {
+            if (!IsInitialBlockDownload()) {
+                ClearBlocksToDownload();
+            } else {
+                if (!pto->fClient && pto->nStartingHeight > chainActive.Height())
+                    RequestBlocksToDownload(pto, state, nNow, vGetData);
+
+                // Extend the queue from its end through the peer we sync from, before it runs dry
+                if (state.fSyncStarted && !blocksToDownload.Empty() && blocksToDownload.Size() < BLOCK_DOWNLOAD_WINDOW &&
+                    (blocksToDownload.Back() != hashBlocksToDownloadEnd || nBlocksToDownloadEndTime < nNow - 30 * 1000000)) {
+                    CBlockLocator locator = chainActive.GetLocator();
+                    locator.vHave.insert(locator.vHave.begin(), blocksToDownload.Back());
+                    connman.PushMessage(pto, msgMaker.Make(NetMsgType::GETBLOCKS, locator, UINT256_ZERO));
+                    hashBlocksToDownloadEnd = blocksToDownload.Back();
+                    nBlocksToDownloadEndTime = nNow;
+                }
+            }
+        }
         if (!pto->fClient && fFetch && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
             std::vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
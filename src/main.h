@@ -36,8 +36,11 @@
 
 #include <algorithm>
 #include <atomic>
+#include <deque>
 #include <exception>
+#include <functional>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -46,7 +49,10 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewDB;
+class CCoinsViewDBWriter;
 class CSporkDB;
+class CSupplyDelta;
 class CBloomFilter;
 class CInv;
 class CConnman;
@@ -91,6 +97,8 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** The maximum size of the raw blocks kept in memory to serve them again */
+static const size_t MAX_RAW_BLOCK_CACHE_SIZE = 0x2000000; // 32 MiB
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
@@ -107,6 +115,12 @@ static const unsigned int MAX_HEADERS_RESULTS = 2000;
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
  *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Bounds of the per peer number of blocks in flight while downloading the chain from all the peers in IBD.
+ *  It grows by one with every block the peer delivers and halves when the peer stalls the download. */
+static const int MIN_BLOCKS_DOWNLOAD_PER_PEER = 4;
+static const int MAX_BLOCKS_DOWNLOAD_PER_PEER = 128;
+/** The maximum size of the blocks received ahead of their parent, kept in memory until it is connected */
+static const size_t MAX_BLOCKS_AHEAD_SIZE = 0x4000000; // 64 MiB
 /** Time to wait (in seconds) between writing blocks/block index to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
@@ -124,6 +138,13 @@ static const unsigned int AVG_INVENTORY_BROADCAST_INTERVAL = 5;
 /** Enable bloom filter */
  static const bool DEFAULT_PEERBLOOMFILTERS = true;
 
+/** Relay and serve the blocks as compact blocks */
+static const bool DEFAULT_PEERCOMPACTBLOCKS = true;
+/** Maximum depth of the blocks served as a cmpctblock, the deeper ones are sent in full */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Maximum depth of the blocks whose transactions are served with a blocktxn */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+
 /** If the tip is older than this (in seconds), the node is considered to be in initial block download. */
 static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 
@@ -200,6 +221,27 @@ FILE* OpenBlockFile(const CDiskBlockPos& pos, bool fReadOnly = false);
 FILE* OpenUndoFile(const CDiskBlockPos& pos, bool fReadOnly = false);
 /** Translation to a filesystem path */
 fs::path GetBlockPosFilename(const CDiskBlockPos& pos, const char* prefix);
+/** Progress counters of the block import pipeline (-reindex, -loadblock, bootstrap.dat) */
+struct CBlockImportProgress {
+    //! Blocks found and deserialized by the reader thread
+    std::atomic<uint64_t> nBlocksRead{0};
+    //! Bytes of block data handed over by the reader thread
+    std::atomic<uint64_t> nBytesRead{0};
+    //! Block headers hashed on the hashing pool
+    std::atomic<uint64_t> nBlocksHashed{0};
+    //! Blocks committed, in file order, to ProcessNewBlock
+    std::atomic<uint64_t> nBlocksProcessed{0};
+
+    //! Start over, for the next file
+    void Reset()
+    {
+        nBlocksRead = 0;
+        nBytesRead = 0;
+        nBlocksHashed = 0;
+        nBlocksProcessed = 0;
+    }
+};
+extern CBlockImportProgress blockImportProgress;
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp = NULL);
 /** Initialize a new block tree database + block data on disk */
@@ -208,6 +250,8 @@ bool InitBlockIndex();
 bool LoadBlockIndex(std::string& strError);
 /** Unload database information */
 void UnloadBlockIndex();
+/** Complete a background write of the chainstate which was interrupted, from the blocks on disk */
+bool ReplayBlocks(CCoinsViewDB* view);
 /** See whether the protocol update is enforced for connected nodes */
 int ActiveProtocol();
 /** Process protocol messages received from a given node */
@@ -265,6 +309,63 @@ struct CNodeStateStats {
     std::vector<int> vHeightInFlight;
 };
 
+/**
+ * Blocks announced by the getblocks answers while in IBD, in chain order. They are downloaded
+ * from all the peers at once and connected in order, the ones received ahead of their parent
+ * being held meanwhile, up to a total size.
+ */
+class CBlockDownloadQueue
+{
+public:
+    struct CBlockAhead {
+        //! Peer the block came from, blamed when it turns out invalid
+        NodeId nodeid;
+        std::shared_ptr<const CBlock> pblock;
+        size_t nSize;
+    };
+
+private:
+    std::deque<uint256> vBlocks;
+    std::set<uint256> setBlocks;
+    //! Blocks received ahead of their parent, by parent hash
+    std::map<uint256, CBlockAhead> mapBlocksAhead;
+    std::set<uint256> setBlocksAhead;
+    size_t nBlocksAheadSize;
+    size_t nMaxBlocksAheadSize;
+
+public:
+    explicit CBlockDownloadQueue(size_t nMaxBlocksAheadSizeIn = MAX_BLOCKS_AHEAD_SIZE) :
+        nBlocksAheadSize(0), nMaxBlocksAheadSize(nMaxBlocksAheadSizeIn) {}
+
+    bool Empty() const { return vBlocks.empty(); }
+    size_t Size() const { return vBlocks.size(); }
+    const uint256& Front() const { return vBlocks.front(); }
+    const uint256& Back() const { return vBlocks.back(); }
+    bool Contains(const uint256& hash) const { return setBlocks.count(hash) > 0; }
+
+    //! Queue a block to download, false if it is queued already
+    bool Push(const uint256& hash);
+    //! Drop the blocks we have now from the front of the queue
+    void Prune(const BlockMap& mapIndex);
+    //! Drop an invalid block with the ones queued after it, held ahead or not, false if it isn't queued
+    bool DropFrom(const uint256& hash);
+    void Clear();
+
+    /**
+     * The next blocks to ask, at most nCount, among the first nWindow ones of the queue.
+     * The blocks held ahead and the ones fSkip returns true for are left out.
+     */
+    void FindBlocksToRequest(size_t nCount, size_t nWindow, const std::function<bool(const uint256&)>& fSkip, std::vector<uint256>& vBlocksRet) const;
+
+    //! Keep a block received before its parent, false if it is held already or there is no room for it
+    bool HoldBlockAhead(NodeId nodeid, const CBlock& block);
+    //! Take the block held ahead on top of hashParent, false if there is none
+    bool PopBlockAhead(const uint256& hashParent, CBlockAhead& aheadRet);
+    bool IsHeldAhead(const uint256& hash) const { return setBlocksAhead.count(hash) > 0; }
+    bool HasBlocksAhead() const { return !mapBlocksAhead.empty(); }
+    size_t GetBlocksAheadSize() const { return nBlocksAheadSize; }
+};
+
 CAmount GetMinRelayFee(const CTransaction& tx, const CTxMemPool& pool, unsigned int nBytes, bool fAllowFree);
 
 /**
@@ -289,6 +390,18 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
 
+/**
+ * Give the transactions of disconnected blocks back to the mempool and let wallets know
+ * they went from confirmed to 0-confirmed or conflicted. vBlocksTx holds the transactions
+ * of every block in the order the blocks were disconnected, the oldest block is resurrected
+ * first so parents enter the mempool before their children. Done once for a whole reorg,
+ * against the tip it ends on, instead of after every disconnected block.
+ * setConfirmed holds the transactions which the blocks connected since are confirming again:
+ * they are left out, as they can't enter the mempool and removing them would evict their
+ * valid in-mempool children.
+ */
+void ResurrectDisconnectedTransactions(std::vector<std::vector<CTransaction>>& vBlocksTx, const std::set<uint256>& setConfirmed = std::set<uint256>());
+
 bool IsTransactionInChain(const uint256& txId, int& nHeightTx, CTransaction& tx);
 bool IsTransactionInChain(const uint256& txId, int& nHeightTx);
 bool IsBlockHashInChain(const uint256& hashBlock);
@@ -351,7 +464,12 @@ public:
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read a block known to the index. The indexed hash is trusted instead of hashing the header again,
+ *  fCheckIntegrity also checks the transactions read against the merkle root. */
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, bool fCheckIntegrity = false);
+/** Read the serialized bytes of a block known to the index, as stored on disk, to serve them without
+ *  deserializing. The header is checked against the index and the recently read blocks are cached. */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vBlock, const CBlockIndex* pindex);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -366,8 +484,9 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
 bool DisconnectBlocks(int nBlocks);
 void ReprocessBlocks(int nBlocks);
 
-/** Apply the effects of this block (with given index) on the UTXO set represented by coins */
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck, bool fAlreadyChecked = false);
+/** Apply the effects of this block (with given index) on the UTXO set represented by coins.
+ *  If pdelta is provided, the coins added and spent are recorded in it for the supply index. */
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck, bool fAlreadyChecked = false, CSupplyDelta* pdelta = nullptr);
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
@@ -426,6 +545,9 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache* pcoinsTip;
 
+/** Global variable that points to the background writer of pcoinsTip's flushes (protected by cs_main) */
+extern CCoinsViewDBWriter* pcoinswriter;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB* pblocktree;
 
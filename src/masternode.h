@@ -27,7 +27,6 @@
 class CMasternode;
 class CMasternodeBroadcast;
 class CMasternodePing;
-extern std::map<int64_t, uint256> mapCacheBlockHashes;
 
 bool GetBlockHash(uint256& hash, int nBlockHeight);
 
@@ -189,8 +188,6 @@ public:
         return !(a.vin == b.vin);
     }
 
-    uint256 CalculateScore(int mod = 1, int64_t nBlockHeight = 0);
-
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -303,6 +300,7 @@ public:
     static CAmount GetMasternodePayment(int nHeight);
     static void InitMasternodeCollateralList();
     static std::pair<int, CAmount> GetNextMasternodeCollateral(int nHeight);
+    static const std::vector<std::pair<int, CAmount>>& GetMasternodeCollateralList();
 };
 
 //
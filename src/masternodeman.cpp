@@ -15,6 +15,7 @@
 #include "netbase.h"
 #include "netmessagemaker.h"
 #include "spork.h"
+#include "supplyindex.h"
 #include "util.h"
 
 #include <boost/thread/thread.hpp>
@@ -25,11 +26,13 @@ CMasternodeMan mnodeman;
 /** Keep track of the active Masternode */
 CActiveMasternodeMan amnodeman;
 
+// longest since paid first, ties broken by the collateral so every node agrees on the order
 struct CompareLastPaid {
     bool operator()(const std::pair<int64_t, CTxIn>& t1,
         const std::pair<int64_t, CTxIn>& t2) const
     {
-        return t1.first < t2.first;
+        if (t1.first != t2.first) return t1.first > t2.first;
+        return t1.second.prevout < t2.second.prevout;
     }
 };
 
@@ -71,11 +74,15 @@ bool CMasternodeDB::Write(const CMasternodeMan& mnodemanToSave)
     uint256 hash = Hash(ssMasternodes.begin(), ssMasternodes.end());
     ssMasternodes << hash;
 
-    // open output file, and associate with CAutoFile
-    FILE* file = fsbridge::fopen(pathMN, "wb");
+    // open a temporary output file, and associate with CAutoFile, so the file
+    // is never truncated while it could be mapped by a reader
+    unsigned short randv = 0;
+    GetRandBytes((unsigned char*)&randv, sizeof(randv));
+    fs::path pathTmp = GetDataDir() / strprintf("mncache.dat.%04x", randv);
+    FILE* file = fsbridge::fopen(pathTmp, "wb");
     CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathMN.string());
+        return error("%s : Failed to open file %s", __func__, pathTmp.string());
 
     // Write and commit header, data
     try {
@@ -86,6 +93,10 @@ bool CMasternodeDB::Write(const CMasternodeMan& mnodemanToSave)
     //    FileCommit(fileout);
     fileout.fclose();
 
+    // replace existing mncache.dat, if any, with new mncache.dat.XXXX
+    if (!RenameOver(pathTmp, pathMN))
+        return error("%s : Rename-into-place failed", __func__);
+
     LogPrint(BCLog::MASTERNODE,"Written info to mncache.dat  %dms\n", GetTimeMillis() - nStart);
     LogPrint(BCLog::MASTERNODE,"  %s\n", mnodemanToSave.ToString());
 
@@ -95,43 +106,30 @@ bool CMasternodeDB::Write(const CMasternodeMan& mnodemanToSave)
 CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad, bool fDryRun)
 {
     int64_t nStart = GetTimeMillis();
-    // open input file, and associate with CAutoFile
-    FILE* file = fsbridge::fopen(pathMN, "rb");
-    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
+    // map the file, the checksum and the data are read in place
+    fsbridge::MappedFile file(pathMN);
+    if (file.IsNull()) {
         error("%s : Failed to open file %s", __func__, pathMN.string());
         return FileError;
     }
-
-    // use file size to size memory buffer
-    int fileSize = fs::file_size(pathMN);
-    int dataSize = fileSize - sizeof(uint256);
-    // Don't try to resize to a negative number if file is small
-    if (dataSize < 0)
-        dataSize = 0;
-    std::vector<unsigned char> vchData;
-    vchData.resize(dataSize);
-    uint256 hashIn;
-
-    // read data and checksum from file
-    try {
-        filein.read((char*)&vchData[0], dataSize);
-        filein >> hashIn;
-    } catch (const std::exception& e) {
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    if (file.size() < sizeof(uint256)) {
+        error("%s : Deserialize or I/O error - file too short", __func__);
         return HashReadError;
     }
-    filein.fclose();
 
-    CDataStream ssMasternodes(vchData, SER_DISK, CLIENT_VERSION);
+    const unsigned char* pDataEnd = file.end() - sizeof(uint256);
+    uint256 hashIn;
+    memcpy(hashIn.begin(), pDataEnd, sizeof(uint256));
 
     // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssMasternodes.begin(), ssMasternodes.end());
+    uint256 hashTmp = Hash(file.begin(), pDataEnd);
     if (hashIn != hashTmp) {
         error("%s : Checksum mismatch, data corrupted", __func__);
         return IncorrectHash;
     }
 
+    CMemoryReader ssMasternodes(SER_DISK, CLIENT_VERSION, file.begin(), pDataEnd);
+
     unsigned char pchMsgTmp[4];
     std::string strMagicMessageTmp;
     try {
@@ -153,6 +151,14 @@ CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad, bo
             error("%s : Invalid network magic number", __func__);
             return IncorrectMagicNumber;
         }
+
+        // a dry run only checks the file can be overwritten: a file of the
+        // right network with a bad format would be recreated anyway
+        if (fDryRun) {
+            LogPrint(BCLog::MASTERNODE,"Checked mncache.dat  %dms\n", GetTimeMillis() - nStart);
+            return Ok;
+        }
+
         // de-serialize data into CMasternodeMan object
         ssMasternodes >> mnodemanToLoad;
     } catch (const std::exception& e) {
@@ -237,6 +243,7 @@ bool CMasternodeMan::Add(CMasternode& mn)
             LOCK(cs_pubkey);
             mapPubKeyMasternodes[m->pubKeyMasternode] = m;
         }
+        nListVersion++;
         return true;
     }
 
@@ -319,6 +326,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
             }
             delete *it;
             it = vMasternodes.erase(it);
+            nListVersion++;
         } else {
             ++it;
         }
@@ -404,6 +412,7 @@ void CMasternodeMan::Clear()
         mapSeenMasternodeBroadcast.clear();
         mapSeenMasternodePing.clear();
         nDsqCount = 0;
+        nListVersion++;
     }
 
     {
@@ -547,52 +556,62 @@ Coin CMasternodeMan::GetCollateral(const CScript& payee) {
 //
 CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(const CBlockIndex* pindexPrev, bool fFilterSigTime, int& nCount, std::vector<CTxIn>& vEligibleTxIns, bool fJustCount)
 {
-    const auto& params = Params();
-    const auto& consensus = params.GetConsensus();
     const auto nBlockHeight = pindexPrev->nHeight + 1;
+    const auto nListVersionStart = nListVersion.load();
     CMasternode* pBestMasternode = nullptr;
 
+    LOCK(cs);
+
+    // the block producer, the payments checks and the RPCs all ask for the
+    // same block, answer from the queue of the last call while nothing changed
+    if (fFilterSigTime &&
+        paymentQueue.hashBlock == pindexPrev->GetBlockHash() &&
+        paymentQueue.nListVersion == nListVersionStart &&
+        paymentQueue.nTime + MASTERNODES_QUEUE_CACHE_SECONDS > GetTime()) {
+        nCount = paymentQueue.nCount;
+        if (fJustCount) {
+            vEligibleTxIns.clear();
+            return nullptr;
+        }
+        vEligibleTxIns = paymentQueue.vEligibleTxIns;
+        return vEligibleTxIns.empty() ? nullptr : Find(vEligibleTxIns.front());
+    }
+
     /*
         Make a vector with all of the last paid times
     */
 
     std::vector<std::pair<int64_t, CTxIn>> vecMasternodeLastPaid;
     vEligibleTxIns.clear();
-    int nMnCount = 0;
-    {
-        LOCK(cs);
 
-        nMnCount = CountEnabled();
-        for (auto mn : vMasternodes) {
-            mn->Check();
-            if (!mn->IsEnabled()) continue;
+    // CountEnabled checks all the masternodes
+    const int nMnCount = CountEnabled();
+    vecMasternodeLastPaid.reserve(nMnCount);
+    for (auto mn : vMasternodes) {
+        if (!mn->IsEnabled()) continue;
 
-            //it's too new, wait for a cycle
-            if (fFilterSigTime && mn->sigTime + (nMnCount * 60) > GetAdjustedTime()) continue;
+        //it's too new, wait for a cycle
+        if (fFilterSigTime && mn->sigTime + (nMnCount * 60) > GetAdjustedTime()) continue;
 
-            //make sure it has as many confirmations as there are masternodes
-            if (pcoinsTip->GetCoinDepthAtHeight(mn->vin.prevout, nBlockHeight) < nMnCount) continue;
+        //make sure it has as many confirmations as there are masternodes
+        if (pcoinsTip->GetCoinDepthAtHeight(mn->vin.prevout, nBlockHeight) < nMnCount) continue;
 
-            vecMasternodeLastPaid.push_back(std::make_pair(mn->SecondsSincePayment(pindexPrev), mn->vin));
-        }
+        vecMasternodeLastPaid.push_back(std::make_pair(mn->SecondsSincePayment(pindexPrev), mn->vin));
     }
 
     nCount = (int)vecMasternodeLastPaid.size();
 
-    //when the network is in the process of upgrading, don't penalize nodes that recently restarted
-    if (fFilterSigTime && nCount < nMnCount / 3) return GetNextMasternodeInQueueForPayment(pindexPrev, false, nCount, vEligibleTxIns, fJustCount);
-
-    if(!fJustCount) {
-
-        // Sort them high to low
-        sort(vecMasternodeLastPaid.rbegin(), vecMasternodeLastPaid.rend(), CompareLastPaid());
-
-        auto nEnabled = CountEnabled();
-        auto nEligibleNetwork = std::max(10, nEnabled * 5 / 100); // oldest 5% or the minimal of 10 MNs
+    if (fFilterSigTime && nCount < nMnCount / 3) {
+        //when the network is in the process of upgrading, don't penalize nodes that recently restarted
+        pBestMasternode = GetNextMasternodeInQueueForPayment(pindexPrev, false, nCount, vEligibleTxIns, false);
+    } else {
+        // only the oldest 5% or the minimal of 10 MNs are needed, high to low
+        const auto nEligibleNetwork = std::min<size_t>(std::max(10, nMnCount * 5 / 100), vecMasternodeLastPaid.size());
+        std::partial_sort(vecMasternodeLastPaid.begin(), vecMasternodeLastPaid.begin() + nEligibleNetwork, vecMasternodeLastPaid.end(), CompareLastPaid());
 
-        uint256 nHigh;
-        int nCountEligible = 0;
-        for (const auto& s : vecMasternodeLastPaid) {
+        vEligibleTxIns.reserve(nEligibleNetwork);
+        for (size_t i = 0; i < nEligibleNetwork; i++) {
+            const auto& s = vecMasternodeLastPaid[i];
             auto pmn = Find(s.second);
             if (!pmn) continue;
 
@@ -601,12 +620,22 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(const CBlockInde
             }
 
             vEligibleTxIns.push_back(s.second);
-            nCountEligible++;
-
-            if (nCountEligible >= nEligibleNetwork) break;
         }
     }
 
+    if (fFilterSigTime) {
+        paymentQueue.hashBlock = pindexPrev->GetBlockHash();
+        paymentQueue.nListVersion = nListVersionStart;
+        paymentQueue.nTime = GetTime();
+        paymentQueue.nCount = nCount;
+        paymentQueue.vEligibleTxIns = vEligibleTxIns;
+    }
+
+    if (fJustCount) {
+        vEligibleTxIns.clear();
+        return nullptr;
+    }
+
     return pBestMasternode;
 }
 
@@ -649,18 +678,14 @@ const CBlockIndex* CMasternodeMan::GetLastPaidBlock(const CScript& script, const
 {
     LOCK(cs_collaterals);
 
-    if(mapPaidPayeesBlocks.find(script) != mapPaidPayeesBlocks.end() &&
-       !mapPaidPayeesBlocks[script].empty()
-    ) {
-        const auto& vblocks = mapPaidPayeesBlocks[script];
-        for (auto it = vblocks.rbegin(); it != vblocks.rend(); ++it)
-        {
-            if((*it)->nHeight <= pindex->nHeight) {
-                return *it;
-            }
-        }
-    }
-    return nullptr;
+    const auto itPaid = mapPaidPayeesBlocks.find(script);
+    if(itPaid == mapPaidPayeesBlocks.end()) return nullptr;
+
+    // the blocks are in height order, take the last one not above pindex
+    const auto& vblocks = itPaid->second;
+    const auto it = std::upper_bound(vblocks.begin(), vblocks.end(), pindex->nHeight,
+        [](int nHeight, const CBlockIndex* pblock) { return nHeight < pblock->nHeight; });
+    return it == vblocks.begin() ? nullptr : *(it - 1);
 }
 
 int CMasternodeMan::BlocksSincePayment(const CScript& script, const CBlockIndex* pindex) {
@@ -705,7 +730,9 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         mapSeenMasternodeBroadcast.insert(std::make_pair(mnb.GetHash(), mnb));
 
         int nDoS = 0;
-        if (!mnb.CheckAndUpdate(nDoS)) {
+        const bool fUpdated = mnb.CheckAndUpdate(nDoS);
+        nListVersion++; // it may have updated a known masternode, even when failing
+        if (!fUpdated) {
             if (nDoS > 0) {
                 LOCK(cs_main);
                 Misbehaving(pfrom->GetId(), nDoS);
@@ -749,7 +776,10 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         mapSeenMasternodePing.insert(std::make_pair(mnp.GetHash(), mnp));
 
         int nDoS = 0;
-        if (mnp.CheckAndUpdate(nDoS)) return;
+        if (mnp.CheckAndUpdate(nDoS)) {
+            nListVersion++;
+            return;
+        }
 
         if (nDoS > 0) {
             // if anything significant failed, mark that node
@@ -848,6 +878,7 @@ void CMasternodeMan::Remove(CTxIn vin)
             }
             delete *it;
             vMasternodes.erase(it);
+            nListVersion++;
             break;
         }
         ++it;
@@ -868,6 +899,7 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
         Add(mn);
     } else {
         pmn->UpdateFromNewBroadcast(mnb);
+        nListVersion++;
     }
 }
 
@@ -875,8 +907,6 @@ bool CMasternodeMan::Init()
 {
     if(initiatedAt > 0) return true;
 
-    FlushStateToDisk();
-
     LOCK(cs_collaterals);
 
     // cleans up all collections
@@ -897,31 +927,30 @@ bool CMasternodeMan::Init()
     auto nNextWeekCollateralAmount = CMasternode::GetMasternodeNodeCollateral(nHeight + nBlocksPerWeek);
 
     if (nCollateralAmount > 0 || nNextWeekCollateralAmount > 0) {
-        std::unique_ptr<CCoinsViewCursor> pcursor(pcoinsTip->Cursor());
+        // the supply index keeps the collateral valued coins, scan the chainstate only when it is out of sync
+        if (!supplyIndex.IsSynced(pcoinsTip->GetBestBlock())) {
+            FlushStateToDisk();
+            supplyIndex.Rebuild(pcoinsTip, nHeight);
+        }
 
-        while (pcursor->Valid()) {
-            boost::this_thread::interruption_point();
-            COutPoint key;
-            Coin coin;
-            if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-                if (!coin.IsSpent() && (coin.out.nValue == nCollateralAmount || coin.out.nValue == nNextWeekCollateralAmount)) {
-                    const auto& out = coin.out;
-                    const auto& nCollateral = out.nValue;
-                    // this is a possible collateral UTXO
-                    mapScriptCollaterals[coin.out.scriptPubKey] = coin;
-                    mapCOutPointCollaterals[key] = coin;
-                    // check if there is no entry for this collateral
-                    if(mapCAmountCollaterals.find(nCollateral) == mapCAmountCollaterals.end()) {
-                        mapCAmountCollaterals[nCollateral] = boost::unordered_set<COutPoint, COutPointCheapHasher>(); // add an empty set
-                    }
-                    mapCAmountCollaterals[nCollateral].insert(key);
+        for (const auto& kv : supplyIndex.GetCollaterals()) {
+            const auto& key = kv.first;
+            const auto& coin = kv.second;
+            if (coin.out.nValue == nCollateralAmount || coin.out.nValue == nNextWeekCollateralAmount) {
+                const auto& nCollateral = coin.out.nValue;
+                // this is a possible collateral UTXO
+                mapScriptCollaterals[coin.out.scriptPubKey] = coin;
+                mapCOutPointCollaterals[key] = coin;
+                // check if there is no entry for this collateral
+                if(mapCAmountCollaterals.find(nCollateral) == mapCAmountCollaterals.end()) {
+                    mapCAmountCollaterals[nCollateral] = boost::unordered_set<COutPoint, COutPointCheapHasher>(); // add an empty set
                 }
+                mapCAmountCollaterals[nCollateral].insert(key);
             }
-            pcursor->Next();
         }
     }
 
-    // scan the blockchain for paid payees
+    // get the paid payees of the recent blocks, indexed when they were connected
     const auto nCollaterals = mapScriptCollaterals.size();
     const auto nMaxDepth = nCollaterals * 2;
 
@@ -939,6 +968,7 @@ bool CMasternodeMan::Init()
 
     initiatedAt = nHeight;
     lastProcess = GetTime();
+    nListVersion++;
 
     return true;
 }
@@ -1066,6 +1096,7 @@ bool CMasternodeMan::ConnectBlock(const CBlockIndex* pindex, const CBlock& block
         mapPaidPayeesBlocks[paidPayee].push_back(pindex);
         mapPaidPayeesHeight[nHeight] = paidPayee;
     }
+    nListVersion++;
 
     return true;
 }
@@ -1144,6 +1175,7 @@ bool CMasternodeMan::DisconnectBlock(const CBlockIndex* pindex, const CBlock& bl
 
         mapPaidPayeesHeight.erase(nHeight);
     }
+    nListVersion++;
 
     return true;
 }
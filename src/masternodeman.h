@@ -17,9 +17,12 @@
 #include "sync.h"
 #include "util.h"
 
+#include <atomic>
+
 #include <boost/unordered_map.hpp>
 
 #define MASTERNODES_DSEG_SECONDS (5 * 60)
+#define MASTERNODES_QUEUE_CACHE_SECONDS 60
 
 class CMasternodeMan;
 class CActiveMasternode;
@@ -96,6 +99,19 @@ private:
     // which Masternodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
 
+    // bumped after any change to the list, the masternodes states or the paid payees
+    std::atomic<int64_t> nListVersion{0};
+
+    // payment queue computed for the last block asked, protected by cs
+    struct CPaymentQueue {
+        uint256 hashBlock;
+        int64_t nListVersion = -1;
+        int64_t nTime = 0;
+        int nCount = 0;
+        // oldest paid first
+        std::vector<CTxIn> vEligibleTxIns;
+    } paymentQueue;
+
     // find an entry in the masternode list that is next to be paid (internally)
     CMasternode* GetNextMasternodeInQueueForPayment(
         const CBlockIndex* pindexPrev, bool fFilterSigTime, 
@@ -127,7 +143,8 @@ public:
                 auto mn = new CMasternode();
                 READWRITE(*mn);
 
-                auto mnScript = Find(GetScriptForDestination(mn->pubKeyCollateralAddress.GetID()));
+                const CScript scriptCollateral = GetScriptForDestination(mn->pubKeyCollateralAddress.GetID());
+                auto mnScript = Find(scriptCollateral);
                 if(mnScript) {
                     auto it = std::find(vMasternodes.begin(), vMasternodes.end(), mnScript);
                     if(it != vMasternodes.end()) vMasternodes.erase(it);
@@ -138,7 +155,7 @@ public:
                 vMasternodes.push_back(mn);
                 {
                     LOCK(cs_script);
-                    mapScriptMasternodes[GetScriptForDestination(mn->pubKeyCollateralAddress.GetID())] = mn;
+                    mapScriptMasternodes[scriptCollateral] = mn;
                 }
                 {
                     LOCK(cs_txin);
@@ -8,8 +8,10 @@
 #ifndef BITCOIN_MINER_H
 #define BITCOIN_MINER_H
 
+#include "crypto/sha256.h"
 #include "primitives/block.h"
 
+#include <memory>
 #include <stdint.h>
 
 class CBlock;
@@ -17,10 +19,20 @@ class CBlockHeader;
 class CBlockIndex;
 class COutput;
 class CReserveKey;
+class CScheduler;
 class CScript;
 class CWallet;
+class CX11KVSTree;
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+//! Seconds a cached block template selection is reused at most
+static const int64_t BLOCK_TEMPLATE_CACHE_MAX_AGE = 60;
+//! Seconds the cached selection is rebuilt after the tip or the mempool changed
+static const int64_t BLOCK_TEMPLATE_REBUILD_DELAY = 1;
+//! Nonces a miner thread hashes between two checks of its block
+static const uint32_t POW_SCAN_BATCH = 0x100;
+//! X11KVS memo entries the proof-of-work scanner keeps at most
+static const size_t POW_SCAN_MAX_MEMO = 1 << 18;
 
 struct CBlockTemplate;
 
@@ -30,6 +42,8 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 /** Check mined block */
 void UpdateTime(CBlockHeader* block, const CBlockIndex* pindexPrev);
+/** Keep the transactions of the next block selected in the background */
+void StartBlockTemplateCache(CScheduler& scheduler);
 
 #ifdef ENABLE_WALLET
     /** Run the miner threads */
@@ -39,11 +53,10 @@ void UpdateTime(CBlockHeader* block, const CBlockIndex* pindexPrev);
 
     void BitcoinMiner(CWallet* pwallet, bool fProofOfStake);
     void ThreadStakeMinter();
+    /** Recent hashes per second of the miner threads together */
+    double GetHashesPerSec();
 #endif // ENABLE_WALLET
 
-extern double dHashesPerSec;
-extern int64_t nHPSTimerStart;
-
 struct CBlockTemplate {
     CBlock block;
     std::vector<CAmount> vTxFees;
@@ -52,4 +65,36 @@ struct CBlockTemplate {
 
 uint64_t GetNetworkHashPS();
 
+/**
+ * Proof-of-work nonce scanner. What doesn't depend on the nonce is prepared
+ * once per header and kept while only the nonce changes: the serialization and
+ * the SHA256 midstate of its first 64 bytes for the double SHA256 headers, and
+ * the X11KVS tree memo, whose subtrees are shared by nearby nonces. Blake512
+ * compresses 128-byte blocks, so X11K headers have no midstate and are hashed
+ * as they are.
+ */
+class CPoWScanner
+{
+private:
+    //! the serialized header the scanner is prepared for
+    std::vector<unsigned char> vHeader;
+    //! SHA256 state after the first 64 bytes of vHeader
+    CSHA256 midstate;
+    std::unique_ptr<CX11KVSTree> ptree;
+
+    void SetHeader(const CBlockHeader& header);
+    uint256 Hash(const CBlockHeader& header);
+
+public:
+    CPoWScanner();
+    ~CPoWScanner();
+
+    /**
+     * Hash up to nCount nonces of header, from header.nNonce on, and stop at
+     * the first one whose hash is not above hashTarget. header.nNonce is left
+     * on that nonce, or on the next one to hash.
+     */
+    bool Scan(CBlockHeader& header, uint32_t nCount, const uint256& hashTarget, uint256& hashRet, uint32_t& nHashesDone);
+};
+
 #endif // BITCOIN_MINER_H
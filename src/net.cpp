@@ -33,6 +33,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -55,6 +59,9 @@
 // We add a random period time (0 to 1 seconds) to feeler connections to prevent synchronization.
 #define FEELER_SLEEP_WINDOW 1
 
+// Maximum number of queued buffers handed to the kernel in one sendmsg() call
+#define MAX_SEND_IOVECS 64
+
 #if !defined(HAVE_MSG_NOSIGNAL) && !defined(MSG_NOSIGNAL)
 #define MSG_NOSIGNAL 0
 #endif
@@ -424,7 +431,7 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char* pszDest, bool fCo
     bool proxyConnectionFailed = false;
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed, sHostIp) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed, sHostIp)) {
-        if (!IsSelectableSocket(hSocket)) {
+        if (socketEventsMode == SOCKETEVENTS_SELECT && !IsSelectableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -874,27 +881,56 @@ size_t CConnman::SocketSendData(CNode* pnode)
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto& data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        assert(it->size() > pnode->nSendOffset);
+        size_t nToSend = 0;
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifdef WIN32
+            const auto& data = *it;
+            nToSend = data.size() - pnode->nSendOffset;
+            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, nToSend, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+            // Gather the queued buffers into one call, so a message header
+            // and its payload, and the small messages, leave together
+            struct iovec iov[MAX_SEND_IOVECS];
+            int nIov = 0;
+            size_t nOffset = pnode->nSendOffset;
+            for (auto itIov = it; itIov != pnode->vSendMsg.end() && nIov < MAX_SEND_IOVECS; ++itIov, ++nIov) {
+                iov[nIov].iov_base = const_cast<unsigned char*>(itIov->data()) + nOffset;
+                iov[nIov].iov_len = itIov->size() - nOffset;
+                nToSend += iov[nIov].iov_len;
+                nOffset = 0;
+            }
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = nIov;
+            nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            // release the buffers fully sent
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                const size_t nRemaining = it->size() - pnode->nSendOffset;
+                if (nLeft < nRemaining) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRemaining;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= it->size();
                 pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            if ((size_t)nBytes < nToSend) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -916,6 +952,9 @@ size_t CConnman::SocketSendData(CNode* pnode)
         assert(pnode->nSendSize == 0);
     }
     pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
+    // the socket is full, wait until it is reported writable again
+    if (!pnode->vSendMsg.empty())
+        pnode->fCanSendData = false;
     return nSentSize;
 }
 
@@ -1118,7 +1157,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket)) {
+    if (socketEventsMode == SOCKETEVENTS_SELECT && !IsSelectableSocket(hSocket)) {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
         return;
@@ -1169,6 +1208,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
+    RegisterEvents(pnode);
 }
 
 void CConnman::ThreadSocketHandler()
@@ -1206,6 +1246,7 @@ void CConnman::ThreadSocketHandler()
                     pnode->grantOutbound.Release();
 
                     // close socket and cleanup
+                    UnregisterEvents(pnode);
                     pnode->CloseSocketDisconnect();
 
                     // hold in disconnected pool until all refs are released
@@ -1249,91 +1290,18 @@ void CConnman::ThreadSocketHandler()
         }
 
         //
-        // Find which sockets have data to receive
+        // Find which sockets are ready
         //
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodes) {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
-                //   receiving data.
-                // * Hand off all complete messages to the processor, to be handled without
-                //   blocking here.
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
-
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        std::vector<const ListenSocket*> vListenReady;
+        SocketEvents(vListenReady);
         if (interruptNet)
             return;
 
-        if (nSelect == SOCKET_ERROR) {
-            if (have_fds) {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
-                return;
-        }
-
         //
         // Accept new connections
         //
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
-                AcceptConnection(hListenSocket);
-            }
+        for (const ListenSocket* pListenSocket : vListenReady) {
+            AcceptConnection(*pListenSocket);
         }
 
         //
@@ -1355,16 +1323,17 @@ void CConnman::ThreadSocketHandler()
             //
             bool recvSet = false;
             bool sendSet = false;
-            bool errorSet = false;
             {
                 LOCK(pnode->cs_hSocket);
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
             }
-            if (recvSet || errorSet) {
+            recvSet = pnode->fHasRecvData && !pnode->fPauseRecv;
+            {
+                LOCK(pnode->cs_vSend);
+                sendSet = pnode->fCanSendData && !pnode->vSendMsg.empty();
+            }
+            if (recvSet) {
                 {
                     {
                         // typical socket buffer is 8K-64K
@@ -1376,6 +1345,9 @@ void CConnman::ThreadSocketHandler()
                                 continue;
                             nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
                         }
+                        // a short read drained the socket, with epoll the next data raises a new event
+                        if (nBytes < (int)sizeof(pchBuf))
+                            pnode->fHasRecvData = false;
                         if (nBytes > 0) {
                             bool notify = false;
                             if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
@@ -1453,6 +1425,241 @@ void CConnman::ThreadSocketHandler()
     }
 }
 
+void CConnman::SocketEvents(std::vector<const ListenSocket*>& vListenReady)
+{
+#ifdef HAVE_EPOLL
+    if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+        SocketEventsEpoll(vListenReady);
+        return;
+    }
+#endif
+    SocketEventsSelect(vListenReady);
+}
+
+void CConnman::SocketEventsSelect(std::vector<const ListenSocket*>& vListenReady)
+{
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+
+    if (wakeupPipe[0] != -1) {
+        FD_SET(wakeupPipe[0], &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, (SOCKET)wakeupPipe[0]);
+        have_fds = true;
+    }
+
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes) {
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is space left in the receive buffer, select() for
+            //   receiving data.
+            // * Hand off all complete messages to the processor, to be handled without
+            //   blocking here.
+
+            bool select_recv = !pnode->fPauseRecv;
+            bool select_send;
+            {
+                LOCK(pnode->cs_vSend);
+                select_send = !pnode->vSendMsg.empty();
+            }
+
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = std::max(hSocketMax, pnode->hSocket);
+            have_fds = true;
+
+            if (select_send) {
+                FD_SET(pnode->hSocket, &fdsetSend);
+                continue;
+            }
+            if (select_recv) {
+                FD_SET(pnode->hSocket, &fdsetRecv);
+            }
+        }
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (interruptNet)
+        return;
+
+    if (nSelect == SOCKET_ERROR) {
+        if (have_fds) {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
+            return;
+    }
+
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
+            vListenReady.push_back(&hListenSocket);
+        }
+    }
+
+    if (wakeupPipe[0] != -1 && FD_ISSET(wakeupPipe[0], &fdsetRecv)) {
+        char buf[128];
+        while (read(wakeupPipe[0], buf, sizeof(buf)) > 0) {}
+    }
+
+    LOCK(cs_vNodes);
+    for (CNode* pnode : vNodes) {
+        bool fRecv = false;
+        bool fSend = false;
+        {
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket != INVALID_SOCKET) {
+                fRecv = FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError);
+                fSend = FD_ISSET(pnode->hSocket, &fdsetSend);
+            }
+        }
+        pnode->fHasRecvData = fRecv;
+        LOCK(pnode->cs_vSend);
+        pnode->fCanSendData = fSend;
+    }
+}
+
+#ifdef HAVE_EPOLL
+void CConnman::SocketEventsEpoll(std::vector<const ListenSocket*>& vListenReady)
+{
+    // The sockets are registered edge triggered: a readiness is reported once
+    // and stays flagged on the node until a read or a write runs dry. Don't
+    // wait while some node still has something to do from the last events.
+    int nTimeout = SOCKET_EVENTS_TIMEOUT_MS;
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes) {
+            if (pnode->fHasRecvData && !pnode->fPauseRecv) {
+                nTimeout = 0;
+                break;
+            }
+            LOCK(pnode->cs_vSend);
+            if (pnode->fCanSendData && !pnode->vSendMsg.empty()) {
+                nTimeout = 0;
+                break;
+            }
+        }
+    }
+
+    struct epoll_event events[256];
+    int nEvents = epoll_wait(epollfd, events, ARRAYLEN(events), nTimeout);
+    if (interruptNet)
+        return;
+
+    if (nEvents < 0) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            interruptNet.sleep_for(std::chrono::milliseconds(50));
+        }
+        return;
+    }
+
+    for (int i = 0; i < nEvents; i++) {
+        const struct epoll_event& event = events[i];
+        if (event.data.ptr == nullptr) {
+            // WakeSocketHandler
+            char buf[128];
+            while (read(wakeupPipe[0], buf, sizeof(buf)) > 0) {}
+            continue;
+        }
+
+        bool fListen = false;
+        for (const ListenSocket& hListenSocket : vhListenSocket) {
+            if (event.data.ptr == &hListenSocket) {
+                vListenReady.push_back(&hListenSocket);
+                fListen = true;
+                break;
+            }
+        }
+        if (fListen)
+            continue;
+
+        // Only this thread deletes the nodes, after their socket is closed,
+        // which unregisters it, so the node is still alive here.
+        CNode* pnode = static_cast<CNode*>(event.data.ptr);
+        if (event.events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            pnode->fHasRecvData = true;
+        if (event.events & EPOLLOUT) {
+            LOCK(pnode->cs_vSend);
+            pnode->fCanSendData = true;
+        }
+    }
+}
+#endif
+
+void CConnman::RegisterEvents(CNode* pnode)
+{
+#ifdef HAVE_EPOLL
+    if (socketEventsMode != SOCKETEVENTS_EPOLL)
+        return;
+
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket == INVALID_SOCKET)
+        return;
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.ptr = pnode;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0)
+        LogPrintf("%s: epoll_ctl failed for peer=%d: %s\n", __func__, pnode->GetId(), NetworkErrorString(WSAGetLastError()));
+#endif
+}
+
+void CConnman::UnregisterEvents(CNode* pnode)
+{
+#ifdef HAVE_EPOLL
+    if (socketEventsMode != SOCKETEVENTS_EPOLL)
+        return;
+
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket == INVALID_SOCKET)
+        return; // closing it already unregistered it
+
+    struct epoll_event event; // ignored, but required by kernels before 2.6.9
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, pnode->hSocket, &event);
+#endif
+}
+
+void CConnman::WakeSocketHandler()
+{
+    if (wakeupPipe[1] == -1)
+        return;
+
+    // a full pipe is as good as a successful write
+    char buf = 0;
+    if (write(wakeupPipe[1], &buf, sizeof(buf)) != sizeof(buf)) {}
+}
+
 void CConnman::WakeMessageHandler()
 {
     {
@@ -1672,6 +1879,7 @@ void CConnman::DumpAddresses()
 {
     int64_t nStart = GetTimeMillis();
 
+    addrman.FlushDeferred();
     CAddrDB adb;
     adb.Write(addrman);
 
@@ -1962,6 +2170,7 @@ bool CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
+    RegisterEvents(pnode);
 
     return true;
 }
@@ -1981,7 +2190,8 @@ void CConnman::ThreadMessageHandler()
         bool fMoreWork = false;
 
         for (CNode* pnode : vNodesCopy) {
-            if (pnode->fDisconnect)
+            // a worker is processing the node messages, wait for it to keep them in order
+            if (pnode->fDisconnect || pnode->fParallelProcessing)
                 continue;
 
             // Receive messages
@@ -2014,6 +2224,39 @@ void CConnman::ThreadMessageHandler()
     }
 }
 
+void CConnman::AddMessageTask(CNode* pnode, std::function<void()> func)
+{
+    pnode->AddRef();
+    pnode->fParallelProcessing = true;
+    {
+        std::lock_guard<std::mutex> lock(mutexMessageTasks);
+        vMessageTasks.emplace_back([this, pnode, func]() {
+            func();
+            pnode->fParallelProcessing = false;
+            pnode->Release();
+            // the node may have messages left for the message handler
+            WakeMessageHandler();
+        });
+    }
+    condMessageTasks.notify_one();
+}
+
+void CConnman::ThreadMessageWorker()
+{
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutexMessageTasks);
+            condMessageTasks.wait(lock, [this] { return flagInterruptMsgProc || !vMessageTasks.empty(); });
+            if (flagInterruptMsgProc)
+                return;
+            task = std::move(vMessageTasks.front());
+            vMessageTasks.pop_front();
+        }
+        task();
+    }
+}
+
 bool CConnman::BindListenPort(const CService& addrBind, std::string& strError, bool fWhitelisted)
 {
     strError = "";
@@ -2158,6 +2401,8 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nBestHeight = 0;
     clientInterface = NULL;
     flagInterruptMsgProc = false;
+    socketEventsMode = SOCKETEVENTS_SELECT;
+    nMessageWorkers = 0;
 }
 
 NodeId CConnman::GetNewNodeId()
@@ -2179,6 +2424,47 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
     nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
     nReceiveFloodSize = connOptions.nReceiveFloodSize;
 
+    socketEventsMode = connOptions.socketEventsMode;
+    nMessageWorkers = std::max(0, std::min(connOptions.nMessageWorkers, MAX_MESSAGE_WORKERS));
+#ifdef HAVE_EPOLL
+    if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd == -1) {
+            strNodeError = strprintf("Failed to create epoll file descriptor: %s", NetworkErrorString(WSAGetLastError()));
+            return false;
+        }
+
+        // listening sockets are level triggered, one connection is accepted per event
+        for (const ListenSocket& hListenSocket : vhListenSocket) {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = (void*)&hListenSocket;
+            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0) {
+                strNodeError = strprintf("Failed to register listening socket with epoll: %s", NetworkErrorString(WSAGetLastError()));
+                return false;
+            }
+        }
+    }
+#endif
+
+#ifndef WIN32
+    if (pipe(wakeupPipe) != 0) {
+        wakeupPipe[0] = wakeupPipe[1] = -1;
+        LogPrintf("Failed to create the socket handler wakeup pipe, relying on timeouts\n");
+    } else {
+        for (int fd : wakeupPipe)
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#ifdef HAVE_EPOLL
+        if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = nullptr;
+            epoll_ctl(epollfd, EPOLL_CTL_ADD, wakeupPipe[0], &event);
+        }
+#endif
+    }
+#endif
+
     SetBestHeight(connOptions.nBestHeight);
 
     clientInterface = connOptions.uiInterface;
@@ -2266,10 +2552,15 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
 
     // Process messages
     threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (int i = 0; i < nMessageWorkers; i++)
+        threadMessageWorkers.emplace_back(&TraceThread<std::function<void()> >, "msgwork", std::function<void()>(std::bind(&CConnman::ThreadMessageWorker, this)));
 
     // Dump network addresses
     scheduler.scheduleEvery(boost::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL);
 
+    // Add the addr gossip queued below a batch
+    scheduler.scheduleEvery(boost::bind(&CAddrMan::FlushDeferred, &addrman), ADDRMAN_DEFERRED_SECONDS);
+
     // Query DNS seeds
     scheduler.scheduleEvery(boost::bind(&CConnman::ThreadDNSAddressSeed, this), DNS_SEEDS_INTERVAL);
 
@@ -2306,8 +2597,14 @@ void CConnman::Interrupt()
         flagInterruptMsgProc = true;
     }
     condMsgProc.notify_all();
+    {
+        // the workers test the flag under this lock before waiting
+        std::lock_guard<std::mutex> lock(mutexMessageTasks);
+    }
+    condMessageTasks.notify_all();
 
     interruptNet();
+    WakeSocketHandler();
     InterruptSocks5(true);
 
     if (semOutbound)
@@ -2321,6 +2618,15 @@ void CConnman::Stop()
 
     if (threadMessageHandler.joinable())
         threadMessageHandler.join();
+    for (std::thread& thread : threadMessageWorkers)
+        if (thread.joinable())
+            thread.join();
+    threadMessageWorkers.clear();
+    {
+        // the left over tasks hold node references, the nodes are deleted below anyway
+        std::lock_guard<std::mutex> lock(mutexMessageTasks);
+        vMessageTasks.clear();
+    }
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2354,6 +2660,17 @@ void CConnman::Stop()
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+
+#ifdef HAVE_EPOLL
+    if (epollfd != -1)
+        close(epollfd);
+    epollfd = -1;
+#endif
+    for (int& fd : wakeupPipe) {
+        if (fd != -1)
+            close(fd);
+        fd = -1;
+    }
     delete semOutbound;
     semOutbound = NULL;
     if(pnodeLocalHost)
@@ -2399,7 +2716,7 @@ void CConnman::AddNewAddress(const CAddress& addr, const CAddress& addrFrom, int
 
 void CConnman::AddNewAddresses(const std::vector<CAddress>& vAddr, const CAddress& addrFrom, int64_t nTimePenalty)
 {
-    addrman.Add(vAddr, addrFrom, nTimePenalty);
+    addrman.AddDeferred(vAddr, addrFrom, nTimePenalty);
 }
 
 std::vector<CAddress> CConnman::GetAddresses()
@@ -2462,6 +2779,7 @@ bool CConnman::DisconnectNode(const std::string& strNode)
     LOCK(cs_vNodes);
     if (CNode* pnode = FindNode(strNode)) {
         pnode->fDisconnect = true;
+        WakeSocketHandler();
         return true;
     }
     return false;
@@ -2473,6 +2791,7 @@ bool CConnman::DisconnectNode(NodeId id)
     for(CNode* pnode : vNodes) {
         if (id == pnode->id) {
             pnode->fDisconnect = true;
+            WakeSocketHandler();
             return true;
         }
     }
@@ -2485,6 +2804,7 @@ void CConnman::DisconnectAll()
     for(CNode* pnode : vNodes) {
         pnode->fDisconnect = true;
     }
+    WakeSocketHandler();
 }
 
 void CConnman::RelayInv(CInv& inv)
@@ -2590,6 +2910,9 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nMinPingUsecTime = std::numeric_limits<int64_t>::max();
     fPauseRecv = false;
     fPauseSend = false;
+    fHasRecvData = false;
+    fCanSendData = false;
+    fParallelProcessing = false;
     nProcessQueueSize = 0;
 
     for (const std::string &msg : getAllNetMessageTypes())
@@ -2660,6 +2983,7 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
     CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
 
     size_t nBytesSent = 0;
+    bool fWakeSocketHandler = false;
     {
         LOCK(pnode->cs_vSend);
         bool optimisticSend(pnode->vSendMsg.empty());
@@ -2677,9 +3001,15 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
             nBytesSent = SocketSendData(pnode);
+
+        // select() only watches for writability the sockets that had data
+        // queued when it was entered, epoll reports it by itself
+        fWakeSocketHandler = optimisticSend && !pnode->vSendMsg.empty() && socketEventsMode == SOCKETEVENTS_SELECT;
     }
     if (nBytesSent)
         RecordBytesSent(nBytesSent);
+    if (fWakeSocketHandler)
+        WakeSocketHandler();
 }
 
 bool CConnman::ForNode(NodeId id, std::function<bool(CNode* pnode)> func)
@@ -86,6 +86,19 @@ static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 256;
 
 static const ServiceFlags REQUIRED_SERVICES = NODE_NETWORK;
 
+/** -socketevents default */
+#ifdef HAVE_EPOLL
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+#else
+static const char* const DEFAULT_SOCKETEVENTS = "select";
+#endif
+/** -msgworkers default: threads running the peers messages which don't touch the chain */
+static const int DEFAULT_MESSAGE_WORKERS = 2;
+/** Maximum number of message worker threads */
+static const int MAX_MESSAGE_WORKERS = 16;
+/** Longest wait for socket events when there is nothing left to receive or send, for the housekeeping */
+static const int SOCKET_EVENTS_TIMEOUT_MS = 500;
+
 static const bool DEFAULT_FORCEDNSSEED = true;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
@@ -134,6 +147,11 @@ public:
         CONNECTIONS_ALL = (CONNECTIONS_IN | CONNECTIONS_OUT),
     };
 
+    enum SocketEventsMode {
+        SOCKETEVENTS_SELECT = 0,
+        SOCKETEVENTS_EPOLL = 1,
+    };
+
     struct Options
     {
         ServiceFlags nLocalServices = NODE_NONE;
@@ -145,6 +163,8 @@ public:
         CClientUIInterface* uiInterface = nullptr;
         unsigned int nSendBufferMaxSize = 0;
         unsigned int nReceiveFloodSize = 0;
+        SocketEventsMode socketEventsMode = SOCKETEVENTS_SELECT;
+        int nMessageWorkers = 0;
     };
     CConnman(uint64_t seed0, uint64_t seed1);
     ~CConnman();
@@ -159,6 +179,13 @@ public:
 
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg);
 
+    bool HasMessageWorkers() const { return nMessageWorkers > 0; }
+    /**
+     * Run func on a message worker. The message handler leaves the node alone
+     * until it returns, so the node messages stay processed in order.
+     */
+    void AddMessageTask(CNode* pnode, std::function<void()> func);
+
     template<typename Callable>
     bool ForEachNodeContinueIf(Callable&& func)
     {
@@ -277,6 +304,9 @@ public:
     CSipHasher GetDeterministicRandomizer(uint64_t id);
 
     unsigned int GetReceiveFloodSize() const;
+
+    /** Interrupt the wait for socket events, e.g. when a peer may be read again */
+    void WakeSocketHandler();
 private:
     struct ListenSocket {
         SOCKET socket;
@@ -289,10 +319,20 @@ private:
     void ProcessOneShot();
     void ThreadOpenConnections();
     void ThreadMessageHandler();
+    void ThreadMessageWorker();
     void AcceptConnection(const ListenSocket& hListenSocket);
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
+    // Wait for the sockets to be ready, flagging the nodes that can receive or send
+    void SocketEvents(std::vector<const ListenSocket*>& vListenReady);
+    void SocketEventsSelect(std::vector<const ListenSocket*>& vListenReady);
+#ifdef HAVE_EPOLL
+    void SocketEventsEpoll(std::vector<const ListenSocket*>& vListenReady);
+#endif
+    void RegisterEvents(CNode* pnode);
+    void UnregisterEvents(CNode* pnode);
+
     void WakeMessageHandler();
 
     uint64_t CalculateKeyedNetGroup(const CAddress& ad);
@@ -380,13 +420,27 @@ private:
     std::mutex mutexMsgProc;
     std::atomic<bool> flagInterruptMsgProc;
 
+    /** tasks for the message workers, see AddMessageTask */
+    int nMessageWorkers;
+    std::deque<std::function<void()> > vMessageTasks;
+    std::condition_variable condMessageTasks;
+    std::mutex mutexMessageTasks;
+
     CThreadInterrupt interruptNet;
 
+    SocketEventsMode socketEventsMode;
+#ifdef HAVE_EPOLL
+    int epollfd = -1;
+#endif
+    // written to by WakeSocketHandler, the read end is watched with the sockets
+    int wakeupPipe[2] = {-1, -1};
+
     std::thread threadDNSAddressSeed;
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
     std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageWorkers;
 
     bool stopping = false;
 };
@@ -600,6 +654,12 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+    // readiness reported by the socket events: there may be data to receive
+    // (socket handler thread only), the socket can take more data (cs_vSend)
+    bool fHasRecvData;
+    bool fCanSendData;
+    // a message worker is running messages of this node
+    std::atomic_bool fParallelProcessing;
 protected:
     mapMsgCmdSize mapSendBytesPerMsgCmd;
     mapMsgCmdSize mapRecvBytesPerMsgCmd;
@@ -611,6 +671,8 @@ public:
     std::atomic<int> nStartingHeight;
 
     // flood relay
+    // vAddrToSend and addrKnown are also updated by the message workers
+    RecursiveMutex cs_addrToSend;
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
@@ -717,6 +779,7 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_addrToSend);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -725,6 +788,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_addrToSend);
         if (_addr.IsValid() && !addrKnown.contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.randrange(vAddrToSend.size())] = _addr;
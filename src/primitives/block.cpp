@@ -13,6 +13,21 @@
 #include "tinyformat.h"
 #include "utilstrencodings.h"
 #include "util.h"
+#include "x11kvsengine.h"
+
+void CBlockHeader::GetX11KVSData(uint8_t* data) const
+{
+#if defined(WORDS_BIGENDIAN)
+    WriteLE32(&data[0], nVersion);
+    memcpy(&data[4], hashPrevBlock.begin(), hashPrevBlock.size());
+    memcpy(&data[36], hashMerkleRoot.begin(), hashMerkleRoot.size());
+    WriteLE32(&data[68], nTime);
+    WriteLE32(&data[72], nBits);
+    WriteLE32(&data[76], nNonce);
+#else // Can take shortcut for little endian
+    memcpy(data, BEGIN(nVersion), 80);
+#endif
+}
 
 // TODO: Change X11KVS algorithm call to whatever the coin being adapted is used.
 uint256 CBlockHeader::GetHash() const
@@ -20,25 +35,107 @@ uint256 CBlockHeader::GetHash() const
     if (nVersion == 1)
         return HashX11K(BEGIN(nVersion), END(nNonce));
 
-    if (nVersion < 4)  { // nVersion = 1, 2, 3
-#if defined(WORDS_BIGENDIAN)
+    if (IsX11KVS()) {
         uint8_t data[80];
-        WriteLE32(&data[0], nVersion);
-        memcpy(&data[4], hashPrevBlock.begin(), hashPrevBlock.size());
-        memcpy(&data[36], hashMerkleRoot.begin(), hashMerkleRoot.size());
-        WriteLE32(&data[68], nTime);
-        WriteLE32(&data[72], nBits);
-        WriteLE32(&data[76], nNonce);
-
-        return HashX11KVS(data, data + 80);
-#else // Can take shortcut for little endian
-        return HashX11KVS(BEGIN(nVersion), END(nNonce));
-#endif
+        GetX11KVSData(data);
+        return x11kvsEngine.Hash(data);
     }
-	
+
     return SerializeHash(*this); // nVersion >= 4
 }
 
+void GetBlockHeaderHashes(const std::vector<const CBlockHeader*>& vpHeaders, std::vector<uint256>& vHashesRet)
+{
+    vHashesRet.resize(vpHeaders.size());
+
+    // Gather the X11KVS headers, so they are hashed in one go on the pool
+    std::vector<size_t> vX11KVS;
+    std::vector<uint8_t> vData;
+    for (size_t i = 0; i < vpHeaders.size(); i++) {
+        if (vpHeaders[i]->IsX11KVS()) {
+            vX11KVS.push_back(i);
+        } else {
+            vHashesRet[i] = vpHeaders[i]->GetHash();
+        }
+    }
+    if (vX11KVS.empty()) return;
+
+    vData.resize(vX11KVS.size() * 80);
+    for (size_t j = 0; j < vX11KVS.size(); j++)
+        vpHeaders[vX11KVS[j]]->GetX11KVSData(&vData[j * 80]);
+
+    std::vector<uint256> vX11KVSHashes(vX11KVS.size());
+    x11kvsEngine.HashBatch(vData.data(), vX11KVS.size(), vX11KVSHashes.data());
+    for (size_t j = 0; j < vX11KVS.size(); j++)
+        vHashesRet[vX11KVS[j]] = vX11KVSHashes[j];
+}
+
+void GetBlockHeaderHashes(const std::vector<CBlockHeader>& vHeaders, std::vector<uint256>& vHashesRet)
+{
+    std::vector<const CBlockHeader*> vpHeaders;
+    vpHeaders.reserve(vHeaders.size());
+    for (const CBlockHeader& header : vHeaders)
+        vpHeaders.push_back(&header);
+    GetBlockHeaderHashes(vpHeaders, vHashesRet);
+}
+
+CBlockHashCache::CBlockHashCache(const CBlockHashCache& other)
+{
+    std::lock_guard<std::mutex> lock(other.mutex);
+    header = other.header;
+    hash = other.hash;
+}
+
+CBlockHashCache& CBlockHashCache::operator=(const CBlockHashCache& other)
+{
+    if (this != &other) {
+        const CBlockHashCache copy(other);
+        std::lock_guard<std::mutex> lock(mutex);
+        header = copy.header;
+        hash = copy.hash;
+    }
+    return *this;
+}
+
+bool CBlockHashCache::Get(const CBlockHeader& headerIn, uint256& hashRet) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (hash.IsNull() || header != headerIn) return false;
+    hashRet = hash;
+    return true;
+}
+
+void CBlockHashCache::Set(const CBlockHeader& headerIn, const uint256& hashIn)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    header = headerIn;
+    hash = hashIn;
+}
+
+void CBlockHashCache::SetNull()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    header.SetNull();
+    hash.SetNull();
+}
+
+uint256 CBlock::GetHash() const
+{
+    const CBlockHeader header = GetBlockHeader();
+    uint256 hash;
+    if (!hashCache.Get(header, hash)) {
+        // hashed outside the lock, concurrent callers at worst compute the same hash twice
+        hash = header.GetHash();
+        hashCache.Set(header, hash);
+    }
+    return hash;
+}
+
+void CBlock::SetCachedHash(const uint256& hash) const
+{
+    hashCache.Set(GetBlockHeader(), hash);
+}
+
 CScript CBlock::GetPaidPayee(CAmount nAmount) const
 {
     const auto& tx = vtx[IsProofOfWork() ? 0 : 1];
@@ -13,6 +13,8 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <mutex>
+
 /** Nodes collect new transactions into a block, hash them into a hash tree,
  * and scan through nonce values to make the block's hash satisfy proof-of-work
  * requirements.  When they solve the proof-of-work, they broadcast the block
@@ -72,12 +74,64 @@ public:
 
     uint256 GetHash() const;
 
+    //! Versions below 4, except version 1 (X11K), are hashed with X11KVS
+    bool IsX11KVS() const
+    {
+        return nVersion < 4 && nVersion != 1;
+    }
+
+    //! The 80 bytes hashed by X11KVS, in little endian order
+    void GetX11KVSData(uint8_t* data) const;
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
     }
+
+    friend bool operator==(const CBlockHeader& a, const CBlockHeader& b)
+    {
+        return a.nVersion == b.nVersion &&
+               a.hashPrevBlock == b.hashPrevBlock &&
+               a.hashMerkleRoot == b.hashMerkleRoot &&
+               a.nTime == b.nTime &&
+               a.nBits == b.nBits &&
+               a.nNonce == b.nNonce &&
+               a.nAccumulatorCheckpoint == b.nAccumulatorCheckpoint;
+    }
+
+    friend bool operator!=(const CBlockHeader& a, const CBlockHeader& b)
+    {
+        return !(a == b);
+    }
 };
 
+/** Compute the hashes of many headers at once, the X11KVS ones being spread over the hashing pool */
+void GetBlockHeaderHashes(const std::vector<const CBlockHeader*>& vpHeaders, std::vector<uint256>& vHashesRet);
+void GetBlockHeaderHashes(const std::vector<CBlockHeader>& vHeaders, std::vector<uint256>& vHashesRet);
+
+
+/**
+ * Hash of a block header kept along with the header it was computed from.
+ * Blocks are shared between threads as const, so the cache is guarded by its
+ * own lock, and copies of a block take a snapshot of it.
+ */
+class CBlockHashCache
+{
+private:
+    mutable std::mutex mutex;
+    CBlockHeader header;
+    uint256 hash;
+
+public:
+    CBlockHashCache() {}
+    CBlockHashCache(const CBlockHashCache& other);
+    CBlockHashCache& operator=(const CBlockHashCache& other);
+
+    //! Return the hash remembered for this header, false if it is a different one
+    bool Get(const CBlockHeader& headerIn, uint256& hashRet) const;
+    void Set(const CBlockHeader& headerIn, const uint256& hashIn);
+    void SetNull();
+};
 
 class CBlock : public CBlockHeader
 {
@@ -90,6 +144,8 @@ public:
 
     // memory only
     mutable bool fChecked;
+    //! hash returned by GetHash() while the header is unchanged
+    mutable CBlockHashCache hashCache;
 
     CBlock()
     {
@@ -118,8 +174,15 @@ public:
         vtx.clear();
         fChecked = false;
         vchBlockSig.clear();
+        hashCache.SetNull();
     }
 
+    /** Same as CBlockHeader::GetHash(), but the result is kept until the header changes */
+    uint256 GetHash() const;
+
+    /** Remember a hash already known for this header (e.g. from the block index), so it isn't computed again */
+    void SetCachedHash(const uint256& hash) const;
+
     CBlockHeader GetBlockHeader() const
     {
         CBlockHeader block;
@@ -275,6 +275,32 @@ extern const char* FINALBUDGETVOTE;
  * The syncstatuscount message is used to track the layer 2 syncing process
  */
 extern const char* SYNCSTATUSCOUNT;
+/**
+ * Contains a 1-byte bool and 8-byte LE version number.
+ * Indicates that a node is willing to provide blocks via "cmpctblock" messages.
+ * May indicate that a node prefers to receive new block announcements via a
+ * "cmpctblock" message rather than an "inv", depending on message contents.
+ * @since protocol version 70230 (COMPACT_BLOCKS_VERSION) and NODE_COMPACT_BLOCKS.
+ */
+extern const char* SENDCMPCT;
+/**
+ * Contains a CBlockHeaderAndShortTxIDs object - providing a header and
+ * list of "short txids".
+ * @since protocol version 70230 (COMPACT_BLOCKS_VERSION) and NODE_COMPACT_BLOCKS.
+ */
+extern const char* CMPCTBLOCK;
+/**
+ * Contains a BlockTransactionsRequest
+ * Peer should respond with "blocktxn" message.
+ * @since protocol version 70230 (COMPACT_BLOCKS_VERSION) and NODE_COMPACT_BLOCKS.
+ */
+extern const char* GETBLOCKTXN;
+/**
+ * Contains a BlockTransactions.
+ * Sent in response to a "getblocktxn" message.
+ * @since protocol version 70230 (COMPACT_BLOCKS_VERSION) and NODE_COMPACT_BLOCKS.
+ */
+extern const char* BLOCKTXN;
 }; // namespace NetMsgType
 
 /* Get a vector of all valid message types (see above) */
@@ -298,6 +324,10 @@ enum ServiceFlags : uint64_t {
     // that the node doesn't want to receive master nodes messages. (the 1<<3 was not picked as constant because on bitcoin 0.14 is witness and we want that update here )
     NODE_BLOOM_WITHOUT_MN = (1 << 4),
 
+    // NODE_COMPACT_BLOCKS means the node relays and serves blocks as compact blocks
+    // (sendcmpct, cmpctblock, getblocktxn and blocktxn) since COMPACT_BLOCKS_VERSION.
+    NODE_COMPACT_BLOCKS = (1 << 5),
+
     // Bits 24-31 are reserved for temporary experiments. Just pick a bit that
     // isn't getting used, or one not being used much, and notify the
     // bitcoin-development mailing list. Remember that service bits are just
@@ -392,6 +422,8 @@ enum {
     MSG_MASTERNODE_ANNOUNCE         = 14,
     MSG_MASTERNODE_PING             = 15,
     // MSG_DSTX                        = 16,
+    // Only in getdata, asks for a cmpctblock instead of a block
+    MSG_CMPCT_BLOCK                 = 17,
 };
 
 #endif // BITCOIN_PROTOCOL_H
@@ -12,6 +12,7 @@
 #include "masternode-sync.h"
 #include "rewards.h"
 #include "sqlite3/sqlite3.h"
+#include "supplyindex.h"
 #include "timedata.h"
 #include "utilmoneystr.h"
 #include "utiltime.h"
@@ -264,66 +265,19 @@ bool CRewards::ConnectBlock(const CBlockIndex* pindex, CAmount nSubsidy)
         if (IsDynamicRewardsEpochHeight(nHeight)) 
         {
             auto nBlocksPerDay = DAY_IN_SECONDS / consensus.nTargetSpacing;
-            auto nBlocksPerWeek = WEEK_IN_SECONDS / consensus.nTargetSpacing;
-            auto nBlocksPerMonth = MONTH_IN_SECONDS / consensus.nTargetSpacing;
 
             // get total money supply
             const auto nMoneySupply = pindex->nMoneySupply.get();
             oss << "nMoneySupply: " << FormatMoney(nMoneySupply) << std::endl;
 
-            // get the current masternode collateral, and the next week collateral
-            auto nCollateralAmount = CMasternode::GetMasternodeNodeCollateral(nHeight);
-            auto nNextWeekCollateralAmount = CMasternode::GetMasternodeNodeCollateral(nHeight + nBlocksPerWeek);
-
             // calculate the current circulating supply
-            CAmount nCirculatingSupply = 0;
-            FlushStateToDisk();
-            std::unique_ptr<CCoinsViewCursor> pcursor(pcoinsTip->Cursor());
-
-            while (pcursor->Valid()) {
-                COutPoint key;
-                Coin coin;
-                if (pcursor->GetKey(key) && pcursor->GetValue(coin) && !coin.IsSpent()) {
-                    // ----------- burn address scanning -----------
-                    CTxDestination source;
-                    if (ExtractDestination(coin.out.scriptPubKey, source)) {
-                        const std::string addr = EncodeDestination(source);
-                        if (consensus.mBurnAddresses.find(addr) != consensus.mBurnAddresses.end() &&
-                            consensus.mBurnAddresses.at(addr) < nHeight
-                        ) {
-                            pcursor->Next(); // Skip
-                            continue;
-                        }
-                    }
-
-                    // ----------- masternode collaterals scanning ----------- 
-                    if(
-                        coin.out.nValue == nCollateralAmount || 
-                        coin.out.nValue == nNextWeekCollateralAmount
-                    ) {
-                        pcursor->Next(); // Skip
-                        continue;
-                    }
-
-                    // ----------- UTXOs age related scanning -----------
-                    auto nBlocksDiff = static_cast<int64_t>(nHeight - coin.nHeight);
-                    const auto nMultiplier = 100000000LL;
-
-                    // y = mx + b 
-                    // 3 months old or less => 100%
-                    // 12 months old or greater => 0%
-                    const auto nSupplyWeightRatio = 
-                        std::min(
-                            std::max(
-                                (100LL * nMultiplier - (((100LL * nMultiplier)/(9LL * nBlocksPerMonth)) * (nBlocksDiff - 3LL * nBlocksPerMonth))) / nMultiplier, 
-                            0LL), 
-                        100LL);
-
-                    nCirculatingSupply += coin.out.nValue * nSupplyWeightRatio / 100LL;
-                }
-
-                pcursor->Next();
+            if (!supplyIndex.IsSynced(pindex->pprev->GetBlockHash())) {
+                // the supply index is missing or out of sync, rebuild it once from the chainstate
+                oss << "Rebuilding the supply index" << std::endl;
+                FlushStateToDisk();
+                supplyIndex.Rebuild(pcoinsTip, pindex->nHeight - 1);
             }
+            CAmount nCirculatingSupply = supplyIndex.GetCirculatingSupply(nHeight);
             oss << "nCirculatingSupply: " << FormatMoney(nCirculatingSupply) << std::endl;
 
             // calculate the epoch's average staking power
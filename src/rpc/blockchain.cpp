@@ -15,9 +15,11 @@
 #include "masternode-sync.h"
 #include "policy/policy.h"
 #include "rpc/server.h"
+#include "supplyindex.h"
 #include "sync.h"
 #include "txdb.h"
 #include "util.h"
+#include "utxosnapshot.h"
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
 #include "hash.h"
@@ -626,7 +628,6 @@ static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash,
 //! Calculate statistics about the unspent transaction output set
 static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
 {
-    const Consensus::Params& consensus = Params().GetConsensus();
     std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
@@ -644,15 +645,9 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         Coin coin;
         if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
             // ----------- burn address scanning -----------
-            CTxDestination source;
-            if (ExtractDestination(coin.out.scriptPubKey, source)) {
-                const std::string addr = EncodeDestination(source);
-                if (consensus.mBurnAddresses.find(addr) != consensus.mBurnAddresses.end() &&
-                    consensus.mBurnAddresses.at(addr) < stats.nHeight)
-                {
-                    pcursor->Next();
-                    continue;
-                }
+            if (Params().IsBurnScript(coin.out.scriptPubKey, stats.nHeight)) {
+                pcursor->Next();
+                continue;
             }
             if (!outputs.empty() && key.hash != prevkey) {
                 ApplyStats(stats, ss, prevkey, outputs);
@@ -686,6 +681,18 @@ static std::map<std::string, CAmount> GetBurnStats(CCoinsView* view, bool fWithV
     }
 
     if(fWithValues) {
+        // the running balances of the supply index, when it follows the chainstate
+        {
+            LOCK(cs_main);
+            if (supplyIndex.IsSynced(view->GetBestBlock())) {
+                for (const auto& p : supplyIndex.GetBurnBalances()) {
+                    if (ret.count(p.first)) ret[p.first] = p.second;
+                }
+                return ret;
+            }
+        }
+
+        FlushStateToDisk();
         std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
 
         while (pcursor->Valid()) {
@@ -693,13 +700,9 @@ static std::map<std::string, CAmount> GetBurnStats(CCoinsView* view, bool fWithV
             COutPoint key;
             Coin coin;
             if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-                CTxDestination source;
-                if (ExtractDestination(coin.out.scriptPubKey, source)) {
-                    const std::string addr = EncodeDestination(source);
-                    if (consensus.mBurnAddresses.find(addr) != consensus.mBurnAddresses.end() &&
-                        consensus.mBurnAddresses.at(addr) <= nHeight) {
-                        ret[addr] = ret[addr] + coin.out.nValue;
-                    }
+                const auto pburn = Params().GetBurnAddress(coin.out.scriptPubKey);
+                if (pburn && pburn->second <= nHeight) {
+                    ret[pburn->first] += coin.out.nValue;
                 }
             } else {
                 error("%s: unable to read value", __func__);
@@ -750,6 +753,62 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
     return ret;
 }
 
+UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites the unspent transaction output set to a snapshot file, which a node having\n"
+            "the blocks up to the same block can load with -loadtxoutset and -loadtxoutsethash=<txoutset_hash>\n"
+            "instead of connecting them.\n"
+            "Note this call may take some time.\n"
+
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) The snapshot file, relative to the data directory if not absolute\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,        (numeric) The number of coins written\n"
+            "  \"base_hash\": \"hex\",       (string) The block the coins are the UTXO set of\n"
+            "  \"base_height\": n,          (numeric) The height of that block\n"
+            "  \"path\": \"path\",           (string) The absolute path of the snapshot file\n"
+            "  \"txoutset_hash\": \"hash\",  (string) The hash of the snapshot file content\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("dumptxoutset", "\"utxo.dat\"") + HelpExampleRpc("dumptxoutset", "\"utxo.dat\""));
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    if (fs::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    // The cursor reads a consistent view of the flushed chainstate, the chain
+    // can move on while the coins are written
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    int nHeight;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        pcursor.reset(pcoinsTip->Cursor());
+        nHeight = mapBlockIndex.at(pcursor->GetBestBlock())->nHeight;
+    }
+
+    CUTXOSnapshotMetadata metadata;
+    uint64_t nCoins;
+    uint256 hashSnapshot;
+    std::string strError;
+    if (!CUTXOSnapshot::Dump(pcursor.get(), nHeight, path, metadata, nCoins, hashSnapshot, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to write the snapshot: " + strError);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_written", (int64_t)nCoins));
+    ret.push_back(Pair("base_hash", metadata.hashBase.GetHex()));
+    ret.push_back(Pair("base_height", metadata.nHeight));
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("txoutset_hash", hashSnapshot.GetHex()));
+    return ret;
+}
+
 UniValue gettxout(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
@@ -859,7 +918,6 @@ UniValue getburnaddresses(const JSONRPCRequest& request)
     int nHeight = WITH_LOCK(cs_main, return chainActive.Height());
     if (nHeight < 0) return "[]";
 
-    if (fWithValues) FlushStateToDisk();
     CAmount nSum = 0;
 
     for (const auto& kv : GetBurnStats(pcoinsTip, fWithValues, nHeight)) {
@@ -1005,6 +1063,13 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
             "        \"status\": \"xxxx\",      (string) status of upgrade\n"
             "        \"info\": \"xxxx\",        (string) additional information about upgrade\n"
             "     }, ...\n"
+            "  },\n"
+            "  \"import\": {                  (object, only while importing or reindexing) block import pipeline counters\n"
+            "     \"read\": xxxxxx,           (numeric) blocks read and deserialized from the block files\n"
+            "     \"bytes\": xxxxxx,          (numeric) bytes of block data read\n"
+            "     \"hashed\": xxxxxx,         (numeric) block headers hashed\n"
+            "     \"processed\": xxxxxx,      (numeric) blocks handed to validation, in file order\n"
+            "  }\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -1034,6 +1099,15 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
 
     obj.push_back(Pair("upgrades", upgrades));
 
+    if (fImporting) {
+        UniValue import(UniValue::VOBJ);
+        import.push_back(Pair("read", (uint64_t)blockImportProgress.nBlocksRead));
+        import.push_back(Pair("bytes", (uint64_t)blockImportProgress.nBytesRead));
+        import.push_back(Pair("hashed", (uint64_t)blockImportProgress.nBlocksHashed));
+        import.push_back(Pair("processed", (uint64_t)blockImportProgress.nBlocksProcessed));
+        obj.push_back(Pair("import", import));
+    }
+
     return obj;
 }
 
@@ -158,6 +158,7 @@ UniValue generate(const JSONRPCRequest& request)
     UniValue blockHashes(UniValue::VARR);
     CReserveKey reservekey(pwalletMain);
     unsigned int nExtraNonce = 0;
+    CPoWScanner scanner;
 
     while (nHeight < nHeightEnd && !ShutdownRequested()) {
 
@@ -178,12 +179,13 @@ UniValue generate(const JSONRPCRequest& request)
                 LOCK(cs_main);
                 IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce);
             }
-            while (pblock->nNonce < std::numeric_limits<uint32_t>::max() &&
-                    !CheckProofOfWork(pblock->GetHash(), pblock->nBits)) {
-                ++pblock->nNonce;
-            }
+            uint256 hash;
+            uint32_t nHashesDone;
+            const bool fFound = scanner.Scan(*pblock, std::numeric_limits<uint32_t>::max() - pblock->nNonce,
+                                             uint256().SetCompact(pblock->nBits), hash, nHashesDone);
             if (ShutdownRequested()) break;
-            if (pblock->nNonce == std::numeric_limits<uint32_t>::max()) continue;
+            if (!fFound) continue;
+            pblock->SetCachedHash(hash);
         }
 
         CValidationState state;
@@ -267,9 +269,7 @@ UniValue gethashespersec(const JSONRPCRequest& request)
             "\nExamples:\n" +
             HelpExampleCli("gethashespersec", "") + HelpExampleRpc("gethashespersec", ""));
 
-    if (GetTimeMillis() - nHPSTimerStart > 8000)
-        return (int64_t)0;
-    return (int64_t)dHashesPerSec;
+    return (int64_t)GetHashesPerSec();
 }
 #endif
 
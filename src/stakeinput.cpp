@@ -17,7 +17,8 @@ bool CPivStake::InitFromTxIn(const CTxIn& txin)
     CTransaction txPrev;
     if (!GetTransaction(txin.prevout.hash, txPrev, hashBlock, true))
         return error("%s : INFO: read txPrev failed, tx id prev: %s", __func__, txin.prevout.hash.GetHex());
-    SetPrevout(txPrev, txin.prevout.n);
+    if (!SetPrevout(txPrev, txin.prevout.n))
+        return error("%s : INFO: prevout %s not found", __func__, txin.prevout.ToString());
 
     // Find the index of the block of the previous transaction
     if (mapBlockIndex.count(hashBlock)) {
@@ -32,13 +33,23 @@ bool CPivStake::InitFromTxIn(const CTxIn& txin)
     return true;
 }
 
-bool CPivStake::SetPrevout(CTransaction txPrev, unsigned int n)
+bool CPivStake::SetPrevout(const CTransaction& txPrev, unsigned int n)
 {
+    if (n >= txPrev.vout.size())
+        return false;
     this->txFrom = txPrev;
-    this->nPosition = n;
+    this->outpointFrom = COutPoint(txPrev.GetHash(), n);
+    this->outFrom = txPrev.vout[n];
     return true;
 }
 
+void CPivStake::SetPrevout(const COutPoint& outpoint, const CTxOut& out, CBlockIndex* pindexFromIn)
+{
+    this->outpointFrom = outpoint;
+    this->outFrom = out;
+    this->pindexFrom = pindexFromIn;
+}
+
 bool CPivStake::GetTxFrom(CTransaction& tx) const
 {
     if (txFrom.IsNull())
@@ -49,28 +60,28 @@ bool CPivStake::GetTxFrom(CTransaction& tx) const
 
 bool CPivStake::GetTxOutFrom(CTxOut& out) const
 {
-    if (txFrom.IsNull() || nPosition >= txFrom.vout.size())
+    if (outFrom.IsNull())
         return false;
-    out = txFrom.vout[nPosition];
+    out = outFrom;
     return true;
 }
 
 bool CPivStake::CreateTxIn(CWallet* pwallet, CTxIn& txIn, uint256 hashTxOut)
 {
-    txIn = CTxIn(txFrom.GetHash(), nPosition);
+    txIn = CTxIn(outpointFrom);
     return true;
 }
 
 CAmount CPivStake::GetValue() const
 {
-    return txFrom.vout[nPosition].nValue;
+    return outFrom.nValue;
 }
 
 bool CPivStake::CreateTxOuts(CWallet* pwallet, std::vector<CTxOut>& vout, CAmount nTotal, const bool onlyP2PK)
 {
     std::vector<valtype> vSolutions;
     txnouttype whichType;
-    CScript scriptPubKeyKernel = txFrom.vout[nPosition].scriptPubKey;
+    const CScript& scriptPubKeyKernel = outFrom.scriptPubKey;
     if (!Solver(scriptPubKeyKernel, whichType, vSolutions))
         return error("%s: failed to parse kernel", __func__);
 
@@ -119,7 +130,7 @@ CDataStream CPivStake::GetUniqueness() const
 {
     //The unique identifier for a KYAN stake is the outpoint
     CDataStream ss(SER_NETWORK, 0);
-    ss << nPosition << txFrom.GetHash();
+    ss << outpointFrom.n << outpointFrom.hash;
     return ss;
 }
 
@@ -130,7 +141,7 @@ CBlockIndex* CPivStake::GetIndexFrom()
         return pindexFrom;
     uint256 hashBlock = UINT256_ZERO;
     CTransaction tx;
-    if (GetTransaction(txFrom.GetHash(), tx, hashBlock, true)) {
+    if (GetTransaction(outpointFrom.hash, tx, hashBlock, true)) {
         // If the index is in the chain, then set it as the "index from"
         if (mapBlockIndex.count(hashBlock)) {
             CBlockIndex* pindex = mapBlockIndex.at(hashBlock);
@@ -138,7 +149,7 @@ CBlockIndex* CPivStake::GetIndexFrom()
                 pindexFrom = pindex;
         }
     } else {
-        LogPrintf("%s : failed to find tx %s\n", __func__, txFrom.GetHash().GetHex());
+        LogPrintf("%s : failed to find tx %s\n", __func__, outpointFrom.hash.GetHex());
     }
 
     return pindexFrom;
@@ -36,14 +36,18 @@ public:
 class CPivStake : public CStakeInput
 {
 private:
+    // only set when initialized from the whole previous transaction
     CTransaction txFrom{CTransaction()};
-    unsigned int nPosition{0};
+    COutPoint outpointFrom;
+    CTxOut outFrom;
 
 public:
     CPivStake() {}
 
     bool InitFromTxIn(const CTxIn& txin) override;
-    bool SetPrevout(CTransaction txPrev, unsigned int n);
+    bool SetPrevout(const CTransaction& txPrev, unsigned int n);
+    // Set the previous output alone, from the wallet stake candidates, with its block index when known
+    void SetPrevout(const COutPoint& outpoint, const CTxOut& out, CBlockIndex* pindexFromIn = nullptr);
 
     CBlockIndex* GetIndexFrom() override;
     bool GetTxFrom(CTransaction& tx) const override;
@@ -366,6 +366,53 @@ private:
     size_t nPos;
 };
 
+/* Minimal stream for reading from a byte range it doesn't own, like a mapped file
+ *
+ * The range must outlive the reader
+ */
+class CMemoryReader
+{
+public:
+    CMemoryReader(int nTypeIn, int nVersionIn, const unsigned char* pbeginIn, const unsigned char* pendIn) : nType(nTypeIn), nVersion(nVersionIn), pend(pendIn), pos(pbeginIn)
+    {
+        assert(pbeginIn <= pendIn);
+    }
+
+    template<typename T>
+    CMemoryReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CMemoryReader::read(): end of data");
+        memcpy(pch, pos, nSize);
+        pos += nSize;
+    }
+
+    void ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CMemoryReader::ignore(): end of data");
+        pos += nSize;
+    }
+
+    size_t size() const { return pend - pos; }
+    bool empty() const { return pos == pend; }
+    int GetVersion() const { return nVersion; }
+    int GetType() const { return nType; }
+
+private:
+    const int nType;
+    const int nVersion;
+    const unsigned char* const pend;
+    const unsigned char* pos;
+};
+
 class CDataStream : public CBaseDataStream<CSerializeData>
 {
 public:
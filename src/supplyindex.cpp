@@ -0,0 +1,341 @@
+// Copyright (c) 2021-2024 The DECENOMY Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "supplyindex.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "fs.h"
+#include "hash.h"
+#include "masternode.h"
+#include "streams.h"
+#include "timedata.h"
+#include "util.h"
+
+#include <algorithm>
+#include <memory>
+
+CSupplyIndex supplyIndex;
+
+static const int SUPPLY_INDEX_VERSION = 3;
+static const char* SUPPLY_INDEX_FILENAME = "supply.dat";
+
+void CSupplyBucket::Add(CAmount nValue)
+{
+    nHundreds += nValue / 100;
+    nRemainders += nValue % 100;
+    vRemainders.push_back(nValue % 100);
+}
+
+bool CSupplyBucket::Remove(CAmount nValue)
+{
+    auto it = std::find(vRemainders.begin(), vRemainders.end(), nValue % 100);
+    if (it == vRemainders.end()) return false;
+    *it = vRemainders.back();
+    vRemainders.pop_back();
+    nHundreds -= nValue / 100;
+    nRemainders -= nValue % 100;
+    return true;
+}
+
+CAmount CSupplyBucket::GetWeightedValue(int64_t nRatio) const
+{
+    if (nRatio <= 0) return 0;
+    if (nRatio >= 100) return nHundreds * 100 + nRemainders;
+
+    CAmount nValue = nHundreds * nRatio;
+    for (const uint8_t nRemainder : vRemainders)
+        nValue += nRemainder * nRatio / 100;
+    return nValue;
+}
+
+void CSupplyIndex::SetNull()
+{
+    mapPartitions.clear();
+    mapCollaterals.clear();
+    mapBurnBalances.clear();
+    hashBestBlock.SetNull();
+    fSynced = false;
+    nPruneHeight = 0;
+    hashWritten.SetNull();
+}
+
+int64_t CSupplyIndex::GetWeightRatio(int64_t nBlocksDiff, int64_t nBlocksPerMonth)
+{
+    const auto nMultiplier = 100000000LL;
+
+    // y = mx + b
+    // 3 months old or less => 100%
+    // 12 months old or greater => 0%
+    return std::min(
+        std::max(
+            (100LL * nMultiplier - (((100LL * nMultiplier) / (9LL * nBlocksPerMonth)) * (nBlocksDiff - 3LL * nBlocksPerMonth))) / nMultiplier,
+        0LL),
+    100LL);
+}
+
+int CSupplyIndex::GetPruneDepth()
+{
+    const int64_t nBlocksPerMonth = MONTH_IN_SECONDS / Params().GetConsensus().nTargetSpacing;
+    const int64_t nStep = (100LL * 100000000LL) / (9LL * nBlocksPerMonth);
+
+    // first age weighing nothing, plus one month of reorg margin
+    return 3 * nBlocksPerMonth + (100LL * 100000000LL + nStep - 1) / nStep + nBlocksPerMonth;
+}
+
+CSupplyIndex::PartitionKey CSupplyIndex::GetPartition(const CTxOut& out)
+{
+    PartitionKey key("", 0);
+
+    const auto pburn = Params().GetBurnAddress(out.scriptPubKey);
+    if (pburn) key.first = pburn->first;
+
+    for (const auto& p : CMasternode::GetMasternodeCollateralList()) {
+        if (p.second == out.nValue) {
+            key.second = out.nValue;
+            break;
+        }
+    }
+
+    return key;
+}
+
+uint256 CSupplyIndex::GetFingerprint()
+{
+    // anything the partitions and the pruning depend on
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << SUPPLY_INDEX_VERSION;
+    ss << Params().GetConsensus().mBurnAddresses;
+    ss << CMasternode::GetMasternodeCollateralList();
+    ss << GetPruneDepth();
+    return ss.GetHash();
+}
+
+void CSupplyIndex::AddCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    const PartitionKey key = GetPartition(coin.out);
+    if (key.second != 0) mapCollaterals[outpoint] = coin;
+    if (!key.first.empty() && coin.out.nValue != 0) mapBurnBalances[key.first] += coin.out.nValue;
+
+    const int nHeight = coin.nHeight;
+    if (nHeight < nPruneHeight) return;
+
+    mapPartitions[key][nHeight].Add(coin.out.nValue);
+}
+
+bool CSupplyIndex::SpendCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    const PartitionKey key = GetPartition(coin.out);
+    if (key.second != 0 && !mapCollaterals.erase(outpoint)) return false;
+    if (!key.first.empty() && coin.out.nValue != 0) {
+        auto it = mapBurnBalances.find(key.first);
+        if (it == mapBurnBalances.end() || it->second < coin.out.nValue) return false;
+        it->second -= coin.out.nValue;
+        if (it->second == 0) mapBurnBalances.erase(it);
+    }
+
+    const int nHeight = coin.nHeight;
+    if (nHeight < nPruneHeight) return true;
+
+    auto itPartition = mapPartitions.find(key);
+    if (itPartition == mapPartitions.end()) return false;
+    auto itBucket = itPartition->second.find(nHeight);
+    if (itBucket == itPartition->second.end()) return false;
+    if (!itBucket->second.Remove(coin.out.nValue)) return false;
+
+    if (itBucket->second.IsEmpty()) itPartition->second.erase(itBucket);
+    if (itPartition->second.empty()) mapPartitions.erase(itPartition);
+    return true;
+}
+
+bool CSupplyIndex::Apply(const CSupplyDelta& delta)
+{
+    for (const CSupplyDelta::CEntry& entry : delta.vEntries) {
+        if (entry.fAdd) {
+            AddCoin(entry.outpoint, entry.coin);
+        } else if (!SpendCoin(entry.outpoint, entry.coin)) {
+            fSynced = false;
+            return error("%s : spent coin at height %d not found", __func__, entry.coin.nHeight);
+        }
+    }
+    return true;
+}
+
+void CSupplyIndex::Prune(int nHeight)
+{
+    const int nNewPruneHeight = nHeight - GetPruneDepth();
+    if (nNewPruneHeight <= nPruneHeight) return;
+
+    for (auto it = mapPartitions.begin(); it != mapPartitions.end(); ) {
+        it->second.erase(it->second.begin(), it->second.lower_bound(nNewPruneHeight));
+        if (it->second.empty())
+            it = mapPartitions.erase(it);
+        else
+            ++it;
+    }
+    nPruneHeight = nNewPruneHeight;
+}
+
+bool CSupplyIndex::ConnectBlock(const CSupplyDelta& delta, const CBlockIndex* pindex)
+{
+    if (!IsSynced(pindex->pprev ? pindex->pprev->GetBlockHash() : UINT256_ZERO)) {
+        fSynced = false;
+        return false;
+    }
+    if (!Apply(delta)) return false;
+
+    hashBestBlock = pindex->GetBlockHash();
+    Prune(pindex->nHeight);
+    return true;
+}
+
+bool CSupplyIndex::DisconnectBlock(const CSupplyDelta& delta, const CBlockIndex* pindex)
+{
+    if (!IsSynced(pindex->GetBlockHash())) {
+        fSynced = false;
+        return false;
+    }
+    if (!Apply(delta)) return false;
+
+    hashBestBlock = pindex->pprev ? pindex->pprev->GetBlockHash() : UINT256_ZERO;
+    return true;
+}
+
+bool CSupplyIndex::Rebuild(CCoinsView* view, int nHeight)
+{
+    SetNull();
+    nPruneHeight = std::max(0, nHeight - GetPruneDepth());
+
+    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+    while (pcursor->Valid()) {
+        COutPoint key;
+        Coin coin;
+        if (pcursor->GetKey(key) && pcursor->GetValue(coin) && !coin.IsSpent())
+            AddCoin(key, coin);
+        pcursor->Next();
+    }
+
+    hashBestBlock = pcursor->GetBestBlock();
+    fSynced = true;
+    return true;
+}
+
+CAmount CSupplyIndex::GetCirculatingSupply(int nHeight) const
+{
+    const auto& consensus = Params().GetConsensus();
+    const int64_t nBlocksPerWeek = WEEK_IN_SECONDS / consensus.nTargetSpacing;
+    const int64_t nBlocksPerMonth = MONTH_IN_SECONDS / consensus.nTargetSpacing;
+
+    // the current masternode collateral, and the next week collateral
+    const CAmount nCollateralAmount = CMasternode::GetMasternodeNodeCollateral(nHeight);
+    const CAmount nNextWeekCollateralAmount = CMasternode::GetMasternodeNodeCollateral(nHeight + nBlocksPerWeek);
+
+    CAmount nCirculatingSupply = 0;
+    for (const auto& partition : mapPartitions) {
+        const PartitionKey& key = partition.first;
+
+        // burnt coins
+        if (!key.first.empty() && consensus.mBurnAddresses.at(key.first) < nHeight) continue;
+
+        // masternode collaterals
+        if (key.second != 0 && (key.second == nCollateralAmount || key.second == nNextWeekCollateralAmount)) continue;
+
+        for (const auto& bucket : partition.second) {
+            nCirculatingSupply += bucket.second.GetWeightedValue(
+                GetWeightRatio(static_cast<int64_t>(nHeight - bucket.first), nBlocksPerMonth));
+        }
+    }
+
+    return nCirculatingSupply;
+}
+
+bool CSupplyIndex::Load(const uint256& hashChainstate)
+{
+    SetNull();
+
+    // an empty chainstate, the index starts empty along with it
+    if (hashChainstate.IsNull()) {
+        fSynced = true;
+        return true;
+    }
+
+    const fs::path path = GetDataDir() / "chainstate" / SUPPLY_INDEX_FILENAME;
+    CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        LogPrintf("%s : no supply index found, it will be rebuilt at the next dynamic rewards epoch\n", __func__);
+        return false;
+    }
+
+    int nVersion;
+    uint256 hashFingerprint;
+    uint256 hashChecksum;
+    CDataStream ssSupply(SER_DISK, CLIENT_VERSION);
+    try {
+        filein >> nVersion;
+        filein >> hashFingerprint;
+        if (nVersion != SUPPLY_INDEX_VERSION || hashFingerprint != GetFingerprint()) {
+            LogPrintf("%s : supply index is outdated, it will be rebuilt at the next dynamic rewards epoch\n", __func__);
+            return false;
+        }
+        filein >> hashBestBlock;
+        filein >> nPruneHeight;
+        filein >> mapPartitions;
+        filein >> mapCollaterals;
+        filein >> mapBurnBalances;
+        filein >> hashChecksum;
+
+        ssSupply << nVersion << hashFingerprint << hashBestBlock << nPruneHeight << mapPartitions << mapCollaterals << mapBurnBalances;
+    } catch (const std::exception& e) {
+        SetNull();
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    if (hashChecksum != Hash(ssSupply.begin(), ssSupply.end())) {
+        SetNull();
+        return error("%s : checksum mismatch, supply index is corrupted", __func__);
+    }
+
+    if (hashBestBlock != hashChainstate) {
+        LogPrintf("%s : supply index at %s does not match the chainstate at %s, it will be rebuilt at the next dynamic rewards epoch\n",
+                  __func__, hashBestBlock.GetHex(), hashChainstate.GetHex());
+        SetNull();
+        return false;
+    }
+
+    fSynced = true;
+    hashWritten = hashBestBlock;
+    LogPrintf("%s : loaded supply index at %s\n", __func__, hashBestBlock.GetHex());
+    return true;
+}
+
+bool CSupplyIndex::Write()
+{
+    if (!fSynced || hashWritten == hashBestBlock) return true;
+
+    CDataStream ssSupply(SER_DISK, CLIENT_VERSION);
+    ssSupply << SUPPLY_INDEX_VERSION << GetFingerprint() << hashBestBlock << nPruneHeight << mapPartitions << mapCollaterals << mapBurnBalances;
+    const uint256 hashChecksum = Hash(ssSupply.begin(), ssSupply.end());
+    ssSupply << hashChecksum;
+
+    const fs::path path = GetDataDir() / "chainstate" / SUPPLY_INDEX_FILENAME;
+    const fs::path pathTmp = GetDataDir() / "chainstate" / (std::string(SUPPLY_INDEX_FILENAME) + ".new");
+    CAutoFile fileout(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s : Failed to open file %s", __func__, pathTmp.string());
+
+    try {
+        fileout << ssSupply;
+    } catch (const std::exception& e) {
+        return error("%s : Serialize or I/O error - %s", __func__, e.what());
+    }
+    FileCommit(fileout.Get());
+    fileout.fclose();
+
+    if (!RenameOver(pathTmp, path))
+        return error("%s : Rename-into-place failed", __func__);
+
+    hashWritten = hashBestBlock;
+    return true;
+}
@@ -0,0 +1,158 @@
+// Copyright (c) 2021-2024 The DECENOMY Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef KYAN_SUPPLYINDEX_H
+#define KYAN_SUPPLYINDEX_H
+
+#include "amount.h"
+#include "coins.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+class CBlockIndex;
+
+/**
+ * The UTXO set changes made by one block, in the order they were applied
+ * to the coins view. Collected by ConnectBlock/DisconnectBlock and handed to
+ * the supply index once the view is flushed into pcoinsTip.
+ */
+class CSupplyDelta
+{
+public:
+    struct CEntry {
+        bool fAdd;
+        COutPoint outpoint;
+        Coin coin;
+    };
+
+    std::vector<CEntry> vEntries;
+
+    void AddCoin(const COutPoint& outpoint, const Coin& coin) { vEntries.push_back(CEntry{true, outpoint, coin}); }
+    void SpendCoin(const COutPoint& outpoint, const Coin& coin) { vEntries.push_back(CEntry{false, outpoint, coin}); }
+};
+
+/**
+ * Unspent value created at one height. The per coin remainders are kept so
+ * that the weighted value is truncated coin by coin, exactly like a scan of
+ * the chainstate would do it: v * r / 100 == (v / 100) * r + (v % 100) * r / 100.
+ */
+class CSupplyBucket
+{
+public:
+    //! Sum of nValue / 100 over the coins
+    CAmount nHundreds;
+    //! Sum of nValue % 100 over the coins
+    CAmount nRemainders;
+    //! nValue % 100 of every coin
+    std::vector<uint8_t> vRemainders;
+
+    CSupplyBucket() : nHundreds(0), nRemainders(0) {}
+
+    void Add(CAmount nValue);
+    bool Remove(CAmount nValue);
+    bool IsEmpty() const { return vRemainders.empty(); }
+
+    /** Sum of nValue * nRatio / 100 over the coins, nRatio in [0, 100] */
+    CAmount GetWeightedValue(int64_t nRatio) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(nHundreds);
+        READWRITE(nRemainders);
+        READWRITE(vRemainders);
+    }
+};
+
+/**
+ * Age bucketed index of the unspent value, maintained block by block on
+ * ConnectTip/DisconnectTip, from which the dynamic rewards circulating supply
+ * is computed in O(buckets) instead of walking the whole chainstate.
+ *
+ * The coins are partitioned by burn address and by masternode collateral
+ * value, the only properties the circulating supply excludes on, and then
+ * bucketed by their creation height. Buckets old enough to weigh nothing
+ * (plus a margin of one month against reorgs) are pruned.
+ *
+ * The unspent coins of a masternode collateral value are kept as well, whatever
+ * their age, so the masternode manager doesn't need to scan the chainstate,
+ * and so is the balance of every burn address for getburnaddresses.
+ *
+ * The index follows pcoinsTip: it only takes a block when its best block is
+ * the block parent, and it is persisted to chainstate/supply.dat at every
+ * full chainstate flush. When it gets out of sync, CRewards or the masternode
+ * manager rebuild it from a scan of the chainstate the next time they need it.
+ */
+class CSupplyIndex
+{
+private:
+    //! (burn address or empty, collateral value or 0)
+    typedef std::pair<std::string, CAmount> PartitionKey;
+    typedef std::map<int, CSupplyBucket> BucketMap;
+
+    std::map<PartitionKey, BucketMap> mapPartitions;
+    //! Unspent coins of a masternode collateral value
+    std::map<COutPoint, Coin> mapCollaterals;
+    //! Unspent value paid to each burn address, whatever its age
+    std::map<std::string, CAmount> mapBurnBalances;
+    //! Chainstate best block the index represents
+    uint256 hashBestBlock;
+    //! Whether the index is in sync with hashBestBlock
+    bool fSynced;
+    //! Coins created below this height are not tracked anymore
+    int nPruneHeight;
+    //! Best block of the last write to disk
+    uint256 hashWritten;
+
+    static PartitionKey GetPartition(const CTxOut& out);
+    static uint256 GetFingerprint();
+    static int GetPruneDepth();
+
+    void AddCoin(const COutPoint& outpoint, const Coin& coin);
+    bool SpendCoin(const COutPoint& outpoint, const Coin& coin);
+    bool Apply(const CSupplyDelta& delta);
+    void Prune(int nHeight);
+
+public:
+    CSupplyIndex() { SetNull(); }
+
+    void SetNull();
+
+    /** Supply weight ratio in [0, 100] of a coin nBlocksDiff blocks old: 100 until 3 months, 0 from 12 months */
+    static int64_t GetWeightRatio(int64_t nBlocksDiff, int64_t nBlocksPerMonth);
+
+    bool IsSynced(const uint256& hashBlock) const { return fSynced && hashBestBlock == hashBlock; }
+
+    /** Take the changes of a block connected on top of the index best block */
+    bool ConnectBlock(const CSupplyDelta& delta, const CBlockIndex* pindex);
+    /** Take the changes of the index best block being disconnected */
+    bool DisconnectBlock(const CSupplyDelta& delta, const CBlockIndex* pindex);
+
+    /** Rebuild the index from the coins of a flushed view whose best block is at nHeight */
+    bool Rebuild(CCoinsView* view, int nHeight);
+
+    /** Age weighted supply at nHeight, without the burnt coins and the masternode collaterals */
+    CAmount GetCirculatingSupply(int nHeight) const;
+
+    /** Unspent coins of any masternode collateral value, as of the index best block */
+    const std::map<COutPoint, Coin>& GetCollaterals() const { return mapCollaterals; }
+
+    /** Unspent value of every burn address holding some, as of the index best block */
+    const std::map<std::string, CAmount>& GetBurnBalances() const { return mapBurnBalances; }
+
+    /** Load chainstate/supply.dat, keeping it only if it matches the chainstate best block */
+    bool Load(const uint256& hashChainstate);
+    /** Write chainstate/supply.dat if the index is in sync and changed since the last write */
+    bool Write();
+};
+
+extern CSupplyIndex supplyIndex;
+
+#endif // KYAN_SUPPLYINDEX_H
@@ -434,6 +434,56 @@ BOOST_AUTO_TEST_CASE(addrman_getaddr)
 }
 
 
+BOOST_AUTO_TEST_CASE(addrman_adddeferred)
+{
+    CAddrManTest addrman;
+
+    // Set addrman addr placement to be deterministic.
+    addrman.MakeDeterministic();
+
+    CNetAddr source = ResolveIP("252.2.2.2");
+
+    // The first gossip is added straight away while addrman is empty.
+    std::vector<CAddress> vAddr1;
+    vAddr1.push_back(CAddress(ResolveService("250.1.1.1", 8333), NODE_NONE));
+    vAddr1.push_back(CAddress(ResolveService("250.1.1.2", 8333), NODE_NONE));
+    addrman.AddDeferred(vAddr1, source);
+    BOOST_CHECK_EQUAL(addrman.size(), 2);
+
+    // Then it waits for a batch.
+    std::vector<CAddress> vAddr2;
+    for (int i = 1; i <= 10; i++)
+        vAddr2.push_back(CAddress(ResolveService(strprintf("251.%d.2.1", i), 8333), NODE_NONE));
+    addrman.AddDeferred(vAddr2, source);
+    BOOST_CHECK_EQUAL(addrman.size(), 2);
+
+    addrman.FlushDeferred();
+    const size_t nSize = addrman.size();
+    BOOST_CHECK(nSize > 2);
+
+    // A full batch is added by the gossip itself.
+    std::vector<CAddress> vAddr3;
+    for (int i = 0; i < ADDRMAN_DEFERRED_BATCH; i++)
+        vAddr3.push_back(CAddress(ResolveService(strprintf("%d.%d.7.3", 1 + i % 200, 1 + i / 200), 8333), NODE_NONE));
+    addrman.AddDeferred(vAddr3, source);
+    BOOST_CHECK(addrman.size() > nSize);
+
+    // Select adds what is left in the queue before picking.
+    std::vector<CAddress> vAddr4;
+    vAddr4.push_back(CAddress(ResolveService("250.4.4.4", 8333), NODE_NONE));
+    const size_t nSizeBatch = addrman.size();
+    addrman.AddDeferred(vAddr4, source);
+    BOOST_CHECK_EQUAL(addrman.size(), nSizeBatch);
+    addrman.Select();
+    BOOST_CHECK_EQUAL(addrman.size(), nSizeBatch + 1);
+
+    // Clear drops the queue.
+    addrman.AddDeferred(vAddr2, ResolveIP("253.3.3.3"));
+    addrman.Clear();
+    addrman.FlushDeferred();
+    BOOST_CHECK_EQUAL(addrman.size(), 0);
+}
+
 BOOST_AUTO_TEST_CASE(caddrinfo_get_tried_bucket)
 {
     CAddrManTest addrman;
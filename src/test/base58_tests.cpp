@@ -12,6 +12,7 @@
 
 #include "key.h"
 #include "script/script.h"
+#include "script/standard.h"
 #include "uint256.h"
 #include "util.h"
 #include "utilstrencodings.h"
@@ -257,5 +258,29 @@ BOOST_AUTO_TEST_CASE(base58_keys_invalid)
 }
 
 
+BOOST_AUTO_TEST_CASE(burn_address_filter)
+{
+    const CChainParams& params = Params();
+    BOOST_CHECK(!params.GetConsensus().mBurnAddresses.empty());
+
+    // every burn address is found from its script, the same way the address string lookup did
+    for (const auto& burn : params.GetConsensus().mBurnAddresses) {
+        const CTxDestination dest = DecodeDestination(burn.first);
+        BOOST_CHECK(IsValidDestination(dest));
+        const auto pburn = params.GetBurnAddress(GetScriptForDestination(dest));
+        BOOST_CHECK(pburn && pburn->first == burn.first && pburn->second == burn.second);
+        BOOST_CHECK(params.IsBurnScript(GetScriptForDestination(dest), burn.second + 1));
+        BOOST_CHECK(!params.IsBurnScript(GetScriptForDestination(dest), burn.second));
+    }
+
+    // regular scripts are not
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(!params.GetBurnAddress(GetScriptForDestination(key.GetPubKey().GetID())));
+    BOOST_CHECK(!params.GetBurnAddress(GetScriptForRawPubKey(key.GetPubKey())));
+    BOOST_CHECK(!params.GetBurnAddress(GetScriptForDestination(CScriptID(GetScriptForDestination(key.GetPubKey().GetID())))));
+    BOOST_CHECK(!params.GetBurnAddress(CScript() << OP_RETURN));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
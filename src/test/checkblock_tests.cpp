@@ -12,10 +12,12 @@
 #include "clientversion.h"
 #include "fs.h"
 #include "main.h"
+#include "random.h"
 #include "utiltime.h"
 #include "test/test_pivx.h"
 
 #include <cstdio>
+#include <thread>
 
 #include <boost/test/unit_test.hpp>
 
@@ -66,4 +68,49 @@ BOOST_AUTO_TEST_CASE(May15)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(block_hash_cache)
+{
+    CBlock block;
+    block.nVersion = 3;
+    block.hashPrevBlock = GetRandHash();
+    block.hashMerkleRoot = GetRandHash();
+    block.nTime = 1599766364;
+    block.nBits = 0x1e0ffff0;
+    block.nNonce = 112122;
+
+    const uint256 hash = block.GetBlockHeader().GetHash();
+    BOOST_CHECK(block.GetHash() == hash);
+
+    // a changed header is hashed again
+    block.nNonce++;
+    BOOST_CHECK(block.GetHash() == block.GetBlockHeader().GetHash());
+    BOOST_CHECK(block.GetHash() != hash);
+
+    // a known hash is returned until the header changes
+    const uint256 hashKnown = GetRandHash();
+    block.SetCachedHash(hashKnown);
+    BOOST_CHECK(block.GetHash() == hashKnown);
+    block.nTime++;
+    BOOST_CHECK(block.GetHash() == block.GetBlockHeader().GetHash());
+
+    // concurrent readers of a shared block agree on the hash
+    const CBlock blockShared(block);
+    std::vector<uint256> vHashes(4);
+    std::vector<std::thread> vThreads;
+    for (uint256& hashThread : vHashes) {
+        vThreads.emplace_back([&blockShared, &hashThread]() {
+            for (int i = 0; i < 100; i++) hashThread = blockShared.GetHash();
+        });
+    }
+    for (std::thread& t : vThreads) t.join();
+    for (const uint256& hashThread : vHashes) {
+        BOOST_CHECK(hashThread == block.GetHash());
+    }
+
+    // a known hash is dropped with the header
+    block.SetCachedHash(hashKnown);
+    block.SetNull();
+    BOOST_CHECK(block.GetHash() == block.GetBlockHeader().GetHash());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
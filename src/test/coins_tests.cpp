@@ -6,7 +6,9 @@
 
 #include "coins.h"
 #include "main.h"
+#include "random.h"
 #include "script/standard.h"
+#include "txdb.h"
 #include "uint256.h"
 #include "undo.h"
 #include "utilstrencodings.h"
@@ -17,8 +19,8 @@
 
 #include <boost/test/unit_test.hpp>
 
-int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out);
-void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txundo, int nHeight);
+int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out, CSupplyDelta* pdelta = nullptr);
+void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txundo, int nHeight, CSupplyDelta* pdelta = nullptr);
 
 namespace
 {
@@ -812,4 +814,69 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_FIXTURE_TEST_CASE(ccoins_db_writer, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    // batches of a few coins, so that the writes go in many parts
+    CCoinsViewDBWriter writer(&db, &db, 1000);
+    CCoinsViewCache cache(&writer);
+
+    std::map<COutPoint, Coin> mapCoins;
+    for (int i = 0; i < 1000; i++) {
+        const COutPoint outpoint(InsecureRand256(), 0);
+        const Coin coin(CTxOut(InsecureRandRange(1000 * COIN), CScript() << OP_TRUE), 1, false, false);
+        mapCoins.emplace(outpoint, coin);
+        cache.AddCoin(outpoint, Coin(coin), false);
+    }
+    const uint256 hashBlock1 = InsecureRand256();
+    cache.SetBestBlock(hashBlock1);
+
+    // The first write of the chainstate goes to the background, and the
+    // coins are read back whether they are on disk yet or not
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0);
+    BOOST_CHECK(cache.GetBestBlock() == hashBlock1);
+    for (const auto& entry : mapCoins) {
+        Coin coin;
+        BOOST_CHECK(cache.GetCoin(entry.first, coin));
+        BOOST_CHECK(coin.out == entry.second.out);
+    }
+    BOOST_CHECK(writer.Sync());
+    BOOST_CHECK(!writer.IsWriting());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock1);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    for (const auto& entry : mapCoins)
+        BOOST_CHECK(db.HaveCoin(entry.first));
+
+    // A flush which isn't known to move forward is written at once
+    size_t i = 0;
+    for (const auto& entry : mapCoins) {
+        if (i++ % 2) cache.SpendCoin(entry.first);
+    }
+    const uint256 hashBlock2 = InsecureRand256();
+    cache.SetBestBlock(hashBlock2);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!writer.IsWriting());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock2);
+    i = 0;
+    for (const auto& entry : mapCoins)
+        BOOST_CHECK_EQUAL(db.HaveCoin(entry.first), (i++ % 2) == 0);
+
+    // The head blocks mark the database until the last part is written
+    CCoinsMap mapWrite;
+    for (int j = 0; j < 10; j++) {
+        CCoinsCacheEntry& entry = mapWrite[COutPoint(InsecureRand256(), 0)];
+        entry.coin = Coin(CTxOut(COIN, CScript() << OP_TRUE), 2, false, false);
+        entry.flags = CCoinsCacheEntry::DIRTY;
+    }
+    const uint256 hashBlock3 = InsecureRand256();
+    std::vector<std::vector<uint256> > vHeads;
+    BOOST_CHECK(db.BatchWriteInParts(mapWrite, hashBlock2, hashBlock3, 1,
+        [&](CCoinsMap::const_iterator itBegin, CCoinsMap::const_iterator itEnd) { vHeads.push_back(db.GetHeadBlocks()); }));
+    BOOST_CHECK_EQUAL(vHeads.size(), mapWrite.size() + 1);
+    BOOST_CHECK(vHeads.front() == std::vector<uint256>({hashBlock3, hashBlock2}));
+    BOOST_CHECK(vHeads.back().empty());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock3);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
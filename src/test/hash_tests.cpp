@@ -4,12 +4,17 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "hash.h"
+#include "miner.h"
+#include "random.h"
 #include "utilstrencodings.h"
+#include "x11kvsengine.h"
 #include "test/test_pivx.h"
 
+#include <atomic>
 #include <vector>
 
 #include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
 
 
 BOOST_FIXTURE_TEST_SUITE(hash_tests, BasicTestingSetup)
@@ -145,4 +150,117 @@ BOOST_AUTO_TEST_CASE(siphash)
     }
 }
 
+BOOST_AUTO_TEST_CASE(x11kvs_engine)
+{
+    FastRandomContext ctx;
+    std::vector<unsigned char> vHeaders;
+    for (int i = 0; i < 4; i++) {
+        std::vector<unsigned char> vHeader = ctx.randbytes(80);
+        // small nonces make the subtree nonces collide more often
+        if (i % 2) le32enc(&vHeader[76], i);
+        vHeaders.insert(vHeaders.end(), vHeader.begin(), vHeader.end());
+    }
+
+    std::vector<uint256> vExpected;
+    for (int i = 0; i < 4; i++) {
+        const unsigned char* p = &vHeaders[i * 80];
+        vExpected.push_back(HashX11KVS(p, p + 80));
+        BOOST_CHECK(x11kvsEngine.Hash(p) == vExpected.back());
+        BOOST_CHECK(x11kvsEngine.Hash(p, 3) == HashX11KVS(p, p + 80, 3));
+    }
+
+    // same results when the pool is serving the engine
+    boost::thread_group threads;
+    for (int i = 0; i < 3; i++)
+        threads.create_thread(&ThreadX11KVSHash);
+    while (x11kvsEngine.GetWorkers() < 3)
+        MilliSleep(1);
+
+    std::vector<uint256> vHashes(4);
+    x11kvsEngine.HashBatch(vHeaders.data(), 4, vHashes.data());
+    for (int i = 0; i < 4; i++) {
+        BOOST_CHECK(vHashes[i] == vExpected[i]);
+        BOOST_CHECK(x11kvsEngine.Hash(&vHeaders[i * 80]) == vExpected[i]);
+    }
+
+    // a caller interrupted while waiting for the pool only leaves once its jobs are done
+    const int nBatch = 64;
+    std::vector<unsigned char> vBatch;
+    for (int i = 0; i < nBatch; i++)
+        vBatch.insert(vBatch.end(), vHeaders.begin() + (i % 4) * 80, vHeaders.begin() + (i % 4 + 1) * 80);
+    std::vector<uint256> vBatchHashes(nBatch);
+    std::atomic<bool> fStarted(false);
+    std::atomic<bool> fInterrupted(false);
+    boost::thread caller([&]() {
+        fStarted = true;
+        x11kvsEngine.HashBatch(vBatch.data(), nBatch, vBatchHashes.data());
+        try {
+            while (true)
+                boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+        } catch (const boost::thread_interrupted&) {
+            fInterrupted = true;
+        }
+    });
+    while (!fStarted)
+        MilliSleep(1);
+    caller.interrupt();
+    caller.join();
+    BOOST_CHECK(fInterrupted);
+    for (int i = 0; i < nBatch; i++)
+        BOOST_CHECK(vBatchHashes[i] == vExpected[i % 4]);
+
+    threads.interrupt_all();
+    threads.join_all();
+    BOOST_CHECK_EQUAL(x11kvsEngine.GetWorkers(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(pow_scanner)
+{
+    // X11K, X11KVS and the double SHA256 headers with and without accumulator checkpoint
+    for (const int32_t nVersion : {1, 3, 5, 7}) {
+        CBlockHeader header;
+        header.nVersion = nVersion;
+        header.hashPrevBlock = InsecureRand256();
+        header.hashMerkleRoot = InsecureRand256();
+        header.nTime = InsecureRand32();
+        header.nBits = 0x1e0ffff0;
+        header.nNonce = InsecureRand32() >> 1;
+        header.nAccumulatorCheckpoint = InsecureRand256();
+
+        CPoWScanner scanner;
+        for (int nRound = 0; nRound < 2; nRound++) {
+            // what the nonces hash to, one at a time
+            std::vector<uint256> vExpected;
+            CBlockHeader headerExpected = header;
+            for (int i = 0; i < 4; i++) {
+                vExpected.push_back(headerExpected.GetHash());
+                headerExpected.nNonce++;
+            }
+
+            // nothing found below the null target, and the nonce is moved past what was hashed
+            const uint32_t nNonceStart = header.nNonce;
+            uint256 hash;
+            uint32_t nHashesDone;
+            BOOST_CHECK(!scanner.Scan(header, 2, uint256(), hash, nHashesDone));
+            BOOST_CHECK_EQUAL(nHashesDone, 2);
+            BOOST_CHECK_EQUAL(header.nNonce, nNonceStart + 2);
+            BOOST_CHECK(hash == vExpected[1]);
+
+            // the scan stops on the first nonce at or below the target
+            header.nNonce = nNonceStart;
+            unsigned int nFirst = 0;
+            while (vExpected[nFirst] > vExpected[3])
+                nFirst++;
+            BOOST_CHECK(scanner.Scan(header, 4, vExpected[3], hash, nHashesDone));
+            BOOST_CHECK_EQUAL(nHashesDone, nFirst + 1);
+            BOOST_CHECK_EQUAL(header.nNonce, nNonceStart + nFirst);
+            BOOST_CHECK(hash == vExpected[nFirst]);
+
+            // a header change besides the nonce is picked up by the scanner
+            header.nNonce = nNonceStart;
+            header.nTime++;
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
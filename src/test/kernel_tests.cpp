@@ -0,0 +1,165 @@
+// Copyright (c) 2021-2022 The DECENOMY Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "kernel.h"
+#include "stakeinput.h"
+#include "test/test_pivx.h"
+#include "utiltime.h"
+#include "x11kvsengine.h"
+
+#include <atomic>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(kernel_tests, TestingSetup)
+
+// Stake kernel hash as computed before the prefix hasher
+static uint256 LegacyKernelHash(const CBlockIndex* pindexPrev, CStakeInput& stakeInput, int nTimeTx)
+{
+    CDataStream ss(SER_GETHASH, 0);
+    ss << pindexPrev->GetStakeModifierV2();
+    ss << (int)stakeInput.GetIndexFrom()->nTime << stakeInput.GetUniqueness() << nTimeTx;
+    return Hash(ss.begin(), ss.end());
+}
+
+struct KernelSetup {
+    const int64_t nTimeNow = 1650000000;
+    CBlockIndex indexFrom;
+    CBlockIndex indexPrev;
+    std::vector<CPivStake> vStakes;
+
+    KernelSetup(size_t nInputs)
+    {
+        SetMockTime(nTimeNow);
+        indexFrom.nHeight = 100000;
+        indexFrom.nTime = nTimeNow - 60 * 60 * 24;
+        indexPrev.nHeight = 200000;
+        indexPrev.nTime = nTimeNow - 10 * Params().GetConsensus().nTimeSlotLength;
+        indexPrev.SetStakeModifier(uint256S("0x9a3f6e2d17c4b58e0f1d2c3b4a5968778695a4b3c2d1e0f1f2e3d4c5b6a79788"));
+
+        vStakes.resize(nInputs);
+        for (size_t i = 0; i < nInputs; i++) {
+            const COutPoint outpoint(uint256S("0x1234"), (uint32_t)i);
+            vStakes[i].SetPrevout(outpoint, CTxOut((i + 1) * 10 * COIN, CScript()), &indexFrom);
+        }
+    }
+
+    ~KernelSetup()
+    {
+        SetMockTime(0);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(kernel_prefix_hash)
+{
+    KernelSetup setup(4);
+    const int nTimeSlot = Params().GetConsensus().nTimeSlotLength;
+
+    for (CPivStake& stake : setup.vStakes) {
+        const CStakeKernel kernel(&setup.indexPrev, &stake, 0x1d001500, setup.nTimeNow);
+        const CHash256 hasherPrefix = kernel.GetPrefixHasher();
+        BOOST_CHECK(kernel.GetHash() == LegacyKernelHash(&setup.indexPrev, stake, setup.nTimeNow));
+
+        // the prefix is the same for every time slot
+        for (int64_t nTimeTx = setup.indexPrev.nTime; nTimeTx <= setup.nTimeNow + 100 * nTimeSlot; nTimeTx += nTimeSlot) {
+            BOOST_CHECK(CStakeKernel::GetHash(hasherPrefix, nTimeTx) == LegacyKernelHash(&setup.indexPrev, stake, nTimeTx));
+            const CStakeKernel kernelAt(&setup.indexPrev, &stake, 0x1d001500, nTimeTx);
+            BOOST_CHECK(kernelAt.GetHash() == CStakeKernel::GetHash(hasherPrefix, nTimeTx));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(kernel_search_matches_stake)
+{
+    KernelSetup setup(64);
+
+    // Weighted targets around 2^247, a handful of inputs have a kernel in the window
+    for (unsigned int nBits : {0x1d001500u, 0x1d000500u, 0x1c010000u}) {
+        CStakeKernelSearch search(&setup.indexPrev, nBits);
+        for (CPivStake& stake : setup.vStakes) {
+            BOOST_CHECK(search.AddInput(&stake));
+        }
+        BOOST_CHECK_EQUAL(search.GetInputsCount(), setup.vStakes.size());
+
+        // Walk the inputs the way the staker does, resuming past each kernel found
+        size_t nStart = 0;
+        while (nStart <= setup.vStakes.size()) {
+            size_t nInput = 0;
+            int64_t nTimeTx = 0;
+            const bool fFound = search.Search(nStart, nInput, nTimeTx);
+
+            // Expected: the first input from nStart that stakes on its own
+            size_t nExpected = setup.vStakes.size();
+            int64_t nTimeExpected = 0;
+            for (size_t i = nStart; i < setup.vStakes.size(); i++) {
+                int64_t nTimeStake = 0;
+                if (Stake(&setup.indexPrev, &setup.vStakes[i], nBits, nTimeStake)) {
+                    nExpected = i;
+                    nTimeExpected = nTimeStake;
+                    break;
+                }
+            }
+
+            BOOST_CHECK_EQUAL(fFound, nExpected < setup.vStakes.size());
+            if (!fFound) break;
+            BOOST_CHECK_EQUAL(nInput, nExpected);
+            BOOST_CHECK_EQUAL(nTimeTx, nTimeExpected);
+            BOOST_CHECK(CStakeKernel::GetHash(CStakeKernel(&setup.indexPrev, &setup.vStakes[nInput], nBits, nTimeTx).GetPrefixHasher(), nTimeTx) ==
+                        LegacyKernelHash(&setup.indexPrev, setup.vStakes[nInput], nTimeTx));
+            BOOST_CHECK(CStakeKernel(&setup.indexPrev, &setup.vStakes[nInput], nBits, nTimeTx).CheckKernelHash(true));
+            nStart = nInput + 1;
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(kernel_search_interrupted)
+{
+    KernelSetup setup(2000);
+
+    // A target out of reach: every input and time slot is hashed
+    CStakeKernelSearch search(&setup.indexPrev, 0x03000001);
+    for (CPivStake& stake : setup.vStakes) {
+        BOOST_CHECK(search.AddInput(&stake));
+    }
+    size_t nInput = 0;
+    int64_t nTimeExpected = 0;
+    BOOST_CHECK(!search.Search(0, nInput, nTimeExpected));
+
+    boost::thread_group workers;
+    for (int i = 0; i < 3; i++)
+        workers.create_thread(&ThreadX11KVSHash);
+    while (x11kvsEngine.GetWorkers() < 3)
+        MilliSleep(1);
+
+    // The staker thread is interrupted at shutdown in the middle of a search,
+    // which only returns once all of its chunks are done
+    std::atomic<bool> fStarted(false);
+    std::atomic<bool> fFound(true);
+    std::atomic<bool> fInterrupted(false);
+    int64_t nTimeTx = 0;
+    boost::thread staker([&]() {
+        fStarted = true;
+        size_t nInputRet = 0;
+        fFound = search.Search(0, nInputRet, nTimeTx);
+        try {
+            while (true)
+                boost::this_thread::sleep_for(boost::chrono::milliseconds(1));
+        } catch (const boost::thread_interrupted&) {
+            fInterrupted = true;
+        }
+    });
+    while (!fStarted)
+        MilliSleep(1);
+    staker.interrupt();
+    staker.join();
+    BOOST_CHECK(fInterrupted);
+    BOOST_CHECK(!fFound);
+    BOOST_CHECK_EQUAL(nTimeTx, nTimeExpected);
+
+    workers.interrupt_all();
+    workers.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,11 +6,16 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "blocksignature.h"
+#include "clientversion.h"
+#include "keystore.h"
 #include "main.h"
 #include "primitives/transaction.h"
 #include "script/sign.h"
+#include "streams.h"
+#include "x11kvsengine.h"
 #include "test_pivx.h"
 #include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
 #include "masternode.h"
 #include "rewards.h"
 
@@ -150,4 +155,229 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     BOOST_CHECK(Test());
 }
 
+static std::vector<CBlock> MakeBlockChain(size_t nBlocks)
+{
+    std::vector<CBlock> vBlocks(nBlocks);
+    uint256 hashPrev = GetRandHash();
+    for (CBlock& block : vBlocks) {
+        block.nVersion = 4;
+        block.hashPrevBlock = hashPrev;
+        block.hashMerkleRoot = GetRandHash();
+        block.nTime = 1600000000;
+        block.nBits = 0x1e0ffff0;
+        hashPrev = block.GetHash();
+    }
+    return vBlocks;
+}
+
+BOOST_AUTO_TEST_CASE(block_download_queue)
+{
+    CBlockDownloadQueue queue;
+    const std::vector<CBlock> vBlocks = MakeBlockChain(10);
+    for (const CBlock& block : vBlocks) {
+        BOOST_CHECK(queue.Push(block.GetHash()));
+    }
+    BOOST_CHECK(!queue.Push(vBlocks[3].GetHash()));
+    BOOST_CHECK_EQUAL(queue.Size(), vBlocks.size());
+    BOOST_CHECK(queue.Front() == vBlocks.front().GetHash());
+    BOOST_CHECK(queue.Back() == vBlocks.back().GetHash());
+
+    // Only the first blocks of the window are asked, in chain order, minus the skipped ones
+    std::vector<uint256> vToRequest;
+    queue.FindBlocksToRequest(3, 5, [&vBlocks](const uint256& hash) { return hash == vBlocks[1].GetHash(); }, vToRequest);
+    BOOST_CHECK_EQUAL(vToRequest.size(), 3U);
+    BOOST_CHECK(vToRequest[0] == vBlocks[0].GetHash());
+    BOOST_CHECK(vToRequest[1] == vBlocks[2].GetHash());
+    BOOST_CHECK(vToRequest[2] == vBlocks[3].GetHash());
+
+    vToRequest.clear();
+    queue.FindBlocksToRequest(100, 5, [](const uint256& hash) { return false; }, vToRequest);
+    BOOST_CHECK_EQUAL(vToRequest.size(), 5U);
+
+    // The blocks held ahead are not asked again
+    BOOST_CHECK(queue.HoldBlockAhead(1, vBlocks[2]));
+    vToRequest.clear();
+    queue.FindBlocksToRequest(100, 5, [](const uint256& hash) { return false; }, vToRequest);
+    BOOST_CHECK_EQUAL(vToRequest.size(), 4U);
+    BOOST_CHECK(std::find(vToRequest.begin(), vToRequest.end(), vBlocks[2].GetHash()) == vToRequest.end());
+
+    // The blocks in the index are pruned from the front only
+    BlockMap mapIndex;
+    CBlockIndex index;
+    mapIndex.emplace(vBlocks[0].GetHash(), &index);
+    mapIndex.emplace(vBlocks[1].GetHash(), &index);
+    mapIndex.emplace(vBlocks[5].GetHash(), &index);
+    queue.Prune(mapIndex);
+    BOOST_CHECK_EQUAL(queue.Size(), vBlocks.size() - 2);
+    BOOST_CHECK(queue.Front() == vBlocks[2].GetHash());
+    BOOST_CHECK(!queue.Contains(vBlocks[1].GetHash()));
+    BOOST_CHECK(queue.Contains(vBlocks[5].GetHash()));
+
+    queue.Clear();
+    BOOST_CHECK(queue.Empty());
+    BOOST_CHECK(!queue.HasBlocksAhead());
+    BOOST_CHECK_EQUAL(queue.GetBlocksAheadSize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(block_download_blocks_ahead)
+{
+    const std::vector<CBlock> vBlocks = MakeBlockChain(4);
+    const size_t nBlockSize = ::GetSerializeSize(vBlocks[0], SER_NETWORK, PROTOCOL_VERSION);
+
+    // Room for two blocks
+    CBlockDownloadQueue queue(2 * nBlockSize);
+    BOOST_CHECK(queue.HoldBlockAhead(7, vBlocks[2]));
+    BOOST_CHECK(!queue.HoldBlockAhead(8, vBlocks[2]));
+    BOOST_CHECK(queue.HoldBlockAhead(8, vBlocks[1]));
+    BOOST_CHECK(!queue.HoldBlockAhead(9, vBlocks[3]));
+    BOOST_CHECK(queue.IsHeldAhead(vBlocks[1].GetHash()));
+    BOOST_CHECK(queue.IsHeldAhead(vBlocks[2].GetHash()));
+    BOOST_CHECK(!queue.IsHeldAhead(vBlocks[3].GetHash()));
+    BOOST_CHECK_EQUAL(queue.GetBlocksAheadSize(), 2 * nBlockSize);
+
+    // They come out in chain order from their parent, with the peer they came from
+    CBlockDownloadQueue::CBlockAhead ahead;
+    BOOST_CHECK(!queue.PopBlockAhead(vBlocks[1].hashPrevBlock, ahead));
+    BOOST_CHECK(queue.PopBlockAhead(vBlocks[0].GetHash(), ahead));
+    BOOST_CHECK(ahead.pblock->GetHash() == vBlocks[1].GetHash());
+    BOOST_CHECK_EQUAL(ahead.nodeid, 8);
+    BOOST_CHECK(queue.PopBlockAhead(ahead.pblock->GetHash(), ahead));
+    BOOST_CHECK(ahead.pblock->GetHash() == vBlocks[2].GetHash());
+    BOOST_CHECK_EQUAL(ahead.nodeid, 7);
+    BOOST_CHECK(!queue.PopBlockAhead(ahead.pblock->GetHash(), ahead));
+    BOOST_CHECK(!queue.HasBlocksAhead());
+    BOOST_CHECK_EQUAL(queue.GetBlocksAheadSize(), 0U);
+
+    // The room is freed with them
+    BOOST_CHECK(queue.HoldBlockAhead(9, vBlocks[3]));
+}
+
+BOOST_AUTO_TEST_CASE(block_download_drop_invalid)
+{
+    CBlockDownloadQueue queue;
+    const std::vector<CBlock> vBlocks = MakeBlockChain(6);
+    for (const CBlock& block : vBlocks) {
+        BOOST_CHECK(queue.Push(block.GetHash()));
+    }
+    const size_t nBlockSize = ::GetSerializeSize(vBlocks[0], SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(queue.HoldBlockAhead(1, vBlocks[1]));
+    BOOST_CHECK(queue.HoldBlockAhead(1, vBlocks[3]));
+    BOOST_CHECK(queue.HoldBlockAhead(1, vBlocks[4]));
+
+    // An invalid block takes the blocks after it along, the ones held ahead included
+    BOOST_CHECK(!queue.DropFrom(uint256S("0x1234")));
+    BOOST_CHECK(queue.DropFrom(vBlocks[2].GetHash()));
+    BOOST_CHECK_EQUAL(queue.Size(), 2U);
+    BOOST_CHECK(queue.Back() == vBlocks[1].GetHash());
+    for (size_t i = 2; i < vBlocks.size(); i++) {
+        BOOST_CHECK(!queue.Contains(vBlocks[i].GetHash()));
+        BOOST_CHECK(!queue.IsHeldAhead(vBlocks[i].GetHash()));
+    }
+    BOOST_CHECK(queue.IsHeldAhead(vBlocks[1].GetHash()));
+    BOOST_CHECK_EQUAL(queue.GetBlocksAheadSize(), nBlockSize);
+
+    // down to the front one, which leaves the queue empty
+    BOOST_CHECK(queue.DropFrom(vBlocks[0].GetHash()));
+    BOOST_CHECK(queue.Empty());
+    BOOST_CHECK(!queue.HasBlocksAhead());
+    BOOST_CHECK_EQUAL(queue.GetBlocksAheadSize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(resurrect_disconnected_transactions)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKey(key);
+    const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    // The coins txA and txB spend, confirmed below the fork
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txFund.vout.assign(2, CTxOut(10 * COIN, scriptPubKey));
+    auto Spend = [&keystore, &scriptPubKey](const CTransaction& txFrom, uint32_t n) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(txFrom.GetHash(), n);
+        tx.vout.emplace_back(txFrom.vout[n].nValue - CENT, scriptPubKey);
+        BOOST_CHECK(SignSignature(keystore, txFrom, tx, 0, SIGHASH_ALL));
+        return tx;
+    };
+    const CMutableTransaction txA = Spend(txFund, 0);
+    const CMutableTransaction txB = Spend(txFund, 1);
+    CMutableTransaction txChildA = Spend(txA, 0);
+    CMutableTransaction txChildB = Spend(txB, 0);
+
+    LOCK(cs_main);
+    // Two blocks, with txA then txB, were disconnected and the new branch confirms txA
+    // again: its coins are back while txB's input is unspent
+    AddCoins(*pcoinsTip, txFund, 1);
+    pcoinsTip->SpendCoin(txA.vin[0].prevout);
+    AddCoins(*pcoinsTip, txA, 1);
+    std::vector<std::vector<CTransaction>> vBlocksTx = {{txB}, {txA}};
+
+    // The children of both were in the mempool already
+    TestMemPoolEntryHelper entry;
+    mempool.addUnchecked(txChildA.GetHash(), entry.Fee(CENT).FromTx(txChildA));
+    mempool.addUnchecked(txChildB.GetHash(), entry.Fee(CENT).FromTx(txChildB));
+
+    ResurrectDisconnectedTransactions(vBlocksTx, {txA.GetHash()});
+    BOOST_CHECK(vBlocksTx.empty());
+    BOOST_CHECK_EQUAL(mempool.size(), 3U);
+    BOOST_CHECK(!mempool.exists(txA.GetHash()));
+    BOOST_CHECK(mempool.exists(txB.GetHash()));
+    BOOST_CHECK(mempool.exists(txChildA.GetHash()));
+    BOOST_CHECK(mempool.exists(txChildB.GetHash()));
+    {
+        LOCK(mempool.cs);
+        BOOST_CHECK_EQUAL(mempool.mapTx.find(txChildA.GetHash())->GetCountWithAncestors(), 1U);
+        BOOST_CHECK_EQUAL(mempool.mapTx.find(txChildB.GetHash())->GetCountWithAncestors(), 2U);
+    }
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(load_external_block_file_interrupted)
+{
+    // A file of blocks with unknown parents: read and hashed, never connected
+    const int nBlocks = 2000;
+    const fs::path pathFile = pathTemp / "import.dat";
+    {
+        CAutoFile file(fopen(pathFile.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        const std::vector<CBlock> vBlocks = MakeBlockChain(nBlocks);
+        for (const CBlock& block : vBlocks) {
+            file << FLATDATA(Params().MessageStart()) << (unsigned int)::GetSerializeSize(block, SER_DISK, CLIENT_VERSION) << block;
+        }
+    }
+
+    boost::thread_group workers;
+    for (int i = 0; i < 3; i++)
+        workers.create_thread(&ThreadX11KVSHash);
+
+    // Shutdown in the middle of the import, with header batches on the hashing pool
+    std::atomic<bool> fStarted(false);
+    boost::thread importer([&pathFile, &fStarted]() {
+        fStarted = true;
+        try {
+            LoadExternalBlockFile(fopen(pathFile.string().c_str(), "rb"));
+        } catch (const boost::thread_interrupted&) {
+        }
+    });
+    while (!fStarted)
+        MilliSleep(1);
+    MilliSleep(5);
+    importer.interrupt();
+    importer.join();
+    BOOST_CHECK(blockImportProgress.nBlocksHashed <= blockImportProgress.nBlocksRead);
+
+    // The progress of the next file starts over
+    LoadExternalBlockFile(fopen(pathFile.string().c_str(), "rb"));
+    BOOST_CHECK_EQUAL(blockImportProgress.nBlocksRead.load(), (uint64_t)nBlocks);
+    BOOST_CHECK_EQUAL(blockImportProgress.nBlocksHashed.load(), (uint64_t)nBlocks);
+    BOOST_CHECK_EQUAL(blockImportProgress.nBlocksProcessed.load(), (uint64_t)nBlocks);
+
+    workers.interrupt_all();
+    workers.join_all();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -318,6 +318,73 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     CheckSort<3>(pool, sortedOrder);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    /* low fee parent */
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(2);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    tx1.vout[1].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[1].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(1000LL).SigOps(1).FromTx(tx1));
+
+    /* higher fee than the parent, lower than its child */
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx2.vout[0].nValue = 2 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(20000LL).SigOps(1).FromTx(tx2));
+
+    /* high fee child of tx1 */
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx3.vin[0].scriptSig = CScript() << OP_11;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx3.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx3.GetHash(), entry.Fee(100000LL).SigOps(2).FromTx(tx3));
+
+    CTxMemPool::txiter it1 = pool.mapTx.find(tx1.GetHash());
+    CTxMemPool::txiter it3 = pool.mapTx.find(tx3.GetHash());
+    BOOST_CHECK_EQUAL(it1->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(it3->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(it3->GetSizeWithAncestors(), it1->GetTxSize() + it3->GetTxSize());
+    BOOST_CHECK_EQUAL(it3->GetModFeesWithAncestors(), 101000LL);
+    BOOST_CHECK_EQUAL(it3->GetSigOpCountWithAncestors(), 3);
+
+    /* the child pays for its parent: tx3 package first, then tx2, then tx1 by itself */
+    std::vector<std::string> sortedOrder;
+    sortedOrder.push_back(tx3.GetHash().ToString());
+    sortedOrder.push_back(tx2.GetHash().ToString());
+    sortedOrder.push_back(tx1.GetHash().ToString());
+    CheckSort<4>(pool, sortedOrder);
+
+    /* prioritising the parent moves its descendants */
+    pool.PrioritiseTransaction(tx1.GetHash(), tx1.GetHash().ToString(), 0, 500000LL);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx3.GetHash())->GetModFeesWithAncestors(), 601000LL);
+    sortedOrder.clear();
+    sortedOrder.push_back(tx1.GetHash().ToString());
+    sortedOrder.push_back(tx3.GetHash().ToString());
+    sortedOrder.push_back(tx2.GetHash().ToString());
+    CheckSort<4>(pool, sortedOrder);
+    pool.ClearPrioritisation(tx1.GetHash());
+
+    /* the parent confirmed in a block leaves the child alone */
+    std::list<CTransaction> removed;
+    pool.remove(tx1, removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    it3 = pool.mapTx.find(tx3.GetHash());
+    BOOST_CHECK_EQUAL(it3->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(it3->GetSizeWithAncestors(), it3->GetTxSize());
+    BOOST_CHECK_EQUAL(it3->GetModFeesWithAncestors(), 100000LL);
+    BOOST_CHECK_EQUAL(it3->GetSigOpCountWithAncestors(), 2);
+}
+
 
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
 {
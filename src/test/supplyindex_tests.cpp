@@ -0,0 +1,179 @@
+// Copyright (c) 2021-2024 The DECENOMY Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "base58.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "random.h"
+#include "script/standard.h"
+#include "supplyindex.h"
+#include "timedata.h"
+#include "test/test_pivx.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(supplyindex_tests, BasicTestingSetup)
+
+static CAmount GetWeightedSum(const std::vector<Coin>& vCoins, int nHeight)
+{
+    const int64_t nBlocksPerMonth = MONTH_IN_SECONDS / Params().GetConsensus().nTargetSpacing;
+    CAmount nSum = 0;
+    for (const Coin& coin : vCoins)
+        nSum += coin.out.nValue * CSupplyIndex::GetWeightRatio(nHeight - static_cast<int>(coin.nHeight), nBlocksPerMonth) / 100LL;
+    return nSum;
+}
+
+BOOST_AUTO_TEST_CASE(supply_bucket_weights)
+{
+    CSupplyBucket bucket;
+    std::vector<CAmount> vValues;
+    for (int i = 0; i < 200; i++) {
+        vValues.push_back(InsecureRandRange(1000 * COIN));
+        bucket.Add(vValues.back());
+    }
+
+    for (int64_t nRatio = 0; nRatio <= 100; nRatio++) {
+        CAmount nExpected = 0;
+        for (const CAmount nValue : vValues)
+            nExpected += nValue * nRatio / 100;
+        BOOST_CHECK_EQUAL(bucket.GetWeightedValue(nRatio), nExpected);
+    }
+
+    for (const CAmount nValue : vValues)
+        BOOST_CHECK(bucket.Remove(nValue));
+    BOOST_CHECK(bucket.IsEmpty());
+    BOOST_CHECK_EQUAL(bucket.GetWeightedValue(100), 0);
+}
+
+BOOST_AUTO_TEST_CASE(supply_index_connect_disconnect)
+{
+    const int64_t nBlocksPerMonth = MONTH_IN_SECONDS / Params().GetConsensus().nTargetSpacing;
+    const int nHeight = 20 * nBlocksPerMonth;
+
+    CSupplyIndex index;
+    BOOST_CHECK(index.Load(UINT256_ZERO));
+
+    // a first block bringing the coins of the whole history
+    uint256 hash1 = InsecureRand256(), hash2 = InsecureRand256();
+    CBlockIndex index1, index2;
+    index1.phashBlock = &hash1;
+    index1.nHeight = nHeight;
+    index2.phashBlock = &hash2;
+    index2.pprev = &index1;
+    index2.nHeight = nHeight + 1;
+
+    std::vector<Coin> vCoins;
+    CSupplyDelta delta1;
+    for (int i = 0; i < 2000; i++) {
+        vCoins.emplace_back(CTxOut(InsecureRandRange(10000 * COIN), CScript()), InsecureRandRange(nHeight + 1), false, false);
+        delta1.AddCoin(COutPoint(), vCoins.back());
+    }
+    BOOST_CHECK(index.ConnectBlock(delta1, &index1));
+    BOOST_CHECK(index.IsSynced(hash1));
+    for (int i = 0; i < 10; i++) {
+        const int nTarget = nHeight + InsecureRandRange(nBlocksPerMonth);
+        BOOST_CHECK_EQUAL(index.GetCirculatingSupply(nTarget), GetWeightedSum(vCoins, nTarget));
+    }
+
+    // a second block spending half of them
+    std::vector<Coin> vCoinsLeft;
+    CSupplyDelta delta2;
+    for (const Coin& coin : vCoins) {
+        if (InsecureRandBool())
+            delta2.SpendCoin(COutPoint(), coin);
+        else
+            vCoinsLeft.push_back(coin);
+    }
+    BOOST_CHECK(index.ConnectBlock(delta2, &index2));
+    BOOST_CHECK(index.IsSynced(hash2));
+    BOOST_CHECK_EQUAL(index.GetCirculatingSupply(nHeight + 1), GetWeightedSum(vCoinsLeft, nHeight + 1));
+
+    // a block not built on the index best block puts it out of sync
+    CSupplyDelta delta3;
+    BOOST_CHECK(!index.ConnectBlock(delta3, &index1));
+    BOOST_CHECK(!index.IsSynced(hash2));
+}
+
+BOOST_AUTO_TEST_CASE(supply_index_disconnect)
+{
+    const int64_t nBlocksPerMonth = MONTH_IN_SECONDS / Params().GetConsensus().nTargetSpacing;
+    const int nHeight = 4 * nBlocksPerMonth;
+
+    CSupplyIndex index;
+    BOOST_CHECK(index.Load(UINT256_ZERO));
+
+    uint256 hash1 = InsecureRand256(), hash2 = InsecureRand256();
+    CBlockIndex index1, index2;
+    index1.phashBlock = &hash1;
+    index1.nHeight = nHeight;
+    index2.phashBlock = &hash2;
+    index2.pprev = &index1;
+    index2.nHeight = nHeight + 1;
+
+    std::vector<Coin> vCoins;
+    CSupplyDelta delta1;
+    for (int i = 0; i < 100; i++) {
+        vCoins.emplace_back(CTxOut(InsecureRandRange(10000 * COIN), CScript()), InsecureRandRange(nHeight + 1), false, false);
+        delta1.AddCoin(COutPoint(), vCoins.back());
+    }
+    BOOST_CHECK(index.ConnectBlock(delta1, &index1));
+    const CAmount nSupply = index.GetCirculatingSupply(nHeight + 1);
+
+    // connect a block spending a coin and creating another one, then undo it
+    const Coin coinNew(CTxOut(vCoins[0].out.nValue + COIN, CScript()), nHeight + 1, false, false);
+    CSupplyDelta delta2, delta2Undo;
+    delta2.SpendCoin(COutPoint(), vCoins[0]);
+    delta2.AddCoin(COutPoint(), coinNew);
+    delta2Undo.SpendCoin(COutPoint(), coinNew);
+    delta2Undo.AddCoin(COutPoint(), vCoins[0]);
+    BOOST_CHECK(index.ConnectBlock(delta2, &index2));
+    BOOST_CHECK(index.GetCirculatingSupply(nHeight + 1) != nSupply);
+    BOOST_CHECK(index.DisconnectBlock(delta2Undo, &index2));
+    BOOST_CHECK(index.IsSynced(hash1));
+    BOOST_CHECK_EQUAL(index.GetCirculatingSupply(nHeight + 1), nSupply);
+
+    // spending an unknown coin puts the index out of sync
+    CSupplyDelta delta3;
+    delta3.SpendCoin(COutPoint(), coinNew);
+    BOOST_CHECK(!index.ConnectBlock(delta3, &index2));
+    BOOST_CHECK(!index.IsSynced(hash1));
+}
+
+BOOST_AUTO_TEST_CASE(supply_index_burn_balances)
+{
+    const auto& burn = *Params().GetConsensus().mBurnAddresses.begin();
+    const CScript scriptBurn = GetScriptForDestination(DecodeDestination(burn.first));
+
+    CSupplyIndex index;
+    BOOST_CHECK(index.Load(UINT256_ZERO));
+
+    uint256 hash1 = InsecureRand256(), hash2 = InsecureRand256();
+    CBlockIndex index1, index2;
+    index1.phashBlock = &hash1;
+    index1.nHeight = burn.second + 1;
+    index2.phashBlock = &hash2;
+    index2.pprev = &index1;
+    index2.nHeight = burn.second + 2;
+
+    const Coin coinBurn1(CTxOut(10 * COIN, scriptBurn), index1.nHeight, false, false);
+    const Coin coinBurn2(CTxOut(5 * COIN, scriptBurn), index1.nHeight, false, false);
+    const Coin coinOther(CTxOut(7 * COIN, CScript()), index1.nHeight, false, false);
+    CSupplyDelta delta1;
+    delta1.AddCoin(COutPoint(), coinBurn1);
+    delta1.AddCoin(COutPoint(), coinBurn2);
+    delta1.AddCoin(COutPoint(), coinOther);
+    BOOST_CHECK(index.ConnectBlock(delta1, &index1));
+    BOOST_CHECK_EQUAL(index.GetBurnBalances().size(), 1);
+    BOOST_CHECK_EQUAL(index.GetBurnBalances().at(burn.first), 15 * COIN);
+
+    // the burnt coins are out of the circulating supply
+    BOOST_CHECK_EQUAL(index.GetCirculatingSupply(index2.nHeight), 7 * COIN);
+
+    CSupplyDelta delta2;
+    delta2.SpendCoin(COutPoint(), coinBurn2);
+    BOOST_CHECK(index.ConnectBlock(delta2, &index2));
+    BOOST_CHECK_EQUAL(index.GetBurnBalances().at(burn.first), 10 * COIN);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
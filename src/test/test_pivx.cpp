@@ -49,7 +49,8 @@ TestingSetup::TestingSetup()
         mapArgs["-datadir"] = pathTemp.string();
         pblocktree = new CBlockTreeDB(1 << 20, true);
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
-        pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        pcoinswriter = new CCoinsViewDBWriter(pcoinsdbview, pcoinsdbview, nDefaultDbBatchSize);
+        pcoinsTip = new CCoinsViewCache(pcoinswriter);
         InitBlockIndex();
         {
             CValidationState state;
@@ -71,6 +72,7 @@ TestingSetup::~TestingSetup()
         threadGroup.join_all();
         UnloadBlockIndex();
         delete pcoinsTip;
+        delete pcoinswriter;
         delete pcoinsdbview;
         delete pblocktree;
         fs::remove_all(pathTemp);
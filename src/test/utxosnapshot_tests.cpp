@@ -0,0 +1,121 @@
+// Copyright (c) 2024 The DECENOMY Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "coins.h"
+#include "random.h"
+#include "txdb.h"
+#include "utxosnapshot.h"
+#include "test/test_pivx.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(utxosnapshot_tests, TestingSetup)
+
+/** Cursor over coins held in memory, like the chainstate cursor would return them */
+class CCoinsMapCursor : public CCoinsViewCursor
+{
+private:
+    const std::map<COutPoint, Coin>& mapCoins;
+    std::map<COutPoint, Coin>::const_iterator it;
+
+public:
+    CCoinsMapCursor(const uint256& hashBlock, const std::map<COutPoint, Coin>& mapCoinsIn) : CCoinsViewCursor(hashBlock), mapCoins(mapCoinsIn), it(mapCoinsIn.begin()) {}
+
+    bool GetKey(COutPoint& key) const override { key = it->first; return true; }
+    bool GetValue(Coin& coin) const override { coin = it->second; return true; }
+    unsigned int GetValueSize() const override { return 0; }
+    bool Valid() const override { return it != mapCoins.end(); }
+    void Next() override { ++it; }
+};
+
+static std::map<COutPoint, Coin> BuildCoins(size_t nCount)
+{
+    std::map<COutPoint, Coin> mapCoins;
+    while (mapCoins.size() < nCount) {
+        CScript script;
+        script << ToByteVector(InsecureRand256());
+        mapCoins.emplace(COutPoint(InsecureRand256(), InsecureRandRange(10)),
+            Coin(CTxOut(InsecureRandRange(1000 * COIN), script), InsecureRandRange(100000), InsecureRandBool(), false));
+    }
+    return mapCoins;
+}
+
+BOOST_AUTO_TEST_CASE(utxosnapshot_roundtrip)
+{
+    // more than a chunk, the last one being partial
+    const std::map<COutPoint, Coin> mapCoins = BuildCoins(SNAPSHOT_CHUNK_COINS + 123);
+    const uint256 hashGenesis = Params().GetConsensus().hashGenesisBlock;
+    const fs::path path = GetDataDir() / "utxo.dat";
+
+    CCoinsMapCursor cursor(hashGenesis, mapCoins);
+    CUTXOSnapshotMetadata metadata;
+    uint64_t nCoins;
+    uint256 hashSnapshot;
+    std::string strError;
+    BOOST_CHECK(CUTXOSnapshot::Dump(&cursor, 0, path, metadata, nCoins, hashSnapshot, strError));
+    BOOST_CHECK_EQUAL(nCoins, mapCoins.size());
+    BOOST_CHECK(metadata.hashBase == hashGenesis);
+
+    CUTXOSnapshotMetadata metadata2;
+    uint64_t nCoins2;
+    uint256 hashSnapshot2;
+    BOOST_CHECK(CUTXOSnapshot::ReadMetadata(path, metadata2, strError));
+    BOOST_CHECK(metadata2.hashBase == hashGenesis);
+    BOOST_CHECK(CUTXOSnapshot::Verify(path, metadata2, nCoins2, hashSnapshot2, strError));
+    BOOST_CHECK_EQUAL(nCoins2, nCoins);
+    BOOST_CHECK(hashSnapshot2 == hashSnapshot);
+
+    // a snapshot which isn't the one expected is refused before anything is written
+    CCoinsViewDB view(1 << 20, true, true);
+    BOOST_CHECK(!CUTXOSnapshot::Load(&view, path, GetRandHash(), strError));
+    BOOST_CHECK(view.GetBestBlock().IsNull());
+    {
+        std::unique_ptr<CCoinsViewCursor> pcursor(view.Cursor());
+        BOOST_CHECK(!pcursor->Valid());
+    }
+
+    BOOST_CHECK(CUTXOSnapshot::Load(&view, path, hashSnapshot, strError));
+    BOOST_CHECK(view.GetBestBlock() == hashGenesis);
+    for (const auto& entry : mapCoins) {
+        Coin coin;
+        BOOST_CHECK(view.GetCoin(entry.first, coin));
+        BOOST_CHECK(coin.out == entry.second.out);
+        BOOST_CHECK_EQUAL(coin.nHeight, entry.second.nHeight);
+        BOOST_CHECK_EQUAL(coin.fCoinBase, entry.second.fCoinBase);
+    }
+
+    // a chainstate which isn't empty is left alone
+    BOOST_CHECK(!CUTXOSnapshot::Load(&view, path, hashSnapshot, strError));
+}
+
+BOOST_AUTO_TEST_CASE(utxosnapshot_corrupted)
+{
+    const std::map<COutPoint, Coin> mapCoins = BuildCoins(100);
+    const fs::path path = GetDataDir() / "utxo_corrupted.dat";
+
+    CCoinsMapCursor cursor(Params().GetConsensus().hashGenesisBlock, mapCoins);
+    CUTXOSnapshotMetadata metadata;
+    uint64_t nCoins;
+    uint256 hashSnapshot;
+    std::string strError;
+    BOOST_CHECK(CUTXOSnapshot::Dump(&cursor, 0, path, metadata, nCoins, hashSnapshot, strError));
+
+    // flip a byte of a coin
+    FILE* file = fsbridge::fopen(path, "r+b");
+    BOOST_REQUIRE(file);
+    fseek(file, fs::file_size(path) / 2, SEEK_SET);
+    int ch = fgetc(file);
+    fseek(file, fs::file_size(path) / 2, SEEK_SET);
+    fputc(ch ^ 0x01, file);
+    fclose(file);
+
+    BOOST_CHECK(!CUTXOSnapshot::Verify(path, metadata, nCoins, hashSnapshot, strError));
+
+    CCoinsViewDB view(1 << 20, true, true);
+    BOOST_CHECK(!CUTXOSnapshot::Load(&view, path, hashSnapshot, strError));
+    BOOST_CHECK(view.GetBestBlock().IsNull());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
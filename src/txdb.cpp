@@ -8,8 +8,10 @@
 #include "txdb.h"
 
 #include "main.h"
+#include "memusage.h"
 #include "pow.h"
 #include "uint256.h"
+#include "util/threadnames.h"
 
 #include <stdint.h>
 
@@ -19,9 +21,11 @@ static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
+static const char DB_PAID_PAYEE = 'p';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
+static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
@@ -92,14 +96,215 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
         CCoinsMap::iterator itOld = it++;
         mapCoins.erase(itOld);
     }
-    if (!hashBlock.IsNull())
+    if (!hashBlock.IsNull()) {
+        batch.Erase(DB_HEAD_BLOCKS);
         batch.Write(DB_BEST_BLOCK, hashBlock);
+    }
 
     bool ret = db.WriteBatch(batch);
     LogPrint(BCLog::COINDB, "Committed %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return ret;
 }
 
+std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const
+{
+    std::vector<uint256> vhashHeadBlocks;
+    if (!db.Read(DB_HEAD_BLOCKS, vhashHeadBlocks))
+        return std::vector<uint256>();
+    return vhashHeadBlocks;
+}
+
+bool CCoinsViewDB::BatchWriteInParts(const CCoinsMap& mapCoins, const uint256& hashOld, const uint256& hashBlock, size_t nBatchSize,
+                                     const std::function<void(CCoinsMap::const_iterator, CCoinsMap::const_iterator)>& fnWritten)
+{
+    CDBBatch batch;
+    size_t count = 0;
+    size_t changed = 0;
+    size_t batches = 1;
+
+    // The coins are partially written until the head blocks are erased
+    batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, hashOld});
+
+    CCoinsMap::const_iterator itBatch = mapCoins.begin();
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end();) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            CoinEntry entry(&it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
+            else
+                batch.Write(entry, it->second.coin);
+            changed++;
+        }
+        count++;
+        ++it;
+        if (batch.SizeEstimate() > nBatchSize) {
+            if (!db.WriteBatch(batch))
+                return false;
+            fnWritten(itBatch, it);
+            itBatch = it;
+            batch.Clear();
+            batches++;
+        }
+    }
+    batch.Erase(DB_HEAD_BLOCKS);
+    batch.Write(DB_BEST_BLOCK, hashBlock);
+
+    if (!db.WriteBatch(batch))
+        return false;
+    fnWritten(itBatch, mapCoins.end());
+    LogPrint(BCLog::COINDB, "Committed %u changed transaction outputs (out of %u) to coin database in %u batches...\n", (unsigned int)changed, (unsigned int)count, (unsigned int)batches);
+    return true;
+}
+
+CCoinsViewDBWriter::CCoinsViewDBWriter(CCoinsView* viewIn, CCoinsViewDB* dbIn, size_t nBatchSizeIn) : CCoinsViewBacked(viewIn), db(dbIn), nBatchSize(nBatchSizeIn), nPendingCoinsUsage(0), fWriteFailed(false)
+{
+}
+
+CCoinsViewDBWriter::~CCoinsViewDBWriter()
+{
+    Sync();
+}
+
+bool CCoinsViewDBWriter::GetCoin(const COutPoint& outpoint, Coin& coin) const
+{
+    {
+        LOCK(cs_pending);
+        CCoinsMap::const_iterator it = mapPending.find(outpoint);
+        if (it != mapPending.end()) {
+            coin = it->second.coin;
+            return !coin.IsSpent();
+        }
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewDBWriter::HaveCoin(const COutPoint& outpoint) const
+{
+    {
+        LOCK(cs_pending);
+        CCoinsMap::const_iterator it = mapPending.find(outpoint);
+        if (it != mapPending.end())
+            return !it->second.coin.IsSpent();
+    }
+    return base->HaveCoin(outpoint);
+}
+
+uint256 CCoinsViewDBWriter::GetBestBlock() const
+{
+    {
+        LOCK(cs_pending);
+        if (!hashPending.IsNull())
+            return hashPending;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewDBWriter::IsForward(const uint256& hashOld, const uint256& hashBlock)
+{
+    // the first write of the chainstate is replayed from the genesis block
+    if (hashOld.IsNull())
+        return true;
+
+    LOCK(cs_main);
+    BlockMap::const_iterator itOld = mapBlockIndex.find(hashOld);
+    BlockMap::const_iterator itNew = mapBlockIndex.find(hashBlock);
+    if (itOld == mapBlockIndex.end() || itNew == mapBlockIndex.end())
+        return false;
+    return itNew->second->GetAncestor(itOld->second->nHeight) == itOld->second;
+}
+
+bool CCoinsViewDBWriter::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+{
+    // one write at a time, and what is written next must be on top of it
+    if (!Sync())
+        return false;
+
+    const uint256 hashOld = base->GetBestBlock();
+    if (nBatchSize == 0 || hashBlock.IsNull() || !IsForward(hashOld, hashBlock))
+        return base->BatchWrite(mapCoins, hashBlock);
+
+    size_t nCoinsUsage = 0;
+    for (const auto& entry : mapCoins)
+        nCoinsUsage += entry.second.coin.DynamicMemoryUsage();
+    {
+        LOCK(cs_pending);
+        mapPending.swap(mapCoins);
+        nPendingCoinsUsage = nCoinsUsage;
+        hashPending = hashBlock;
+    }
+    threadWriter = boost::thread(&CCoinsViewDBWriter::ThreadWrite, this, hashOld);
+    return true;
+}
+
+void CCoinsViewDBWriter::ThreadWrite(const uint256& hashOld)
+{
+    util::ThreadRename("pivx-coinswrite");
+    const int64_t nStart = GetTimeMillis();
+    const uint256 hashBlock = WITH_LOCK(cs_pending, return hashPending);
+
+    // Only this thread changes the map from now on, so it is read without the
+    // lock and the readers are only kept out while the written coins are erased
+    bool fOk = false;
+    try {
+        fOk = db->BatchWriteInParts(mapPending, hashOld, hashBlock, nBatchSize,
+            [this](CCoinsMap::const_iterator itBegin, CCoinsMap::const_iterator itEnd) {
+                size_t nCoinsUsage = 0;
+                for (CCoinsMap::const_iterator it = itBegin; it != itEnd; ++it)
+                    nCoinsUsage += it->second.coin.DynamicMemoryUsage();
+                LOCK(cs_pending);
+                mapPending.erase(itBegin, itEnd);
+                nPendingCoinsUsage -= nCoinsUsage;
+            });
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+
+    {
+        LOCK(cs_pending);
+        if (fOk) {
+            hashPending.SetNull();
+        } else {
+            // keep the coins readable, the node is going to stop
+            fWriteFailed = true;
+        }
+    }
+    condWritten.notify_all();
+    LogPrint(BCLog::COINDB, "%s: chainstate at %s written in %dms\n", __func__, hashBlock.GetHex(), GetTimeMillis() - nStart);
+}
+
+void CCoinsViewDBWriter::WaitForWrite() const
+{
+    WAIT_LOCK(cs_pending, lock);
+    condWritten.wait(lock, [this] { return hashPending.IsNull() || fWriteFailed; });
+}
+
+bool CCoinsViewDBWriter::Sync()
+{
+    WaitForWrite();
+    if (threadWriter.joinable())
+        threadWriter.join();
+    LOCK(cs_pending);
+    return !fWriteFailed;
+}
+
+bool CCoinsViewDBWriter::IsWriting() const
+{
+    LOCK(cs_pending);
+    return !hashPending.IsNull() && !fWriteFailed;
+}
+
+CCoinsViewCursor* CCoinsViewDBWriter::Cursor() const
+{
+    WaitForWrite();
+    return base->Cursor();
+}
+
+size_t CCoinsViewDBWriter::DynamicMemoryUsage() const
+{
+    LOCK(cs_pending);
+    return memusage::DynamicUsage(mapPending) + nPendingCoinsUsage;
+}
+
 size_t CCoinsViewDB::EstimateSize() const
 {
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
@@ -226,6 +431,21 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadPaidPayee(const uint256& hashBlock, CScript& payee, CAmount& nAmount)
+{
+    CTxOut out;
+    if (!Read(std::make_pair(DB_PAID_PAYEE, hashBlock), out))
+        return false;
+    payee = out.scriptPubKey;
+    nAmount = out.nValue;
+    return true;
+}
+
+bool CBlockTreeDB::WritePaidPayee(const uint256& hashBlock, const CScript& payee, CAmount nAmount)
+{
+    return Write(std::make_pair(DB_PAID_PAYEE, hashBlock), CTxOut(nAmount, payee));
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string& name, bool fValue)
 {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
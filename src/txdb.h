@@ -11,13 +11,17 @@
 #include "coins.h"
 #include "chain.h"
 #include "dbwrapper.h"
+#include "sync.h"
 
+#include <condition_variable>
+#include <functional>
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
 
 class CCoinsViewDBCursor;
 class uint256;
@@ -33,6 +37,10 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -dbbatchsize default (bytes), size of the coin database batches written in the background
+static const int64_t nDefaultDbBatchSize = 16 << 20;
+//! -dbbackgroundflush default
+static const bool DEFAULT_DB_BACKGROUND_FLUSH = true;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -81,6 +89,73 @@ public:
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
+
+    //! The new and old best blocks of a write in parts which didn't complete, empty if none
+    std::vector<uint256> GetHeadBlocks() const;
+
+    /**
+     * Write the dirty coins of mapCoins in batches of about nBatchSize bytes,
+     * moving the best block from hashOld to hashBlock. Until the last batch,
+     * the head blocks mark the database as partially written, and the blocks
+     * from hashOld to hashBlock are replayed on startup (see ReplayBlocks).
+     * fnWritten is called with each range of mapCoins once it is on disk.
+     */
+    bool BatchWriteInParts(const CCoinsMap& mapCoins, const uint256& hashOld, const uint256& hashBlock, size_t nBatchSize,
+                           const std::function<void(CCoinsMap::const_iterator, CCoinsMap::const_iterator)>& fnWritten);
+};
+
+/**
+ * Layer between the coins cache and the coin database, writing the flushes of
+ * the cache in the background. A flush hands its map over in constant time, so
+ * the cache above starts again empty and validation goes on while the map is
+ * written in bounded batches without cs_main. The coins not on disk yet keep
+ * serving the reads, and each batch leaves memory once it is written.
+ *
+ * Only flushes moving the chainstate forward are written in the background,
+ * as an interrupted one is completed on startup by replaying its blocks. The
+ * others, and all of them when nBatchSize is 0, are written at once.
+ */
+class CCoinsViewDBWriter : public CCoinsViewBacked
+{
+private:
+    CCoinsViewDB* db;
+    //! Size of the background batches, 0 to write everything at once
+    const size_t nBatchSize;
+
+    mutable Mutex cs_pending;
+    mutable std::condition_variable condWritten;
+    //! Coins handed over by the last flush which are not on disk yet
+    CCoinsMap mapPending;
+    //! Memory used by the coins of mapPending, beside the map itself
+    size_t nPendingCoinsUsage;
+    //! Best block of the background write, null when there is none
+    uint256 hashPending;
+    //! A background write failed, the next flush reports it
+    bool fWriteFailed;
+    boost::thread threadWriter;
+
+    void ThreadWrite(const uint256& hashOld);
+    //! Wait for the background write to be on disk
+    void WaitForWrite() const;
+    //! Whether hashBlock descends from hashOld, so a write between them can be replayed
+    static bool IsForward(const uint256& hashOld, const uint256& hashBlock);
+
+public:
+    CCoinsViewDBWriter(CCoinsView* viewIn, CCoinsViewDB* dbIn, size_t nBatchSizeIn);
+    ~CCoinsViewDBWriter();
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const override;
+    bool HaveCoin(const COutPoint& outpoint) const override;
+    uint256 GetBestBlock() const override;
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override;
+    CCoinsViewCursor* Cursor() const override;
+
+    //! Whether a flush is being written in the background
+    bool IsWriting() const;
+    //! Wait for the last flush to be on disk, returning whether all the writes succeeded
+    bool Sync();
+    //! Memory used by the coins not written yet, part of the coins cache budget
+    size_t DynamicMemoryUsage() const;
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -125,6 +200,8 @@ public:
     bool ReadReindexing(bool& fReindex);
     bool ReadTxIndex(const uint256& txid, CDiskTxPos& pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >& list);
+    bool ReadPaidPayee(const uint256& hashBlock, CScript& payee, CAmount& nAmount);
+    bool WritePaidPayee(const uint256& hashBlock, const CScript& payee, CAmount nAmount);
     bool WriteFlag(const std::string& name, bool fValue);
     bool ReadFlag(const std::string& name, bool& fValue);
     bool WriteInt(const std::string& name, int nValue);
@@ -87,6 +87,12 @@ struct uint256CheapHasher {
     }
 };
 
+struct uint160CheapHasher {
+    uint64_t operator()(const uint160& i) const {
+        return i.GetCheapHash();
+    }
+};
+
 /** 512-bit unsigned big integer. */
 class uint512 : public base_uint<512>
 {
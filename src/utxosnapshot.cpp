@@ -0,0 +1,290 @@
+// Copyright (c) 2024 The DECENOMY Core Developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "utxosnapshot.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "coins.h"
+#include "hash.h"
+#include "main.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <boost/thread.hpp>
+
+namespace {
+
+const std::string strSnapshotMagic = "UTXOSnapshot";
+
+//! Write bytes to the snapshot file and to the running hash of its content
+void WriteHashed(CAutoFile& fileout, CHashWriter& hasher, CDataStream& ss)
+{
+    hasher.write(&ss[0], ss.size());
+    fileout.write(&ss[0], ss.size());
+    ss.clear();
+}
+
+template <typename Stream>
+bool ReadHeader(Stream& s, CUTXOSnapshotMetadata& metadata, std::string& strError)
+{
+    std::string strMagic;
+    unsigned char pchMsgTmp[4];
+    s >> LIMITED_STRING(strMagic, 32);
+    if (strMagic != strSnapshotMagic) {
+        strError = "not a UTXO snapshot file";
+        return false;
+    }
+    s >> FLATDATA(pchMsgTmp);
+    if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
+        strError = "UTXO snapshot of another network";
+        return false;
+    }
+    s >> metadata;
+    if (metadata.nVersion != CUTXOSnapshotMetadata::CURRENT_VERSION) {
+        strError = strprintf("unsupported UTXO snapshot version %u", metadata.nVersion);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Stream a snapshot file, checking its format and its hash. The coins of every
+ * chunk are written to view when there is one, without moving its best block.
+ */
+bool ReadSnapshot(const fs::path& path, CCoinsViewDB* view, CUTXOSnapshotMetadata& metadata, uint64_t& nCoins, uint256& hashSnapshot, std::string& strError)
+{
+    FILE* file = fsbridge::fopen(path, "rb");
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        strError = strprintf("failed to open file %s", path.string());
+        return false;
+    }
+
+    CHashVerifier<CAutoFile> verifier(&filein);
+    nCoins = 0;
+    try {
+        if (!ReadHeader(verifier, metadata, strError))
+            return false;
+
+        CCoinsMap mapCoins;
+        while (true) {
+            boost::this_thread::interruption_point();
+
+            uint32_t nCount;
+            verifier >> nCount;
+            if (nCount == 0)
+                break;
+            if (nCount > SNAPSHOT_CHUNK_COINS) {
+                strError = strprintf("invalid chunk of %u coins", nCount);
+                return false;
+            }
+
+            for (uint32_t i = 0; i < nCount; i++) {
+                COutPoint outpoint;
+                Coin coin;
+                verifier >> outpoint;
+                verifier >> coin;
+                if (coin.IsSpent()) {
+                    strError = strprintf("spent coin %s", outpoint.ToString());
+                    return false;
+                }
+                if (view) {
+                    CCoinsCacheEntry& entry = mapCoins[outpoint];
+                    entry.coin = std::move(coin);
+                    entry.flags = CCoinsCacheEntry::DIRTY;
+                }
+            }
+            nCoins += nCount;
+
+            if (view && !view->BatchWrite(mapCoins, UINT256_ZERO)) {
+                strError = "failed to write the coins database";
+                return false;
+            }
+        }
+
+        uint64_t nCoinsIn;
+        verifier >> nCoinsIn;
+        if (nCoinsIn != nCoins) {
+            strError = strprintf("%u coins read instead of %u", nCoins, nCoinsIn);
+            return false;
+        }
+
+        hashSnapshot = verifier.GetHash();
+        uint256 hashIn;
+        filein >> hashIn;
+        if (hashIn != hashSnapshot) {
+            strError = "checksum mismatch, data corrupted";
+            return false;
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("deserialize or I/O error - %s", e.what());
+        return false;
+    }
+
+    return true;
+}
+
+} // anonymous namespace
+
+bool CUTXOSnapshot::Dump(CCoinsViewCursor* pcursor, int nHeight, const fs::path& path, CUTXOSnapshotMetadata& metadata, uint64_t& nCoins, uint256& hashSnapshot, std::string& strError)
+{
+    int64_t nStart = GetTimeMillis();
+
+    metadata = CUTXOSnapshotMetadata();
+    metadata.hashBase = pcursor->GetBestBlock();
+    metadata.nHeight = nHeight;
+
+    // write to a temporary file, renamed once complete
+    fs::path pathTmp = path;
+    pathTmp += ".incomplete";
+    FILE* file = fsbridge::fopen(pathTmp, "wb");
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull()) {
+        strError = strprintf("failed to open file %s", pathTmp.string());
+        return false;
+    }
+
+    CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    nCoins = 0;
+    try {
+        ss << strSnapshotMagic;
+        ss << FLATDATA(Params().MessageStart());
+        ss << metadata;
+        WriteHashed(fileout, hasher, ss);
+
+        CDataStream ssCoins(SER_DISK, CLIENT_VERSION);
+        uint32_t nCount = 0;
+        while (true) {
+            const bool fEnd = !pcursor->Valid();
+            if (!fEnd) {
+                COutPoint key;
+                Coin coin;
+                if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+                    strError = "unable to read the coins database";
+                    return false;
+                }
+                ssCoins << key;
+                ssCoins << coin;
+                nCount++;
+                pcursor->Next();
+            }
+
+            if (nCount == SNAPSHOT_CHUNK_COINS || (fEnd && nCount > 0)) {
+                boost::this_thread::interruption_point();
+                ss << nCount;
+                ss.write(&ssCoins[0], ssCoins.size());
+                WriteHashed(fileout, hasher, ss);
+                ssCoins.clear();
+                nCoins += nCount;
+                nCount = 0;
+            }
+            if (fEnd)
+                break;
+        }
+
+        ss << (uint32_t)0;
+        ss << nCoins;
+        WriteHashed(fileout, hasher, ss);
+
+        hashSnapshot = hasher.GetHash();
+        fileout << hashSnapshot;
+    } catch (const std::exception& e) {
+        strError = strprintf("serialize or I/O error - %s", e.what());
+        return false;
+    }
+    FileCommit(fileout.Get());
+    fileout.fclose();
+
+    if (!RenameOver(pathTmp, path)) {
+        strError = "rename-into-place failed";
+        return false;
+    }
+
+    LogPrintf("%s: %u coins of block %s written to %s, hash %s  %dms\n", __func__,
+        nCoins, metadata.hashBase.GetHex(), path.string(), hashSnapshot.GetHex(), GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CUTXOSnapshot::ReadMetadata(const fs::path& path, CUTXOSnapshotMetadata& metadata, std::string& strError)
+{
+    FILE* file = fsbridge::fopen(path, "rb");
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        strError = strprintf("failed to open file %s", path.string());
+        return false;
+    }
+
+    try {
+        return ReadHeader(filein, metadata, strError);
+    } catch (const std::exception& e) {
+        strError = strprintf("deserialize or I/O error - %s", e.what());
+        return false;
+    }
+}
+
+bool CUTXOSnapshot::Verify(const fs::path& path, CUTXOSnapshotMetadata& metadata, uint64_t& nCoins, uint256& hashSnapshot, std::string& strError)
+{
+    return ReadSnapshot(path, nullptr, metadata, nCoins, hashSnapshot, strError);
+}
+
+bool CUTXOSnapshot::Load(CCoinsViewDB* view, const fs::path& path, const uint256& hashExpected, std::string& strError)
+{
+    int64_t nStart = GetTimeMillis();
+
+    {
+        std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+        if (!view->GetBestBlock().IsNull() || pcursor->Valid()) {
+            strError = "the chainstate is not empty";
+            return false;
+        }
+    }
+
+    CUTXOSnapshotMetadata metadata;
+    uint64_t nCoins;
+    uint256 hashSnapshot;
+    if (!Verify(path, metadata, nCoins, hashSnapshot, strError))
+        return false;
+    if (hashSnapshot != hashExpected) {
+        strError = strprintf("the snapshot hash %s is not the expected %s", hashSnapshot.GetHex(), hashExpected.GetHex());
+        return false;
+    }
+
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(metadata.hashBase);
+        if (it == mapBlockIndex.end() || it->second->nHeight != metadata.nHeight) {
+            strError = strprintf("the base block %s of the snapshot is not in the block index", metadata.hashBase.GetHex());
+            return false;
+        }
+        if (!(it->second->nStatus & BLOCK_HAVE_DATA) || it->second->nChainTx == 0) {
+            strError = strprintf("the blocks up to the base block %s of the snapshot are missing", metadata.hashBase.GetHex());
+            return false;
+        }
+    }
+
+    LogPrintf("%s: loading %u coins of block %s (height %d), hash %s\n", __func__,
+        nCoins, metadata.hashBase.GetHex(), metadata.nHeight, hashSnapshot.GetHex());
+
+    uint64_t nCoinsLoaded;
+    uint256 hashLoaded;
+    if (!ReadSnapshot(path, view, metadata, nCoinsLoaded, hashLoaded, strError) || hashLoaded != hashSnapshot) {
+        if (strError.empty())
+            strError = "the snapshot changed while it was loaded";
+        strError += ", the chainstate directory has to be removed";
+        return false;
+    }
+
+    // the best block makes the coins a chainstate
+    CCoinsMap mapEmpty;
+    if (!view->BatchWrite(mapEmpty, metadata.hashBase)) {
+        strError = "failed to write the coins database best block";
+        return false;
+    }
+
+    LogPrintf("%s: chainstate loaded at block %s  %dms\n", __func__, metadata.hashBase.GetHex(), GetTimeMillis() - nStart);
+    return true;
+}
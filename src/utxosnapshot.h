@@ -0,0 +1,77 @@
+// Copyright (c) 2024 The DECENOMY Core Developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef UTXOSNAPSHOT_H
+#define UTXOSNAPSHOT_H
+
+#include "fs.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <string>
+
+class CCoinsViewCursor;
+class CCoinsViewDB;
+
+//! Number of coins serialized together in a snapshot chunk
+static const unsigned int SNAPSHOT_CHUNK_COINS = 50000;
+
+/** What a UTXO set snapshot file is made of, read back from its header */
+class CUTXOSnapshotMetadata
+{
+public:
+    static const uint32_t CURRENT_VERSION = 1;
+
+    uint32_t nVersion;
+    //! block the coins are the UTXO set of
+    uint256 hashBase;
+    int nHeight;
+
+    CUTXOSnapshotMetadata() : nVersion(CURRENT_VERSION), nHeight(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(nVersion);
+        READWRITE(hashBase);
+        READWRITE(nHeight);
+    }
+};
+
+/**
+ * A UTXO set snapshot, written by dumptxoutset from a node and loaded with
+ * -loadtxoutset into the empty chainstate of a node which has the blocks up
+ * to its base block, so it doesn't have to connect them all again.
+ *
+ * The file is streamed: a magic message, the network magic and the metadata,
+ * then chunks of up to SNAPSHOT_CHUNK_COINS (outpoint, coin) pairs each preceded
+ * by its coin count, an empty chunk, the total number of coins and, last, the
+ * hash of everything before it. The coins keep their compressed chainstate
+ * serialization.
+ */
+class CUTXOSnapshot
+{
+public:
+    /** Write the coins of a chainstate cursor to path, returning the snapshot hash */
+    static bool Dump(CCoinsViewCursor* pcursor, int nHeight, const fs::path& path, CUTXOSnapshotMetadata& metadata, uint64_t& nCoins, uint256& hashSnapshot, std::string& strError);
+
+    /** Read the metadata of a snapshot file, without checking the rest of it */
+    static bool ReadMetadata(const fs::path& path, CUTXOSnapshotMetadata& metadata, std::string& strError);
+
+    /** Stream a whole snapshot file, checking its chunks and its hash */
+    static bool Verify(const fs::path& path, CUTXOSnapshotMetadata& metadata, uint64_t& nCoins, uint256& hashSnapshot, std::string& strError);
+
+    /**
+     * Write the coins of a snapshot file into an empty chainstate. The file is
+     * verified first, against the hash dumptxoutset returned for it as its own
+     * checksum proves nothing about where it came from, and the best block is
+     * only written once all the coins are, so a failure never leaves a
+     * chainstate looking complete.
+     */
+    static bool Load(CCoinsViewDB* view, const fs::path& path, const uint256& hashExpected, std::string& strError);
+};
+
+#endif
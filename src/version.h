@@ -12,7 +12,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 70229;
+static const int PROTOCOL_VERSION = 70230;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -36,5 +36,8 @@ static const int MEMPOOL_GD_VERSION = 60002;
 //! "filter*" commands are disabled without NODE_BLOOM after and including this version
 static const int NO_BLOOM_VERSION = 70201;
 
+//! "sendcmpct", "cmpctblock", "getblocktxn" and "blocktxn" messages, compact block relay, starting with this version
+static const int COMPACT_BLOCKS_VERSION = 70230;
+
 
 #endif // BITCOIN_VERSION_H
@@ -471,4 +471,62 @@ BOOST_AUTO_TEST_CASE(cached_balances_tests)
 
 }
 
+BOOST_AUTO_TEST_CASE(available_coins_index_tests)
+{
+    CWallet &wallet = *pwalletMain;
+    LOCK2(cs_main, wallet.cs_wallet);
+    wallet.SetMinVersion(FEATURE_PRE_SPLIT_KEYPOOL);
+    wallet.SetupSPKM(false);
+
+    // Receive three coins, and one paying somebody else
+    CTxDestination receivingAddr;
+    BOOST_ASSERT(wallet.getNewAddress(receivingAddr, "receiving_address").result);
+    CKey key;
+    key.MakeNewKey(true);
+    CTxOut creditOut(5 * COIN, GetScriptForDestination(receivingAddr));
+    CTxOut otherOut(5 * COIN, GetScriptForDestination(key.GetPubKey().GetID()));
+    CMutableTransaction mTx;
+    mTx.vin.emplace_back(CTxIn(COutPoint(uint256(), 999)));
+    mTx.vout = {creditOut, otherOut, creditOut, creditOut};
+    CWalletTx wtxIn(&wallet, CTransaction(mTx));
+    BOOST_CHECK(wallet.AddToWallet(wtxIn));
+    CWalletTx& wtxCredit = wallet.mapWallet[wtxIn.GetHash()];
+
+    // Unconfirmed, out of the mempool: nothing available
+    std::vector<COutput> vCoins;
+    BOOST_CHECK(!wallet.AvailableCoins(&vCoins));
+    BOOST_CHECK_EQUAL(wallet.mapSpendableCoins.size(), 3);
+
+    // Confirmed: only our three coins
+    SimpleFakeMine(wtxCredit);
+    BOOST_CHECK(wallet.AvailableCoins(&vCoins));
+    BOOST_CHECK_EQUAL(vCoins.size(), 3);
+    for (const COutput& out : vCoins) {
+        BOOST_CHECK(out.i != 1);
+        BOOST_CHECK(out.fSpendable);
+    }
+
+    // Locked coins are skipped
+    wallet.LockCoin(COutPoint(wtxCredit.GetHash(), 0));
+    BOOST_CHECK(wallet.AvailableCoins(&vCoins));
+    BOOST_CHECK_EQUAL(vCoins.size(), 2);
+    wallet.UnlockCoin(COutPoint(wtxCredit.GetHash(), 0));
+
+    // Spent coins too
+    std::vector<CTxIn> vinDebit = {CTxIn(COutPoint(wtxCredit.GetHash(), 2))};
+    BuildAndLoadTxToWallet(vinDebit, {otherOut}, wallet);
+    BOOST_CHECK(wallet.AvailableCoins(&vCoins));
+    BOOST_CHECK_EQUAL(vCoins.size(), 2);
+    BOOST_CHECK(wallet.AvailableCoins(nullptr));
+
+    // No coin of a masternode collateral value
+    BOOST_CHECK(!wallet.AvailableCoins(&vCoins, nullptr, ONLY_10000));
+
+    // Importing the key of the other coin makes it ours without a rescan
+    BOOST_CHECK(wallet.AddKeyPubKey(key, key.GetPubKey()));
+    BOOST_CHECK(wallet.AvailableCoins(&vCoins));
+    BOOST_CHECK_EQUAL(vCoins.size(), 3);
+    BOOST_CHECK_EQUAL(wallet.mapSpendableCoins.count(COutPoint(wtxCredit.GetHash(), 1)), 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -165,6 +165,7 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey& pubkey)
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    fWalletCoinsDirty = true;
 
     // TODO: Move the follow block entirely inside the spkm (including WriteKey to AddKeyPubKeyWithDB)
     // check if we need to remove from watch-only
@@ -227,6 +228,7 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    WITH_LOCK(cs_wallet, fWalletCoinsDirty = true);
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -251,6 +253,7 @@ bool CWallet::AddWatchOnly(const CScript& dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    WITH_LOCK(cs_wallet, fWalletCoinsDirty = true);
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
@@ -263,6 +266,7 @@ bool CWallet::RemoveWatchOnly(const CScript& dest)
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    fWalletCoinsDirty = true;
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
@@ -875,6 +879,9 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
     // Break debit/credit balance caches:
     wtx.MarkDirty();
 
+    // (Re)index its coins, they may be ours now after a rescan
+    AddToWalletCoins(wtx);
+
     // Notify UI of new or updated transaction
     NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
 
@@ -1080,6 +1087,8 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex,
     if (!AddToWalletIfInvolvingMe(tx, pindex, posInBlock, true))
         return; // Not one of ours
 
+    UpdateStakeCandidates(tx, pindex, posInBlock);
+
     // If a transaction changes 'conflicted' state, that changes the balance
     // available of the outputs it spends. So force those to be
     // recomputed, also:
@@ -1089,12 +1098,106 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex,
     }
 }
 
+void CWallet::UpdateStakeCandidates(const CTransaction& tx, const CBlockIndex* pindex, int posInBlock)
+{
+    AssertLockHeld(cs_wallet);
+    const uint256& hash = tx.GetHash();
+
+    if (!pindex || posInBlock == CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK) {
+        // Out of the chain: its outputs can't stake anymore. The coins it spent
+        // come back lazily, through GetStakeCandidate, if they are available again.
+        for (unsigned int i = 0; i < tx.vout.size(); i++)
+            mapStakeCandidates.erase(COutPoint(hash, i));
+        return;
+    }
+
+    BlockMap::const_iterator mi = mapBlockIndex.find(pindex->GetBlockHash());
+    if (mi == mapBlockIndex.end()) return;
+
+    for (const CTxIn& txin : tx.vin)
+        mapStakeCandidates.erase(txin.prevout);
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        if (tx.vout[i].nValue <= 0 || !(IsMine(tx.vout[i]) & ISMINE_SPENDABLE)) continue;
+        mapStakeCandidates[COutPoint(hash, i)] = CStakeCandidate{tx.vout[i], mi->second};
+    }
+}
+
+bool CWallet::GetStakeCandidate(const COutput& out, CStakeCandidate& candidateRet)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    const COutPoint outpoint(out.tx->GetHash(), out.i);
+    auto it = mapStakeCandidates.find(outpoint);
+    if (it != mapStakeCandidates.end() && chainActive.Contains(it->second.pindexFrom)) {
+        candidateRet = it->second;
+        return true;
+    }
+
+    // Not synced since the wallet was loaded, or reorganized: take it from the wallet tx
+    BlockMap::const_iterator mi = mapBlockIndex.find(out.tx->hashBlock);
+    if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second)) return false;
+    candidateRet = CStakeCandidate{out.tx->vout[out.i], mi->second};
+    mapStakeCandidates[outpoint] = candidateRet;
+    return true;
+}
+
+void CWallet::AddToWalletCoins(const CWalletTx& wtx) const
+{
+    AssertLockHeld(cs_wallet);
+    const uint256& hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        const COutPoint outpoint(hash, i);
+        const CTxOut& out = wtx.vout[i];
+        EraseFromWalletCoins(outpoint, out.nValue);
+
+        const isminetype mine = IsMine(out);
+        if (mine == ISMINE_NO || out.nValue <= 0) continue;
+
+        const CWalletCoin coin{&wtx, mine, IsSolvable(*this, out.scriptPubKey)};
+        if (mine & ISMINE_SPENDABLE)
+            mapSpendableCoins.emplace(outpoint, coin);
+        else
+            mapWatchOnlyCoins.emplace(outpoint, coin);
+        mapCoinsByValue.emplace(out.nValue, outpoint);
+    }
+}
+
+void CWallet::EraseFromWalletCoins(const COutPoint& outpoint, CAmount nValue) const
+{
+    if (!mapSpendableCoins.erase(outpoint) && !mapWatchOnlyCoins.erase(outpoint)) return;
+    auto range = mapCoinsByValue.equal_range(nValue);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == outpoint) {
+            mapCoinsByValue.erase(it);
+            break;
+        }
+    }
+}
+
+void CWallet::ReindexWalletCoins() const
+{
+    AssertLockHeld(cs_wallet);
+    if (!fWalletCoinsDirty) return;
+    mapSpendableCoins.clear();
+    mapWatchOnlyCoins.clear();
+    mapCoinsByValue.clear();
+    for (const auto& it : mapWallet)
+        AddToWalletCoins(it.second);
+    fWalletCoinsDirty = false;
+}
+
 void CWallet::EraseFromWallet(const uint256& hash)
 {
     if (!fFileBacked)
         return;
     {
         LOCK(cs_wallet);
+        auto it = mapWallet.find(hash);
+        if (it != mapWallet.end()) {
+            for (unsigned int i = 0; i < it->second.vout.size(); i++)
+                EraseFromWalletCoins(COutPoint(hash, i), it->second.vout[i].nValue);
+        }
         if (mapWallet.erase(hash)) {
             setWallet.erase(hash);
             CWalletDB(strWalletFile).EraseTx(hash);
@@ -1899,85 +2002,102 @@ bool CWallet::AvailableCoins(std::vector<COutput>* pCoins,      // --> populates
 
     LOCK2(cs_main, cs_wallet);
 
-    std::vector<uint256> vErase;
-
-    for (auto it = setWallet.begin(); it != setWallet.end(); ++it) {
-
-        const uint256& wtxid = *it;
-
-        auto it2 = mapWallet.find(wtxid);
-        if(it2 != mapWallet.end()) {
-            const CWalletTx* pcoin = &(*it2).second;
+    // A key or a script added since may have made more coins ours
+    ReindexWalletCoins();
 
-            // Check if the tx is selectable
-            int nDepth;
-            if (!CheckTXAvailability(pcoin, fOnlyConfirmed, nDepth))
-                continue;
-
-            // Check min depth requirement for stake inputs
-            if (nCoinType == STAKEABLE_COINS && nDepth < nStakeMinDepth) continue;
-
-            int nMine = 0;
-            int nMineSpent = 0;
-
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
+    // Deeply spent coins, dropped from the index
+    std::vector<std::pair<COutPoint, CAmount> > vErase;
 
-                int nSpendDepth;
-                bool spent = IsSpent(wtxid, i, nSpendDepth);
-                isminetype mine = IsMine(pcoin->vout[i]);
+    // Availability and depth of the last tx seen, its coins come in a row
+    const CWalletTx* pcoinLast = nullptr;
+    bool fAvailableLast = false;
+    int nDepthLast = 0;
 
-                // Check If not mine
-                if (mine == ISMINE_NO) continue;
-
-                nMine++;
-
-                // Check if the utxo was spent.
-                if (spent) {
-                    if(nSpendDepth > nMaxReorgDepth) nMineSpent++;
-                    continue;
-                }
+    // Returns false once the search can stop
+    auto processCoin = [&](const COutPoint& outpoint, const CWalletCoin& coin) -> bool {
+        const CWalletTx* pcoin = coin.pwtx;
+        const uint256& wtxid = outpoint.hash;
+        const unsigned int i = outpoint.n;
 
-                // Check for only 10k utxo
-                if (nCoinType == ONLY_10000 && !CMasternode::CheckMasternodeCollateral(pcoin->vout[i].nValue)) continue;
+        // Check if the tx is selectable
+        if (pcoin != pcoinLast) {
+            pcoinLast = pcoin;
+            fAvailableLast = CheckTXAvailability(pcoin, fOnlyConfirmed, nDepthLast);
+        }
+        if (!fAvailableLast) return true;
+        const int nDepth = nDepthLast;
 
-                // Check if watch only utxo are allowed
-                if (mine == ISMINE_WATCH_ONLY && coinControl && !coinControl->fAllowWatchOnly) continue;
+        // Check min depth requirement for stake inputs
+        if (nCoinType == STAKEABLE_COINS && nDepth < nStakeMinDepth) return true;
 
-                // Skip locked utxo
-                if (IsLockedCoin(wtxid, i) && nCoinType != ONLY_10000) continue;
+        // Check if the utxo was spent.
+        int nSpendDepth;
+        if (IsSpent(wtxid, i, nSpendDepth)) {
+            if (nSpendDepth > nMaxReorgDepth) vErase.emplace_back(outpoint, pcoin->vout[i].nValue);
+            return true;
+        }
 
-                // Skip configured masternode collaterals
-                if (masternodeConfig.contains(COutPoint(wtxid, i)) && nCoinType != ONLY_10000) continue;
+        // Check for only 10k utxo
+        if (nCoinType == ONLY_10000 && !CMasternode::CheckMasternodeCollateral(pcoin->vout[i].nValue)) return true;
 
-                // Check if we should include zero value utxo
-                if (pcoin->vout[i].nValue <= 0) continue;
+        // Skip locked utxo
+        if (IsLockedCoin(wtxid, i) && nCoinType != ONLY_10000) return true;
 
-                if (fCoinsSelected && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(COutPoint(wtxid, i)))
-                    continue;
+        // Skip configured masternode collaterals
+        if (masternodeConfig.contains(outpoint) && nCoinType != ONLY_10000) return true;
 
-                bool solvable = IsSolvable(*this, pcoin->vout[i].scriptPubKey);
+        if (fCoinsSelected && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(outpoint))
+            return true;
 
-                bool spendable = ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
-                        (((mine & ISMINE_WATCH_ONLY) != ISMINE_NO) && (coinControl && coinControl->fAllowWatchOnly && solvable));
+        bool spendable = ((coin.mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
+                (((coin.mine & ISMINE_WATCH_ONLY) != ISMINE_NO) && (coinControl && coinControl->fAllowWatchOnly && coin.fSolvable));
 
-                // found valid coin
-                if (!pCoins) return true;
-                pCoins->emplace_back(COutput(pcoin, i, nDepth, spendable, solvable));
+        // found valid coin
+        if (!pCoins) return false;
+        pCoins->emplace_back(COutput(pcoin, i, nDepth, spendable, coin.fSolvable));
+        return true;
+    };
+
+    bool fContinue = true;
+    if (nCoinType == ONLY_10000) {
+        // only the coins of a collateral value
+        std::set<CAmount> setCollaterals = {CMasternode::GetCurrentMasternodeCollateral(), CMasternode::GetNextWeekMasternodeCollateral()};
+        for (const CAmount nCollateral : setCollaterals) {
+            auto range = mapCoinsByValue.equal_range(nCollateral);
+            for (auto it = range.first; fContinue && it != range.second; ++it) {
+                auto itCoin = mapSpendableCoins.find(it->second);
+                if (itCoin == mapSpendableCoins.end()) {
+                    // Check if watch only utxo are allowed
+                    if (coinControl && !coinControl->fAllowWatchOnly) continue;
+                    itCoin = mapWatchOnlyCoins.find(it->second);
+                    if (itCoin == mapWatchOnlyCoins.end()) continue;
+                }
+                fContinue = processCoin(itCoin->first, itCoin->second);
             }
+        }
+    } else {
+        for (auto it = mapSpendableCoins.begin(); fContinue && it != mapSpendableCoins.end(); ++it)
+            fContinue = processCoin(it->first, it->second);
 
-            if(nDepth > 0 && nMine > 0 && nMine == nMineSpent) {
-                vErase.push_back(wtxid);
-            }
+        // Watch only utxo, when allowed. They can't sign a coinstake.
+        if (nCoinType != STAKEABLE_COINS && !(coinControl && !coinControl->fAllowWatchOnly)) {
+            for (auto it = mapWatchOnlyCoins.begin(); fContinue && it != mapWatchOnlyCoins.end(); ++it)
+                fContinue = processCoin(it->first, it->second);
         }
     }
 
-    if(vErase.size() > 0) {
-        for (auto& h : vErase) {
-            setWallet.erase(h);
+    // Drop the deeply spent coins, and the txes left without coins
+    for (const auto& p : vErase) {
+        EraseFromWalletCoins(p.first, p.second);
+        auto itSpendable = mapSpendableCoins.lower_bound(COutPoint(p.first.hash, 0));
+        auto itWatchOnly = mapWatchOnlyCoins.lower_bound(COutPoint(p.first.hash, 0));
+        if ((itSpendable == mapSpendableCoins.end() || itSpendable->first.hash != p.first.hash) &&
+            (itWatchOnly == mapWatchOnlyCoins.end() || itWatchOnly->first.hash != p.first.hash)) {
+            setWallet.erase(p.first.hash);
         }
-        setWallet.rehash(0);
     }
 
+    if (!fContinue) return true;
     return (pCoins && pCoins->size() > 0);
 }
 
@@ -2552,10 +2672,24 @@ bool CWallet::CreateCoinStake(
     }
     pStakerStatus->SetLastValue(nStakedValue);
 
-    for (const COutput &out : *availableCoins) {
-        CPivStake stakeInput;
-        stakeInput.SetPrevout((CTransaction) *out.tx, out.i);
+    // Batch kernel search over all the coins and time slots
+    CStakeKernelSearch kernelSearch(pindexPrev, nBits);
+    std::vector<CPivStake> vStakeInputs;
+    vStakeInputs.reserve(availableCoins->size());
+    {
+        LOCK2(cs_main, cs_wallet);
+        for (const COutput &out : *availableCoins) {
+            CStakeCandidate candidate;
+            if (!GetStakeCandidate(out, candidate)) continue;
+            CPivStake stakeInput;
+            stakeInput.SetPrevout(COutPoint(out.tx->GetHash(), out.i), candidate.out, candidate.pindexFrom);
+            if (kernelSearch.AddInput(&stakeInput))
+                vStakeInputs.push_back(stakeInput);
+        }
+    }
 
+    size_t nNextInput = 0;
+    while (true) {
         //new block came in, move on
         if (WITH_LOCK(cs_main, return chainActive.Height()) != pindexPrev->nHeight) return false;
 
@@ -2564,14 +2698,17 @@ bool CWallet::CreateCoinStake(
 
         nCredit = 0;
 
-        nAttempts++;
-        fKernelFound = Stake(pindexPrev, &stakeInput, nBits, nTxNewTime);
+        size_t nInput = 0;
+        fKernelFound = kernelSearch.Search(nNextInput, nInput, nTxNewTime);
+        nAttempts += (int) ((fKernelFound ? nInput + 1 : vStakeInputs.size()) - nNextInput);
 
         // update staker status (time, attempts)
         pStakerStatus->SetLastTime(nTxNewTime);
         pStakerStatus->SetLastTries(nAttempts);
 
-        if (!fKernelFound) continue;
+        if (!fKernelFound) break;
+        nNextInput = nInput + 1;
+        CPivStake& stakeInput = vStakeInputs[nInput];
 
         // Found a kernel
         LogPrintf("CreateCoinStake : kernel found\n");
@@ -2781,6 +2918,10 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
     if (nLoadWalletRet != DB_LOAD_OK)
         return nLoadWalletRet;
 
+    // Index the coins once all the keys and scripts are loaded
+    for (const auto& it : mapWallet)
+        AddToWalletCoins(it.second);
+
     uiInterface.LoadWallet(this);
 
     return DB_LOAD_OK;
@@ -3921,6 +4062,8 @@ void CWallet::SetNull()
 
     // Max record in the UI
     nLoadedRecordsMaxCount = MAX_AMOUNT_LOADED_RECORDS;
+
+    fWalletCoinsDirty = false;
 }
 
 bool CWallet::isMultiSendEnabled()
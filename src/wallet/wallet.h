@@ -228,6 +228,13 @@ struct CRecipient
     {}
 };
 
+/** A wallet output confirmed in the active chain, with what the staker needs of it */
+struct CStakeCandidate
+{
+    CTxOut out;
+    CBlockIndex* pindexFrom;
+};
+
 
 /**
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
@@ -268,6 +275,15 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Stake candidates by outpoint, so the minter reads the kernel data of its
+     * coins from memory instead of looking their transactions up on disk.
+     * Kept up to date by SyncTransaction, filled lazily for the coins confirmed
+     * before the wallet was loaded.
+     */
+    std::map<COutPoint, CStakeCandidate> mapStakeCandidates;
+    void UpdateStakeCandidates(const CTransaction& tx, const CBlockIndex* pindex, int posInBlock);
+
     bool IsKeyUsed(const CPubKey& vchPubKey);
 
 
@@ -347,6 +363,29 @@ public:
     boost::unordered_map<uint256, CWalletTx, uint256CheapHasher> mapWallet;
     mutable boost::unordered_set<uint256, uint256CheapHasher> setWallet;
 
+    //! A wallet coin, with its ownership and solvability computed when indexed
+    struct CWalletCoin {
+        const CWalletTx* pwtx;
+        isminetype mine;
+        bool fSolvable;
+    };
+    /**
+     * Outputs of the wallet txes that are mine, with a positive value, and not
+     * spent deeper than -maxreorg. They are partitioned into spendable and watch
+     * only coins and indexed by value for the masternode collaterals, so
+     * AvailableCoins only walks the coins its coin type asks for. Deeply spent
+     * coins are dropped by AvailableCoins, like setWallet txes.
+     */
+    mutable std::map<COutPoint, CWalletCoin> mapSpendableCoins;
+    mutable std::map<COutPoint, CWalletCoin> mapWatchOnlyCoins;
+    mutable std::multimap<CAmount, COutPoint> mapCoinsByValue;
+    //! Keys, scripts or watch-only scripts changed since the coins were indexed
+    mutable bool fWalletCoinsDirty;
+    void AddToWalletCoins(const CWalletTx& wtx) const;
+    void EraseFromWalletCoins(const COutPoint& outpoint, CAmount nValue) const;
+    //! Index again all the wallet coins, if their ownership may have changed
+    void ReindexWalletCoins() const;
+
     std::list<CAccountingEntry> laccentries;
 
     typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
@@ -380,6 +419,8 @@ public:
     bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
     //! >> Available coins (staking)
     bool StakeableCoins(std::vector<COutput>* pCoins = nullptr);
+    //! >> Stake candidate of an available coin, false if it is not confirmed in the active chain
+    bool GetStakeCandidate(const COutput& out, CStakeCandidate& candidateRet);
 
     std::map<CTxDestination, std::vector<COutput> > AvailableCoinsByAddress(bool fConfirmed = true, CAmount maxCoinValue = 0);
 
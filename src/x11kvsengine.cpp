@@ -0,0 +1,183 @@
+// Copyright (c) 2021-2022 The DECENOMY Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "x11kvsengine.h"
+
+#include "util/threadnames.h"
+
+#include <set>
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/thread.hpp>
+
+CX11KVSEngine x11kvsEngine;
+
+uint256 CX11KVSTree::HashX11KV(uint32_t nonce) const
+{
+    unsigned char header[80];
+    memcpy(header, prefix, 76);
+    le32enc(header + 76, nonce);
+    return ::HashX11KV(header, header + 80);
+}
+
+const uint256& CX11KVSTree::GetX11KV(uint32_t nonce)
+{
+    std::map<uint32_t, uint256>::iterator it = mapX11KV.find(nonce);
+    if (it == mapX11KV.end())
+        it = mapX11KV.emplace(nonce, HashX11KV(nonce)).first;
+    return it->second;
+}
+
+uint256 CX11KVSTree::GetNode(unsigned int level, uint32_t nonce)
+{
+    const uint256 hash = GetX11KV(nonce);
+    if (level == HASHX11KVS_MIN_LEVEL) return hash;
+
+    const std::pair<uint32_t, unsigned int> key(nonce, level);
+    std::map<std::pair<uint32_t, unsigned int>, uint256>::const_iterator it = mapNodes.find(key);
+    if (it != mapNodes.end()) return it->second;
+
+    uint32_t nonce1, nonce2;
+    GetChildNonces(nonce, hash, nonce1, nonce2);
+    const uint256 hash1 = GetNode(level - 1, nonce1);
+    const uint256 hash2 = GetNode(level - 1, nonce2);
+
+    const uint256 result = Hash(hash.begin(), hash.end(),
+                                hash1.begin(), hash1.end(),
+                                hash2.begin(), hash2.end());
+    mapNodes.emplace(key, result);
+    return result;
+}
+
+void CX11KVSTree::Prune(uint32_t nonce)
+{
+    mapX11KV.erase(mapX11KV.begin(), mapX11KV.lower_bound(nonce));
+    mapNodes.erase(mapNodes.begin(), mapNodes.lower_bound(std::make_pair(nonce, 0u)));
+}
+
+void CX11KVSEngine::RunJob(boost::unique_lock<boost::mutex>& lock)
+{
+    CJob job = std::move(queue.front());
+    queue.pop_front();
+    lock.unlock();
+    job.func();
+    lock.lock();
+    if (--(*job.pnTodo) == 0)
+        condDone.notify_all();
+}
+
+void CX11KVSEngine::Thread()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nWorkers++;
+    try {
+        while (true) {
+            while (queue.empty())
+                condWorker.wait(lock); // interruption point
+            RunJob(lock);
+        }
+    } catch (...) {
+        nWorkers--;
+        // wake up the callers, so they run the leftovers themselves
+        condDone.notify_all();
+        throw;
+    }
+}
+
+int CX11KVSEngine::GetWorkers()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return nWorkers;
+}
+
+void CX11KVSEngine::Execute(std::vector<std::function<void()> >& vJobs)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (nWorkers == 0 || vJobs.size() < 2) {
+        lock.unlock();
+        for (std::function<void()>& func : vJobs)
+            func();
+        return;
+    }
+
+    size_t nTodo = vJobs.size();
+    for (std::function<void()>& func : vJobs)
+        queue.push_back(CJob{std::move(func), &nTodo});
+    condWorker.notify_all();
+
+    // The caller joins the pool until its own jobs are done. It may run
+    // somebody else's jobs meanwhile, which is fine. The jobs write to the
+    // caller's stack, so it can't unwind on an interruption before they are
+    // all done: the interruption is left pending for the caller to honor.
+    boost::this_thread::disable_interruption noInterruption;
+    while (nTodo > 0) {
+        if (!queue.empty())
+            RunJob(lock);
+        else
+            condDone.wait(lock);
+    }
+}
+
+uint256 CX11KVSEngine::Hash(const unsigned char* pheader, unsigned int level)
+{
+    CX11KVSTree tree(pheader);
+    const uint32_t nonce = le32dec(pheader + 76);
+
+    if (GetWorkers() > 0) {
+        // Evaluate the X11KV hashes of each depth of the tree on the pool.
+        // The next depth is only known once the current one is hashed.
+        std::set<uint32_t> setFrontier;
+        setFrontier.insert(nonce);
+        for (unsigned int nLevel = level; ; nLevel--) {
+            std::vector<uint32_t> vNonces;
+            for (const uint32_t n : setFrontier)
+                if (!tree.HaveX11KV(n)) vNonces.push_back(n);
+
+            std::vector<uint256> vHashes(vNonces.size());
+            std::vector<std::function<void()> > vJobs;
+            vJobs.reserve(vNonces.size());
+            for (size_t i = 0; i < vNonces.size(); i++) {
+                uint256* phash = &vHashes[i];
+                const uint32_t n = vNonces[i];
+                vJobs.emplace_back([&tree, phash, n]() { *phash = tree.HashX11KV(n); });
+            }
+            Execute(vJobs);
+            for (size_t i = 0; i < vNonces.size(); i++)
+                tree.SetX11KV(vNonces[i], vHashes[i]);
+
+            if (nLevel <= HASHX11KVS_MIN_LEVEL) break;
+
+            std::set<uint32_t> setNext;
+            for (const uint32_t n : setFrontier) {
+                uint32_t nonce1, nonce2;
+                CX11KVSTree::GetChildNonces(n, tree.GetX11KV(n), nonce1, nonce2);
+                setNext.insert(nonce1);
+                setNext.insert(nonce2);
+            }
+            setFrontier.swap(setNext);
+        }
+    }
+
+    // All the X11KV are memoized at this point when running on the pool,
+    // so only the double SHA256 combinations are left.
+    return tree.GetNode(level, nonce);
+}
+
+void CX11KVSEngine::HashBatch(const unsigned char* pheaders, size_t nCount, uint256* phashes)
+{
+    std::vector<std::function<void()> > vJobs;
+    vJobs.reserve(nCount);
+    for (size_t i = 0; i < nCount; i++) {
+        const unsigned char* pheader = pheaders + i * 80;
+        uint256* phash = phashes + i;
+        vJobs.emplace_back([pheader, phash]() { *phash = CX11KVSTree(pheader).GetNode(HASHX11KVS_MAX_LEVEL, le32dec(pheader + 76)); });
+    }
+    Execute(vJobs);
+}
+
+void ThreadX11KVSHash()
+{
+    util::ThreadRename("pivx-x11kvs");
+    x11kvsEngine.Thread();
+}
@@ -0,0 +1,134 @@
+// Copyright (c) 2021-2022 The DECENOMY Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef KYAN_X11KVSENGINE_H
+#define KYAN_X11KVSENGINE_H
+
+#include "hash.h"
+#include "uint256.h"
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/** Maximum number of X11KVS hashing threads */
+static const int MAX_X11KVS_THREADS = 16;
+/** -parhash default (number of X11KVS hashing threads, 0 = auto) */
+static const int DEFAULT_X11KVS_THREADS = 0;
+
+/**
+ * Memo of X11KVS trees over one 76-byte header prefix. All the nodes of a tree
+ * share the prefix and differ only on the nonce, so the X11KV results and the
+ * combined subtrees are kept by nonce. Used for a single header by the engine,
+ * and across consecutive nonces by the proof-of-work scanner: the children of
+ * a node are never below its nonce, so what is below the next nonce to hash
+ * can be pruned.
+ */
+class CX11KVSTree
+{
+private:
+    unsigned char prefix[76];
+    //! nonce -> X11KV(prefix || nonce)
+    std::map<uint32_t, uint256> mapX11KV;
+    //! (nonce, level) -> X11KVS subtree hash
+    std::map<std::pair<uint32_t, unsigned int>, uint256> mapNodes;
+
+public:
+    explicit CX11KVSTree(const unsigned char* pheader) { memcpy(prefix, pheader, sizeof(prefix)); }
+
+    const unsigned char* GetPrefix() const { return prefix; }
+
+    uint256 HashX11KV(uint32_t nonce) const;
+
+    bool HaveX11KV(uint32_t nonce) const { return mapX11KV.count(nonce); }
+    void SetX11KV(uint32_t nonce, const uint256& hash) { mapX11KV[nonce] = hash; }
+    const uint256& GetX11KV(uint32_t nonce);
+
+    static void GetChildNonces(uint32_t nonce, const uint256& hash, uint32_t& nonce1, uint32_t& nonce2)
+    {
+        nonce1 = nonce + (le32dec(hash.begin() + 24) % HASHX11KVS_MAX_DRIFT);
+        nonce2 = nonce + (le32dec(hash.begin() + 28) % HASHX11KVS_MAX_DRIFT);
+    }
+
+    /** Combine the subtree rooted at (level, nonce), evaluating any X11KV not memoized yet */
+    uint256 GetNode(unsigned int level, uint32_t nonce);
+
+    /** Forget the memo below nonce */
+    void Prune(uint32_t nonce);
+
+    //! Number of memoized X11KV hashes and subtrees
+    size_t GetSize() const { return mapX11KV.size() + mapNodes.size(); }
+};
+
+/**
+ * Evaluation engine for the X11KVS hash tree.
+ *
+ * Within one call the X11KV results are memoized by nonce in a CX11KVSTree
+ * and every (level, nonce) subtree is combined only once. Sibling
+ * nonces collide often inside HASHX11KVS_MAX_DRIFT, which makes the memo
+ * save a good part of the 2^7-1 X11KV evaluations.
+ *
+ * Hash() expands the tree one depth at a time and computes the X11KV hashes
+ * of each depth on the worker pool. HashBatch() spreads whole headers over
+ * the pool instead, which is what header sync and reindex want.
+ *
+ * Worker threads are started by the caller (see ThreadX11KVSHash) and leave
+ * on thread interruption. Without workers, all the work runs inline on the
+ * calling thread, so the engine is usable before init and in the tools.
+ */
+class CX11KVSEngine
+{
+private:
+    struct CJob {
+        std::function<void()> func;
+        size_t* pnTodo;
+    };
+
+    //! Mutex to protect the inner state
+    boost::mutex mutex;
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+    //! Callers block on this while their jobs are being run by the workers
+    boost::condition_variable condDone;
+    //! The queue of jobs to be processed, from all the callers
+    std::deque<CJob> queue;
+    //! The number of worker threads currently running
+    int nWorkers;
+
+    /** Run one job taken from the queue. The lock is released while the job runs. */
+    void RunJob(boost::unique_lock<boost::mutex>& lock);
+
+public:
+    CX11KVSEngine() : nWorkers(0) {}
+
+    //! Worker thread
+    void Thread();
+
+    //! Number of worker threads currently serving the engine
+    int GetWorkers();
+
+    /**
+     * Run the jobs on the worker pool, the calling thread helping out, and return when all of them are done.
+     * Also open to other hashing work that splits well, like the staker kernel search.
+     * It is not an interruption point: an interruption of the caller is honored at its next one.
+     */
+    void Execute(std::vector<std::function<void()> >& vJobs);
+
+    /** X11KVS hash of a serialized (little endian) 80-byte header, same as HashX11KVS(p, p + 80, level) */
+    uint256 Hash(const unsigned char* pheader, unsigned int level = HASHX11KVS_MAX_LEVEL);
+
+    /** X11KVS hashes of nCount serialized 80-byte headers stored back to back */
+    void HashBatch(const unsigned char* pheaders, size_t nCount, uint256* phashes);
+};
+
+extern CX11KVSEngine x11kvsEngine;
+
+/** Run an instance of the X11KVS hashing worker */
+void ThreadX11KVSHash();
+
+#endif // KYAN_X11KVSENGINE_H